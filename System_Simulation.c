@@ -10,25 +10,313 @@
  * 
  * @authors Mert Çolakoğlu, Emrah Tunç, Binnur Söztutar
  * @course Operating Systems
- * @platform macOS only
+ * @platform Linux and macOS (POSIX threads) - see the Platform functions for the differences
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE // CPU affinity: sched_getaffinity, pthread_attr_setaffinity_np
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+/* Default configuration - every value can be overridden at runtime (see SimConfig) */
+#define DEFAULT_NUM_CARS 12
+#define DEFAULT_NUM_MINIBUSES 10
+#define DEFAULT_NUM_TRUCKS 8
+#define DEFAULT_FERRY_CAPACITY 20
+#define DEFAULT_TOLL_BOOTHS 2  // per side
+#define DEFAULT_NUM_FERRIES 1
+#define DEFAULT_ERRAND_WORKERS 2
+#define DEFAULT_LATENCY_BUDGET 30 // Seconds the adaptive scheduler lets a ferry wait to fill up
+#define ARRIVAL_SMOOTHING 0.125   // Weight of the newest arrival in the smoothed arrival rate
+#define DEFAULT_BOOTH_OPEN_QUEUE 4  // Open a booth when more vehicles than this queue per open booth
+#define DEFAULT_BOOTH_CLOSE_QUEUE 1 // Close one when at most this many would queue per remaining booth
+#define DEFAULT_BOOTH_OPEN_WAIT 10  // Also open one when the front vehicle has queued this many seconds
+#define BOOTH_SCALING_COOLDOWN (5 * NS_PER_SECOND) // Least time between two booth changes on a side
+#define DEFAULT_SIMULATION_TIME 180 // 3 minutes
 
-/* Constants - define the size and constraints of the simulation */
-#define MAX_VEHICLES 30
-#define MAX_CAPACITY 20
-#define NUM_TOLL_BOOTHS 2  // per side
-#define SIMULATION_TIME 180 // 3 minutes
+/* Constants */
 #define MAX_NAME_LENGTH 30
+#define MAX_CONFIG_LINE 256
+#define ARENA_ALIGNMENT 16
+#define ARENA_MIN_BLOCK (64 * 1024)
+#define VEHICLE_POOL_BATCH 256
+#define VEHICLE_QUEUE_MIN_STORAGE 64 // Queues start this small and double up to their capacity
+#define ARENA_ROUND(bytes) (((bytes) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+#define SNAPSHOT_MAX_ATTEMPTS 64  // Reads before a metrics snapshot settles for a torn copy
+#define LOG_RING_SIZE 4096        // Must be a power of two
+#define LOG_TEXT_LENGTH 192
+#define NS_PER_SECOND 1000000000LL
+#define MAX_DETAILED_RECORDS 100 // Vehicles listed one by one in the report
+#define STATS_BATCH 64            // Completed vehicles the statistics kernels take per pass
+#define HISTOGRAM_SUB_BITS 6      // 64 exact buckets, then 32 per power of two - about 3% relative precision
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (HISTOGRAM_SUB_BUCKETS + (64 - HISTOGRAM_SUB_BITS) * (HISTOGRAM_SUB_BUCKETS / 2))
+#define TRACE_MAGIC "FERRYTRC"
+#define TRACE_VERSION 3
+#define CHECKPOINT_MAGIC "FERRYCKP"
+#define CHECKPOINT_VERSION 2
 
 /* Mutex for thread synchronization - essential for shared data access protection */
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled (with mutex) whenever total_vehicles_transported changes - set up by
+ * initialize_simulation, as timed waits need platform_cond_init's clock */
+pthread_cond_t simulation_progress;
+
+/* Loading policies - which ready vehicles fill the ferry's free quota */
+typedef enum {
+    LOADING_FIFO,          // Board in arrival order, skipping vehicles that no longer fit
+    LOADING_GREEDY,        // Largest vehicles first
+    LOADING_EXACT_FILL,    // Fill as much quota as possible (exact search over per-type counts)
+    LOADING_POLICY_COUNT
+} LoadingPolicy;
+
+const char* loading_policy_names[LOADING_POLICY_COUNT] = { "fifo", "greedy", "exact" };
+
+/* How the terminals are connected by routes */
+typedef enum {
+    TOPOLOGY_LINE,         // 0-1, 1-2, ... - every terminal but the ends is a transfer point
+    TOPOLOGY_RING,         // The line closed back to terminal 0
+    TOPOLOGY_STAR,         // Terminal 0 is a hub with a route to every other terminal
+    TOPOLOGY_COUNT
+} Topology;
+
+const char* topology_names[TOPOLOGY_COUNT] = { "line", "ring", "star" };
+
+/* Departure schedulers - when a loaded ferry leaves (see departure_schedulers) */
+typedef enum {
+    DEPARTURE_RULES,       // The fixed rule cascade: full, nearly full, final trip, other side waiting
+    DEPARTURE_ADAPTIVE,    // Leave when the expected time to fill up exceeds the latency budget
+    DEPARTURE_POLICY_COUNT
+} DeparturePolicy;
+
+const char* departure_policy_names[DEPARTURE_POLICY_COUNT] = { "rules", "adaptive" };
+
+/* Why a crossing started - set by the departure scheduler or ferry_decide */
+typedef enum {
+    TRIP_REASON_FULL,          // At full capacity
+    TRIP_REASON_NOTHING_FITS,  // 1-3 quotas free and no vehicle that fits is coming
+    TRIP_REASON_FINAL,         // Every remaining vehicle is aboard
+    TRIP_REASON_OTHER_SIDE,    // Nothing more here, vehicles wait at the other end
+    TRIP_REASON_BOTH_EMPTY,    // Nothing waits at either end
+    TRIP_REASON_BUDGET,        // Adaptive: filling up would exceed the latency budget
+    TRIP_REASON_FIRST_RETURN,  // The deliberate empty return after the first outbound trip
+    TRIP_REASON_REPOSITION,    // Empty leg towards waiting vehicles
+    TRIP_REASON_COUNT
+} TripReason;
+
+const char* trip_reason_names[TRIP_REASON_COUNT] = {
+    "full", "nothing-fits", "final", "other-side", "both-empty", "budget", "first-return", "reposition"
+};
+
+/* Log verbosity - a message is written when its level is at or below the configured one */
+typedef enum {
+    LOG_SILENT,            // Nothing at all, not even the report (benchmark runs)
+    LOG_SUMMARY,           // Banner, milestones and the final report
+    LOG_INFO,              // Every vehicle and ferry state change (default)
+    LOG_DEBUG,             // As info, each line prefixed with its timestamp and event fields
+    LOG_LEVEL_COUNT
+} LogLevel;
+
+const char* log_level_names[LOG_LEVEL_COUNT] = { "silent", "summary", "info", "debug" };
+
+/* What a log record is about - stored with every record next to the formatted text */
+typedef enum {
+    LOG_EVENT_GENERAL,
+    LOG_EVENT_QUEUE,         // Vehicle joined (or could not join) a toll queue
+    LOG_EVENT_TOLL,          // Toll booth processing
+    LOG_EVENT_WAITING_AREA,
+    LOG_EVENT_BOARDING,
+    LOG_EVENT_DEPARTURE,     // Departure decisions and departures
+    LOG_EVENT_TRIP,          // Docking and completed crossings
+    LOG_EVENT_UNLOADING,
+    LOG_EVENT_ERRAND,
+    LOG_EVENT_DISPATCH,
+    LOG_EVENT_COUNT
+} LogEvent;
+
+const char* log_event_names[LOG_EVENT_COUNT] = {
+    "general", "queue", "toll", "waiting", "boarding", "departure", "trip", "unloading", "errand",
+    "dispatch"
+};
+
+/* Lifecycle events recorded in the binary trace - the moments VehicleTiming stamps */
+typedef enum {
+    TRACE_ARRIVAL,          // Joined a toll queue (outbound or return)
+    TRACE_TOLL_ENTRY,
+    TRACE_WAITING_AREA,
+    TRACE_BOARDING,
+    TRACE_UNLOAD,           // Outbound crossing over
+    TRACE_ERRAND_START,
+    TRACE_ERRAND_END,
+    TRACE_COMPLETE,         // Return crossing over - round trip done
+    TRACE_FERRY_DEPART,
+    TRACE_FERRY_ARRIVE,
+    TRACE_EVENT_COUNT
+} TraceEvent;
+
+/* One fixed-size trace record (32 bytes, native byte order) */
+typedef struct {
+    int64_t time_ns;        // sim_now() when the event happened
+    int32_t id;             // Vehicle id, or ferry index for ferry events
+    int32_t trip_number;    // Crossing the event belongs to, 0 if none yet
+    int32_t unit;           // Booth number for toll entries, ferry index for boarding/unloading,
+                            // the other end of the crossing for ferry events
+    int32_t quota;          // Vehicle quota, or the load for ferry events
+    int32_t vehicles;       // Vehicles aboard, ferry events only
+    uint8_t event;          // TraceEvent
+    uint8_t vehicle_type;   // VehicleType, 0 for ferry events
+    uint8_t side;           // SideId where it happened (ferry events: departure/arrival side)
+    uint8_t leg;            // 0 outbound, 1 return
+} TraceRecord;
+
+/* Trace file header - the run's configuration plus what replay needs to check the file */
+typedef struct {
+    char magic[8];          // TRACE_MAGIC, not NUL-terminated
+    uint32_t version;
+    uint32_t record_size;
+    int32_t num_cars;
+    int32_t num_minibuses;
+    int32_t num_trucks;
+    int32_t ferry_capacity;
+    int32_t num_ferries;
+    int32_t booths_per_side;
+    int32_t loading_policy;
+    int32_t virtual_clock;
+    int64_t record_count;
+    int64_t duration_ns;    // Total simulation time, as in the report
+} TraceHeader;
+
+/* Runtime configuration - loaded from the command line and/or a config file */
+typedef struct {
+    int num_cars;                 // 1 quota each
+    int num_minibuses;            // 2 quotas each
+    int num_trucks;               // 3 quotas each
+    int ferry_capacity;           // Ferry capacity in quotas
+    int booths_per_side;          // Toll booths on each side
+    int num_ferries;              // Ferries operating on the route
+    int errand_workers;           // Threads that return vehicles from their errands
+    int simulation_time;          // Maximum simulation time in seconds
+    int queue_capacity;           // Per-side queue/waiting area limit, 0 = whole fleet fits
+    int virtual_clock;            // 1 = discrete-event engine, delays advance a simulated clock
+    LoadingPolicy loading_policy; // Shared by the departure decision and the loader
+    LogLevel log_level;
+    char trace_file[MAX_CONFIG_LINE];  // Binary event trace to write, "" = none
+    char replay_file[MAX_CONFIG_LINE]; // Trace to analyse instead of running a simulation
+    char latency_export[MAX_CONFIG_LINE]; // Latency percentiles as CSV (or JSON for *.json)
+    char trip_export[MAX_CONFIG_LINE];    // Per-trip telemetry as CSV, "" = none
+    char stats_file[MAX_CONFIG_LINE];     // Live metrics in Prometheus text format, "" = off
+    int stats_interval;           // Seconds between live metrics snapshots
+    int seed;                     // Random seed, 0 = seeded from the current time
+    char batch_file[MAX_CONFIG_LINE];  // Parameter sweep to run instead of a single simulation
+    int batch_jobs;               // Simulations run at once in a batch, 0 = one per CPU
+    int batch_runs;               // Runs of every batch line, each with its own seed
+    char bench_file[MAX_CONFIG_LINE];  // Run the benchmark ladder and write JSON results here
+    int bench_max_vehicles;       // Largest fleet the benchmark ladder goes up to
+    int bench_real_time;          // Seconds per real-time benchmark case, 0 = virtual clock only
+    int num_terminals;            // Terminals in the network, 2 = the classic single route
+    Topology topology;            // How the terminals are connected
+    int arrival_rate;             // Poisson arrivals per hour at each terminal, 0 = whole fleet at the start
+    char arrival_file[MAX_CONFIG_LINE]; // Recorded arrivals to replay (CSV), "" = none
+    DeparturePolicy departure_policy; // When a loaded ferry leaves
+    int latency_budget;           // Adaptive scheduler: longest expected wait to fill up, in seconds
+    int booths_max;               // Booths a side may open under load, 0 = always booths_per_side
+    int booth_open_queue;         // Queued vehicles per open booth above which another one opens
+    int booth_close_queue;        // Queued vehicles per remaining booth at or below which one closes
+    int booth_open_wait;          // Seconds the front vehicle may queue before another booth opens
+    char checkpoint_file[MAX_CONFIG_LINE]; // World state to save (virtual clock), "" = none
+    int checkpoint_interval;      // Simulated seconds between checkpoints, 0 = only at the end
+    char resume_file[MAX_CONFIG_LINE];     // Checkpoint to continue from, "" = start afresh
+    int pin_threads;              // 1 = booth and ferry threads pinned to the CPUs in turn (Linux)
+} SimConfig;
+
+SimConfig config = {
+    DEFAULT_NUM_CARS, DEFAULT_NUM_MINIBUSES, DEFAULT_NUM_TRUCKS,
+    DEFAULT_FERRY_CAPACITY, DEFAULT_TOLL_BOOTHS, DEFAULT_NUM_FERRIES, DEFAULT_ERRAND_WORKERS,
+    DEFAULT_SIMULATION_TIME, 0, 0,
+    LOADING_FIFO, LOG_INFO, "", "", "", "", "", 1, 0, "", 0, 1, "", 1000000, 10,
+    2, TOPOLOGY_LINE, 0, "", DEPARTURE_RULES, DEFAULT_LATENCY_BUDGET,
+    0, DEFAULT_BOOTH_OPEN_QUEUE, DEFAULT_BOOTH_CLOSE_QUEUE, DEFAULT_BOOTH_OPEN_WAIT,
+    "", 0, "", 0
+};
+
+/* Mutex families whose contention is measured (see lock_mutex) */
+typedef enum {
+    LOCK_WAITING_AREA,        // CityPart.mutex
+    LOCK_TOLL_QUEUE,          // CityPart.queue_mutex
+    LOCK_FERRY,               // Ferry.mutex
+    LOCK_VEHICLE_RECORDS,     // vehicle_records_mutex
+    LOCK_CLASS_COUNT
+} LockClass;
+
+const char* lock_class_names[LOCK_CLASS_COUNT] = {
+    "waiting_area", "toll_queue", "ferry", "vehicle_records"
+};
+
+/* One simulation of a batch */
+typedef struct {
+    SimConfig config;
+    char parameters[MAX_CONFIG_LINE]; // The batch file line, shown in the results
+    int line;                     // Batch file line the run came from - groups the replicas
+    unsigned int seed;
+    pid_t pid;                    // Process running it, 0 once finished
+} BatchRun;
+
+/* What one run reported - written by its process into memory shared with the runner */
+typedef struct {
+    int status;                   // 0 = not finished, 1 = finished, -1 = failed
+    double duration;              // Simulated seconds, as in the report
+    int fleet_size;
+    int vehicles_transported;     // Completed round trips
+    int trips;
+    double utilisation;           // Quota carried per quota offered, percent
+    double round_trip_p50;        // Seconds
+    double round_trip_p99;
+    double round_trip_mean;
+    double departure_wait;        // Mean seconds from the waiting area to departure
+    
+    // Simulator performance, used by --bench
+    double wall_seconds;          // Wall time of the run itself, setup excluded
+    long long events;             // Vehicle and ferry events processed
+    long peak_rss_kb;             // Peak resident set size of the run's process
+    long long lock_contended[LOCK_CLASS_COUNT];
+    long long lock_wait_ns[LOCK_CLASS_COUNT];
+} BatchResult;
+
+/* Terminals of the network - identified by these IDs, names are only for printing.
+ * The classic route is the two-terminal network Side_A <-> Side_B */
+typedef enum {
+    SIDE_A = 0,
+    SIDE_B = 1,
+    MAX_TERMINALS = 16
+} SideId;
+
+/* Printable terminal names, indexed by SideId */
+const char* side_names[MAX_TERMINALS] = {
+    "Side_A", "Side_B", "Side_C", "Side_D", "Side_E", "Side_F", "Side_G", "Side_H",
+    "Side_I", "Side_J", "Side_K", "Side_L", "Side_M", "Side_N", "Side_O", "Side_P"
+};
+
+/* One ferry route between two terminals - its ferries shuttle between the ends.
+ * ends[0] takes the part of Side_A in the first-trip rules of the two-terminal route */
+typedef struct {
+    SideId ends[2];
+} Route;
 
 /* Vehicle types with their quota requirements */
 typedef enum {
@@ -37,63 +325,303 @@ typedef enum {
     TRUCK = 3     // 3 quotas
 } VehicleType;
 
-/* Each vehicle has its own data and statistics */
+/* Vehicles that could board, counted per quota, plus the FIFO first-fit over them */
 typedef struct {
-    int id;
-    VehicleType type;
+    int available[TRUCK + 1];     // Indexed by quota
+    int fifo_take[TRUCK + 1];     // What boarding in arrival order would take
+    int fifo_remaining;           // Free quota left after the FIFO first-fit
+} LoadCandidates;
+
+/* How many vehicles of each quota a loading policy boards */
+typedef struct {
+    int take[TRUCK + 1];          // Indexed by quota
+    int vehicles;
     int quota;
-    char type_name[10];  // "CAR", "MINIBUS", or "TRUCK"
-    
+} LoadPlan;
+
+/* Ferry utilisation under the active loading policy, protected by mutex */
+typedef struct {
+    int departures;               // Every crossing, including empty repositioning
+    int loaded_departures;        // Crossings with at least one vehicle aboard
+    int full_departures;          // Crossings at full capacity
+    long long quota_carried;
+    long long quota_offered;      // Sum of capacity over all crossings
+    long long vehicles_departed;  // Vehicles aboard at departure, over all crossings
+    double departure_wait_seconds; // Their time from entering the waiting area to departure
+} LoadingStats;
+
+LoadingStats loading_stats = { 0, 0, 0, 0, 0, 0, 0.0 };
+
+/* One crossing, indexed by trip number - 28 bytes, so long runs stay cheap */
+typedef struct {
+    int32_t ferry;
+    int32_t vehicles;
+    int32_t quota;
+    uint8_t from;
+    uint8_t to;
+    uint8_t reason;               // TripReason
+    uint8_t arrived;              // 1 once the crossing is over
+    float dwell_seconds;          // Docked at the departure side, unloading included
+    float loading_seconds;        // First vehicle aboard to departure, 0 for empty legs
+    float crossing_seconds;
+} TripRecord;
+
+/* Every crossing of the run, protected by mutex */
+typedef struct {
+    TripRecord* records;
+    int count;
+    int capacity;
+} TripLog;
+
+TripLog trip_log = { NULL, 0, 0 };
+
+/* Journey stages with a latency distribution in the report */
+typedef enum {
+    LATENCY_QUEUE_WAIT,       // Arrival to toll entry, per leg
+    LATENCY_TOLL_SERVICE,     // Toll entry to waiting area, per leg
+    LATENCY_WAITING_DWELL,    // Waiting area to boarding, per leg
+    LATENCY_FERRY_RIDE,       // Boarding to unload, per leg
+    LATENCY_ROUND_TRIP,       // First arrival to completion, per vehicle
+    LATENCY_METRIC_COUNT
+} LatencyMetric;
+
+const char* latency_metric_names[LATENCY_METRIC_COUNT] = {
+    "queue_wait", "toll_service", "waiting_dwell", "ferry_ride", "round_trip"
+};
+
+/* HDR-style histogram of nanosecond durations: exact below HISTOGRAM_SUB_BUCKETS, then
+ * HISTOGRAM_SUB_BUCKETS / 2 linear buckets per power of two. Fixed size, whatever the sample count */
+typedef struct {
+    long long counts[HISTOGRAM_BUCKETS];
+    long long count;
+    long long min;
+    long long max;
+    double sum;
+} LatencyHistogram;
+
+/* Every metric overall, per vehicle type and per side (where the stage happened),
+ * protected by vehicle_records_mutex */
+typedef struct {
+    LatencyHistogram all[LATENCY_METRIC_COUNT];
+    LatencyHistogram by_type[TRUCK + 1][LATENCY_METRIC_COUNT];
+    LatencyHistogram by_side[MAX_TERMINALS][LATENCY_METRIC_COUNT];
+} LatencyStats;
+
+LatencyStats latency_stats;
+
+/* Printable vehicle type names, indexed by VehicleType */
+const char* vehicle_type_names[TRUCK + 1] = { "", "CAR", "MINIBUS", "TRUCK" };
+
+/* Nanoseconds on the simulation clock (see sim_now) */
+typedef long long SimTime;
+
+/* Cold per-vehicle data - timing statistics, only touched on state changes and for the report */
+typedef struct {
     // Tracking timing statistics for each step of the journey
-    time_t arrival_time;          // When the vehicle arrived at the queue
-    time_t toll_entry_time;       // When the vehicle entered a toll booth
-    time_t waiting_area_time;     // When the vehicle entered the waiting area
-    time_t boarding_time;         // When the vehicle boarded the ferry
-    time_t unload_time;           // When the vehicle was unloaded
+    SimTime arrival_time;         // When the vehicle arrived at the queue
+    SimTime toll_entry_time;      // When the vehicle entered a toll booth
+    SimTime waiting_area_time;    // When the vehicle entered the waiting area
+    SimTime boarding_time;        // When the vehicle boarded the ferry
+    SimTime unload_time;          // When the vehicle was unloaded
     
     // Return journey timing statistics
-    time_t arrival_time_return;   // When the vehicle arrived for return journey
-    time_t toll_entry_time_return;// When the vehicle entered toll booth for return
-    time_t waiting_area_time_return; // When the vehicle entered waiting area for return
-    time_t boarding_time_return;  // When the vehicle boarded for return journey
-    time_t complete_time;         // When the vehicle completed the round trip
+    SimTime arrival_time_return;  // When the vehicle arrived for return journey
+    SimTime toll_entry_time_return;// When the vehicle entered toll booth for return
+    SimTime waiting_area_time_return; // When the vehicle entered waiting area for return
+    SimTime boarding_time_return; // When the vehicle boarded for return journey
+    SimTime complete_time;        // When the vehicle completed the round trip
+} VehicleTiming;
+
+/* Hot per-vehicle data - what queue, waiting area and ferry scans read. Kept to one cache
+ * line; the timing stamps live in a separate array (see vehicle_pool_reserve) */
+typedef struct Vehicle {
+    VehicleTiming* timing;        // Cold data - must stay the first member (see VehicleSlot)
+    int id;
+    VehicleType type;
+    int quota;
     
     // Status tracking
     int is_transported;           // 1 if completed A to B, 2 if completed round trip
     int outbound_trip_number;     // Trip number for A to B journey
     int return_trip_number;       // Trip number for B to A journey
-    char origin[MAX_NAME_LENGTH]; // The origin side ("Side_A" or "Side_B")
-    char current_side[MAX_NAME_LENGTH]; // Current side of the vehicle
+    SideId origin_side;           // The origin side
+    SideId destination_side;      // Terminal of the errand, a route away from the origin
+    SideId return_side;           // Where the return leg goes - the side the ferry came from
+    SideId current_side;          // Current side of the vehicle
     int ready_for_return;         // 1 if vehicle is ready to return
     int errand_time;              // Time the vehicle spends on destination side before return
     int toll_entry_booth_id;      // Store the booth ID for later reference
+    union {
+        unsigned long waiting_sequence;   // Arrival order in the waiting area, across all lanes
+        struct Vehicle* handoff_next;     // Link in the booth handoff, until the waiting area takes it
+    };
 } Vehicle;
 
+/* Arena slot for a vehicle - a finished vehicle's slot links it into the freelist.
+ * Both members start with the timing pointer, so a slot keeps its cold record when reused. */
+typedef union VehicleSlot {
+    Vehicle vehicle;
+    struct {
+        VehicleTiming* timing;
+        union VehicleSlot* next_free;
+    } free_slot;
+} VehicleSlot;
+
+/* Stage durations a completed round trip adds to the statistics */
+typedef enum {
+    STAGE_OUTBOUND,               // Arrival to unload at the destination
+    STAGE_OUTBOUND_QUEUE,
+    STAGE_OUTBOUND_TOLL,
+    STAGE_OUTBOUND_WAITING,
+    STAGE_OUTBOUND_RIDE,
+    STAGE_RETURN_QUEUE,
+    STAGE_RETURN_TOLL,
+    STAGE_RETURN_WAITING,
+    STAGE_RETURN_RIDE,
+    STAGE_RETURN,                 // Return arrival to completion
+    STAGE_ROUND_TRIP,
+    STAGE_COUNT
+} BatchStage;
+
+/* Up to STATS_BATCH vehicles that just completed, as structure-of-arrays - one contiguous
+ * nanosecond array per stage and one per grouping key, so the statistics kernels are
+ * plain loops the compiler can vectorise (see stats_batch_fill) */
+typedef struct {
+    int count;
+    const Vehicle* vehicles[STATS_BATCH];
+    int types[STATS_BATCH];
+    int origins[STATS_BATCH];
+    int destinations[STATS_BATCH];
+    long long durations[STAGE_COUNT][STATS_BATCH];
+} StatsBatch;
+
+/* One chunk of arena memory, the allocations follow the (aligned) header */
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;                  // Usable bytes after the header
+    size_t used;
+} ArenaBlock;
+
+/* Simulation-scoped allocator - the fleet and other long-lived objects are carved out of
+ * large blocks and all released together by arena_release */
+typedef struct {
+    ArenaBlock* blocks;           // Most recent block first
+    VehicleSlot* free_vehicles;   // Slots of destroyed vehicles, reused before the arena grows
+    pthread_mutex_t mutex;        // Vehicles are destroyed from ferry threads
+} SimArena;
+
+SimArena sim_arena = { NULL, NULL, PTHREAD_MUTEX_INITIALIZER };
+
+/* Bounded ring buffer of vehicles - O(1) push/pop, stable removal from the middle */
+typedef struct {
+    Vehicle** items;
+    int capacity;                 // Maximum number of vehicles held
+    int mask;                     // Storage length - 1 (a power of two, grows up to capacity)
+    int head;                     // Storage index of the front vehicle
+    int size;                     // Number of vehicles currently held
+} VehicleQueue;
+
+/* xoshiro256** generator state - one independent stream per entity (see rng_init) */
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+/* Stream namespaces - each entity's stream is derived from the run seed and its stream id */
+#define RNG_STREAM_SETUP 0ULL
+#define RNG_STREAM_BOOTH (1ULL << 32)
+#define RNG_STREAM_FERRY (2ULL << 32)
+#define RNG_STREAM_ARRIVALS (3ULL << 32)
+
 /* Each toll booth is a separate thread that processes vehicles */
 typedef struct {
     char name[MAX_NAME_LENGTH];
-    int is_occupied;
-    Vehicle* current_vehicle;
+    int id;                       // Booth number on its side, starting at 1
+    SideId side;                  // Side the booth belongs to
+    int is_occupied;              // Only written by the booth's own thread (or the event engine)
+    _Atomic(Vehicle*) current_vehicle; // Read without locks by the ferry's FIFO candidate walk
+    Rng rng;                      // Processing times - only drawn by this booth (or the event engine)
     pthread_t thread;
     int is_running;
+    
+    // Staffing, protected by the side's queue_mutex
+    int is_open;                  // 0 = closed, takes no new vehicles (finishes the current one)
+    SimTime opened_at;            // When the booth last opened
+    SimTime open_ns;              // Open time before the last opening
 } TollBooth;
 
-/* Each side of the city has booths, queues and a waiting area */
+/* Waiting area with one FIFO lane per next terminal and vehicle type - arrival order across
+ * lanes is kept by waiting_sequence, so both per-type and global FIFO access are cheap.
+ * The capacity is shared by every route leaving the terminal */
+typedef struct {
+    VehicleQueue lanes[MAX_TERMINALS][TRUCK + 1]; // [heading][quota], lane 0 unused
+    int size_to[MAX_TERMINALS];      // Vehicles in the lanes towards each terminal
+    int size;                        // Vehicles in all lanes
+    int capacity;                    // Limit on size
+    unsigned long next_sequence;
+} WaitingArea;
+
+/* Lock-free handoff from the toll booths into the waiting area. Booths push without
+ * locking; whoever holds CityPart.mutex takes the whole list with one exchange */
+typedef struct {
+    _Atomic(Vehicle*) head;                // Most recently pushed vehicle first
+    atomic_int by_quota[MAX_TERMINALS][TRUCK + 1]; // [heading][quota] pushed but not yet in the lanes
+} WaitingHandoff;
+
+/* Smoothed arrival rate of the vehicles joining a toll queue for one heading */
+typedef struct {
+    SimTime last_ns;              // Time of the latest arrival
+    double mean_gap_seconds;      // Smoothed time between arrivals
+    double mean_quota;            // Smoothed quota per arrival
+    int samples;                  // Arrivals seen so far
+} ArrivalEstimate;
+
+/* Each terminal (side) has booths, queues and a waiting area. The inbound queue, the booths
+ * and the waiting area are separate synchronisation domains, so finishing booths never
+ * contend with the ferry loading from the waiting area. Terminals share no locks with each
+ * other. Loading and routing state is kept per berth - per route leaving the terminal,
+ * indexed by the terminal at its far end */
 typedef struct {
     char name[MAX_NAME_LENGTH];
-    TollBooth booths[NUM_TOLL_BOOTHS];
-    Vehicle* vehicle_queue[MAX_VEHICLES];
-    int queue_size;
-    Vehicle* waiting_area[MAX_VEHICLES];
-    int waiting_area_size;
-    pthread_mutex_t mutex;
+    SideId id;                    // Position in city_parts - used instead of the name everywhere but output
+    TollBooth* booths;            // The most booths that can be open (see config.booths_max)
+    int num_booths;
+    int open_booths;              // Booths open now, at least config.booths_per_side (queue_mutex)
+    int peak_open_booths;
+    int booth_openings;           // Booths opened and closed at runtime
+    int booth_closings;
+    SimTime last_booth_change;    // Start of the scaling cooldown
+    VehicleQueue vehicle_queue;   // Vehicles waiting for a toll booth, protected by queue_mutex
+    pthread_mutex_t queue_mutex;  // Arrivals and errand returns push, booths take
+    WaitingHandoff handoff;       // Vehicles done with tolls, on their way to the waiting area
+    WaitingArea waiting_area;     // Vehicles done with tolls, waiting for the ferry, protected by mutex
+    pthread_mutex_t mutex;        // Waiting area lanes - lock with city_lock so the handoff is collected
+    
+    // Per-heading, per-quota counters kept up to date on every handoff, readable without
+    // locks. A vehicle is counted at its new stage before it leaves the old one, so it is never missed
+    atomic_int queued_by_quota[MAX_TERMINALS][TRUCK + 1]; // Vehicles in vehicle_queue
+    atomic_int booth_by_quota[MAX_TERMINALS][TRUCK + 1];  // Vehicles currently at a toll booth
+    ArrivalEstimate arrivals_to[MAX_TERMINALS];           // Recent queue arrivals per heading, protected by queue_mutex
+    
+    // Dispatcher state per berth, protected by dispatcher.mutex
+    struct Ferry* loading_ferry[MAX_TERMINALS]; // The one docked ferry allowed to load at the berth
+    int ferries_docked[MAX_TERMINALS];          // Ferries of the route currently docked here
+    int ferries_inbound[MAX_TERMINALS];         // Ferries of the route crossing towards this side
+    
+    // Event-driven wakeups
+    pthread_cond_t queue_not_empty;        // Booth threads sleep here while the queue is empty (queue_mutex)
+    pthread_cond_t booths_changed;         // Closed booth threads sleep here until they open (queue_mutex)
+    pthread_cond_t waiting_area_changed;   // Broadcast when a vehicle enters the waiting area (mutex)
+    atomic_ulong waiting_area_version;     // Incremented with every vehicle handed to the waiting area
+    atomic_int waiting_area_sleepers;      // Ferries blocked on waiting_area_changed - booths only lock to wake them
 } CityPart;
 
-/* The ferry carries vehicles between the two sides */
-typedef struct {
+/* The ferry carries vehicles between the two ends of its route */
+typedef struct Ferry {
+    char name[MAX_NAME_LENGTH];
+    const Route* route;           // The route this ferry serves
     int capacity;
     int current_load;
-    Vehicle* vehicles[MAX_CAPACITY];
+    Vehicle** vehicles;           // Sized for a ferry full of 1-quota vehicles
     int vehicle_count;
     CityPart* location;
     int is_loading;
@@ -102,1442 +630,7132 @@ typedef struct {
     pthread_t thread;
     int is_running;
     pthread_mutex_t mutex;
+    Rng rng;                      // Travel and errand times - only drawn by this ferry's thread
+
+    // Journey state shared by the departure and arrival halves of a trip
+    CityPart* departure_side;     // Side the ferry left from on its current crossing
+    int first_outbound_completed; // 1 once the first A->B trip has arrived
+    int first_return_completed;   // 1 once the first (empty) B->A return has departed
+
+    // Message state used by ferry_decide to avoid log spam
+    int last_waiting_message;
+    SimTime last_message_time;
+    
+    // Message state used by can_depart to avoid log spam
+    SimTime depart_message_time;  // Time when last message was displayed
+    int depart_vehicles_needed;   // Number of vehicles in last message
+    int depart_unfilled_quota;    // Amount of quota in last message
+    int depart_state;             // Previous departure state
+    TripReason depart_reason;     // Why the scheduler last decided to depart
+    SimTime depart_deadline;      // Adaptive scheduler: re-evaluate departure at this time, 0 = no timer
+    int deadline_generation;      // Virtual clock mode: identifies the current deadline event
+    
+    // Trip bookkeeping
+    int trip_number;              // Fleet-wide number of the current/last crossing
+    SimTime docked_time;          // When the ferry docked at its current side
+    SimTime first_boarding_time;  // When the first vehicle of the next crossing boarded
+    SimTime departure_time;       // When the current/last crossing started
+    int trips_completed;          // Crossings completed by this ferry
+    int vehicles_carried;         // Vehicles unloaded by this ferry
+    CityPart* docked_at;          // Side this ferry is docked at, protected by dispatcher.mutex
+    long docked_sequence;         // Docking order, used to hand over the loading slot fairly
+    int event_pending;            // Virtual clock mode: 1 while a ferry event is scheduled
+    
+    // Event-driven wakeups, used together with mutex
+    pthread_cond_t departure_changed;      // Broadcast when anything affecting departure changes
+    unsigned long departure_version;       // Incremented with every departure_changed broadcast
 } Ferry;
 
+/* Coordinates the fleet: which docked ferry loads at each side and where empty ferries go */
+typedef struct {
+    pthread_mutex_t mutex;        // Protects the dispatcher fields of every CityPart and Ferry
+    long next_docked_sequence;
+} Dispatcher;
+
 /* Global variables for the simulation */
-CityPart side_a, side_b;
-Ferry ferry;
+CityPart city_parts[MAX_TERMINALS];   /* num_terminals terminals, indexed by SideId */
+int num_terminals = 0;
+Route routes[MAX_TERMINALS];          /* Any topology has at most one route per terminal */
+int num_routes = 0;
+Ferry* ferries = NULL;    /* config.num_ferries ferries */
+int num_ferries = 0;
+Dispatcher dispatcher = { PTHREAD_MUTEX_INITIALIZER, 0 };
 int total_vehicles_transported = 0;
-time_t start_time, end_time;
-int simulation_running = 1;
-int trip_count = 0;  /* Counter for ferry trip numbers */
+int vehicles_dropped = 0; /* Turned away by a full toll queue or waiting area, protected by mutex */
+int vehicles_dropped_by_type[TRUCK + 1] = { 0 };
+SimTime start_time, end_time;
+atomic_int simulation_running = 1;
+int trip_count = 0;       /* Completed ferry trips, protected by mutex */
+uint64_t run_seed = 0;    /* Every random stream of the run is derived from this */
+Rng setup_rng;            /* Stream for the setup - starting side and initial queue order */
+int next_trip_number = 0; /* Last trip number handed out at departure, protected by mutex */
+int single_origin_fleet = 0; /* Whole fleet created at the first ferry's start under the rules scheduler -
+                                enables the first-trip rules */
+
+/* Live counters, updated atomically where the state changes so that the stats thread never
+ * takes a simulation lock. Each counter is exact; updates that move a vehicle between counters
+ * are grouped (metric_update_begin/end) so that metrics_snapshot reads them coherently */
+typedef struct {
+    atomic_int queue_depth[MAX_TERMINALS];
+    atomic_int waiting_area_size[MAX_TERMINALS];
+    atomic_int booths_busy[MAX_TERMINALS];
+    atomic_int booths_open[MAX_TERMINALS];
+    atomic_int* ferry_load;       // Quota aboard, one per ferry
+    atomic_int* ferry_vehicles;   // Vehicles aboard, one per ferry
+    atomic_int trips_completed;
+    atomic_int vehicles_transported;
+    atomic_int vehicles_dropped;
+    atomic_llong clock_ns;        // Virtual clock mode only - the engine's current time
+    atomic_llong events;          // Vehicle and ferry events, counted whether traced or not
+    atomic_int writers;           // Update groups in progress
+    atomic_ulong epoch;           // Update groups completed
+    atomic_llong snapshot_retries; // Snapshot reads repeated because a group was in progress
+    atomic_llong snapshots_torn;  // Snapshots given up on after SNAPSHOT_MAX_ATTEMPTS reads
+} LiveMetrics;
+
+/* A coherent copy of the moving counters - a vehicle in transit between two of them
+ * is counted in exactly one */
+typedef struct {
+    int queue_depth[MAX_TERMINALS];
+    int waiting_area_size[MAX_TERMINALS];
+    int booths_busy[MAX_TERMINALS];
+    int booths_open[MAX_TERMINALS];
+    int* ferry_load;              // One per ferry
+    int* ferry_vehicles;
+    int trips_completed;
+    int vehicles_transported;
+    int vehicles_dropped;
+} MetricsSnapshot;
+
+LiveMetrics live_metrics;
+
+/* Contended acquisitions and the time spent blocked in them - uncontended ones are free */
+typedef struct {
+    atomic_llong contended;
+    atomic_llong wait_ns;
+} LockStats;
+
+LockStats lock_stats[LOCK_CLASS_COUNT];
+
+/* Simulation clock - wall clock by default, simulated timeline in virtual clock mode */
+long long virtual_clock_us = 0;   /* Simulated microseconds elapsed since virtual_epoch */
+SimTime clock_epoch = 0;          /* CLOCK_MONOTONIC reading at startup, origin of sim_now() */
+
+/* Ferry decisions shared by the threaded loop and the discrete-event engine */
+typedef enum {
+    FERRY_ACTION_DEPART,      // Loaded and ready - cross to the other side and unload
+    FERRY_ACTION_LOADED,      // Vehicles were taken from the waiting area
+    FERRY_ACTION_REPOSITION,  // Nothing here, but vehicles waiting at the other side
+    FERRY_ACTION_IDLE         // Nothing to do until the situation changes
+} FerryAction;
 
 /* Forward declarations - required for circular dependency handling */
-void* vehicle_errand_handler(void* arg);
+void* errand_worker(void* arg);
 
 /* Function prototypes */
 // Functions organized into logical groups by functionality
 
+// Logging functions
+void log_start();
+void log_stop();
+void log_flush();
+int log_enabled(LogLevel level);
+void sim_log(LogLevel level, LogEvent event, int vehicle_id, int side, int booth, const char* format, ...);
+
+// Live metrics functions
+void metric_add(atomic_int* counter, int delta);
+int metric_read(atomic_int* counter);
+void metric_update_begin();
+void metric_update_end();
+void metrics_snapshot_init(MetricsSnapshot* snapshot);
+void metrics_snapshot_destroy(MetricsSnapshot* snapshot);
+int metrics_snapshot(MetricsSnapshot* snapshot);
+void lock_mutex(pthread_mutex_t* mutex, LockClass lock_class);
+void live_metrics_init();
+void live_metrics_destroy();
+int write_live_metrics(const char* path);
+void stats_start();
+void stats_stop();
+
+// Trace functions
+int trace_open(const char* path);
+void trace_close();
+void trace_vehicle(TraceEvent event, const Vehicle* vehicle, int side, int unit, int trip_number);
+void trace_ferry(TraceEvent event, const Ferry* ferry, int side, int peer_side);
+int replay_trace(const char* path);
+
+// Arena functions
+void arena_init(size_t initial_bytes);
+void* arena_alloc(size_t bytes);
+void arena_release();
+void vehicle_pool_reserve(int count);
+
 // Vehicle functions
 Vehicle* create_vehicle(int id, VehicleType type);
 void destroy_vehicle(Vehicle* vehicle);
+void drop_vehicle(Vehicle* vehicle);
+int fleet_remaining();
+void start_vehicle_errand(Vehicle* vehicle, CityPart* location);
+void complete_vehicle_errand(Vehicle* vehicle, CityPart* location, int delay_seconds);
+
+// Errand timer functions
+void errand_timer_start(int num_workers);
+void errand_timer_stop();
+void errand_timer_destroy();
+
+// Network functions
+void build_network(int terminals, Topology topology);
+const Route* find_route(SideId a, SideId b);
+CityPart* route_peer(const Route* route, const CityPart* city);
+SideId vehicle_heading(const Vehicle* vehicle);
+SideId pick_destination(Rng* rng, SideId origin);
+
+// Arrival generator functions
+int streaming_arrivals();
+int load_arrival_file(const char* path, SimConfig* cfg);
+void arrivals_init();
+int arrival_next(long long* at_us, SideId* side, VehicleType* type);
+int arrivals_pending(VehicleType type);
+void inject_arrival(SideId side, VehicleType type);
+void arrivals_schedule_next();
+void arrivals_start();
+void arrivals_stop();
+void arrivals_destroy();
+
+// Vehicle queue functions
+void vehicle_queue_init(VehicleQueue* queue, int capacity);
+void vehicle_queue_destroy(VehicleQueue* queue);
+void vehicle_queue_grow(VehicleQueue* queue);
+int vehicle_queue_push_back(VehicleQueue* queue, Vehicle* vehicle);
+Vehicle* vehicle_queue_pop_front(VehicleQueue* queue);
+Vehicle* vehicle_queue_at(const VehicleQueue* queue, int index);
+void vehicle_queue_swap(VehicleQueue* queue, int i, int j);
+
+// Waiting area functions
+void waiting_area_init(WaitingArea* area, int capacity, SideId terminal);
+void waiting_area_destroy(WaitingArea* area);
+int waiting_area_push(WaitingArea* area, Vehicle* vehicle);
+Vehicle* waiting_area_front(const WaitingArea* area, SideId heading, const int* lane_limit);
+Vehicle* waiting_area_pop(WaitingArea* area, SideId heading, int quota);
+void waiting_handoff_push(WaitingHandoff* handoff, Vehicle* vehicle);
+Vehicle* waiting_handoff_take_all(WaitingHandoff* handoff);
+void collect_waiting_vehicles(CityPart* city);
+void city_lock(CityPart* city);
 
 // City part functions
 void add_vehicle_to_queue(CityPart* city, Vehicle* vehicle);
 void add_to_waiting_area(CityPart* city, Vehicle* vehicle);
 
 // Toll booth functions
-void initialize_toll_booth(TollBooth* booth, const char* name);
+void initialize_toll_booth(TollBooth* booth, const char* name, SideId side, int id);
 void* toll_booth_process_vehicle(void* arg);
-typedef struct {
-    TollBooth* booth;
-    CityPart* city;
-} TollBoothArg;
+Vehicle* toll_booth_take_vehicle(CityPart* city, TollBooth* booth);
+void toll_booth_release_vehicle(CityPart* city, TollBooth* booth, Vehicle* vehicle);
+void toll_booth_scale(CityPart* city, SimTime now);
+void toll_booth_set_open(CityPart* city, TollBooth* booth, int open, SimTime now);
+double booth_open_seconds(const TollBooth* booth, SimTime now);
+int toll_processing_time(TollBooth* booth);
 
 // City part functions
-void initialize_city_part(CityPart* city, const char* name);
+void initialize_city_part(CityPart* city, const char* name, SideId id);
 void add_vehicle_to_queue(CityPart* city, Vehicle* vehicle);
 void process_toll_booths(CityPart* city);
 void add_to_waiting_area(CityPart* city, Vehicle* vehicle);
+int inbound_vehicle_count(CityPart* city, SideId heading);
+void wake_city_waiters(CityPart* city);
+
+// Loading policy functions
+void load_candidates_init(LoadCandidates* candidates, int unfilled_quota);
+void load_candidates_offer(LoadCandidates* candidates, int quota);
+int quota_fits_any(int free_quota, const int* count_by_quota);
+int pending_by_quota(CityPart* city, SideId heading, int quota);
+int city_has_fitting_vehicle(CityPart* city, SideId heading, int free_quota, int include_pending);
+void collect_load_candidates(CityPart* city, SideId heading, LoadCandidates* candidates, int include_pending);
+void plan_load(LoadingPolicy policy, const LoadCandidates* candidates, int unfilled_quota, LoadPlan* plan);
+LoadingPolicy parse_loading_policy(const char* name);
+
+// Latency histogram functions
+int histogram_bucket(long long value);
+long long histogram_bucket_high(int bucket);
+void histogram_record_batch(LatencyHistogram* histogram, const long long* values, int count);
+void batch_group_by(const long long* values, const int* keys, int count, int key_limit,
+                    long long* grouped, int* starts);
+long long histogram_percentile(const LatencyHistogram* histogram, double percentile);
+void latency_record_batch(const StatsBatch* batch);
+void print_latency_report();
+int export_latency_stats(const char* path);
+
+// Trip telemetry functions
+void trip_log_append(const TripRecord* trip);
+void print_trip_report();
+int export_trip_log(const char* path);
 
 // Ferry functions
-void initialize_ferry(Ferry* ferry, int capacity);
+void initialize_ferry(Ferry* ferry, const char* name, int capacity, const Route* route);
 void dock_at(Ferry* ferry, CityPart* city);
 int load_vehicle(Ferry* ferry, Vehicle* vehicle);
+int load_from_waiting_area(Ferry* ferry, CityPart* location);
 int can_depart(Ferry* ferry);
+int rules_should_depart(Ferry* ferry);
+int adaptive_should_depart(Ferry* ferry);
+long long departure_grace_us();
+void arrival_estimate_update(ArrivalEstimate* estimate, SimTime now, int quota);
+double expected_fill_seconds(CityPart* city, SideId heading, int missing_quota, SimTime now, SimTime* deadline);
+int unload_ferry_begin(Ferry* ferry);
+void unload_ferry_finish(Ferry* ferry);
 void unload_ferry(Ferry* ferry);
+int travel_requires_unload(Ferry* ferry, CityPart* destination);
+void travel_depart(Ferry* ferry, CityPart* destination);
+void travel_arrive(Ferry* ferry, CityPart* destination);
+int travel_time(Ferry* ferry);
 void travel(Ferry* ferry, CityPart* destination);
+FerryAction ferry_decide(Ferry* ferry, CityPart** destination);
 void* ferry_operation(void* arg);
+void notify_departure_change(Ferry* ferry);
+void notify_fleet();
+
+// Dispatcher functions
+void dispatcher_ferry_docked(Ferry* ferry, CityPart* city);
+void dispatcher_ferry_departing(Ferry* ferry, CityPart* destination);
+int dispatcher_has_loading_slot(Ferry* ferry);
+int dispatcher_should_reposition(Ferry* ferry, CityPart* destination);
+void wait_for_ferry_wakeup(Ferry* ferry, CityPart* location, unsigned long waiting_area_version,
+                           unsigned long departure_version);
+void ferry_grace_wait(Ferry* ferry, long long delay_us);
+
+// Platform functions
+SimTime monotonic_ns();
+long long deadline_clock_us();
+void make_deadline(long long delay_us, struct timespec* deadline);
+void platform_sleep_us(long long delay_us);
+void platform_cond_init(pthread_cond_t* cond);
+int platform_cpu_count();
+int platform_pinned_cpu(int index);
+int platform_thread_create(pthread_t* thread, void* (*start)(void*), void* arg, int cpu);
+int pinned_thread_cpu();
+
+// Clock functions
+SimTime sim_now();
+double seconds_between(SimTime end, SimTime start);
+
+// Random number functions
+uint64_t splitmix64(uint64_t* state);
+void rng_init(Rng* rng, uint64_t seed, uint64_t stream);
+uint64_t rng_next(Rng* rng);
+int rng_below(Rng* rng, int bound);
+double natural_log(double x);
+long long rng_exponential(Rng* rng, double mean);
+void seed_random_streams(uint64_t seed);
+
+// Configuration functions
+int total_fleet_size();
+int parse_option_name(const char* name, const char* const* names, int count);
+int parse_config_int(const char* value);
+int apply_config_option(SimConfig* cfg, const char* key, const char* value);
+int load_config_file(SimConfig* cfg, const char* path);
+int validate_config(const SimConfig* cfg);
+
+// Batch runner functions
+int load_batch_file(const char* path, const SimConfig* base, BatchRun** runs);
+void run_batch_instance(const BatchRun* run, BatchResult* result);
+BatchResult* run_batch_processes(BatchRun* runs, int count, int jobs);
+int run_batch(const char* path);
+long peak_rss_kb();
+void bench_case(BatchRun* run, int index, int vehicles, int booths, int virtual_clock);
+void write_bench_json(FILE* file, const BatchRun* runs, const BatchResult* results, int count);
+int run_benchmark(const char* path);
 
 // Simulation functions
 void initialize_simulation();
 void create_vehicles();
 void run_simulation(int simulation_time);
+void run_discrete_event_simulation(int simulation_time);
+void log_fleet_finished();
 void generate_report();
 void cleanup_simulation();
 
+// Checkpoint functions
+int checkpoint_write(const char* path);
+void checkpoint_write_interval(long long at_us);
+int checkpoint_read_config(const char* path, SimConfig* cfg);
+int checkpoint_check(const char* path);
+int checkpoint_restore(const char* path);
+
 /**
- * Thread structure and handler for vehicles spending time at destination
- * Manages vehicle errands and return journey preparation
+ * Errand timer for vehicles spending time at destination
+ * Pending errands sit in a min-heap ordered by due time; a small fixed pool of worker
+ * threads sleeps until the earliest one is due and sends the vehicle back to the queue.
+ * The number of threads does not depend on the fleet size.
  */
-/* Structure for handling vehicle errands at destination */
+/* One vehicle on its errand at the destination */
 typedef struct {
+    long long due_us;         // When the errand ends, on the condition variable clock (deadline_clock_us)
+    long long sequence;       // Start order - keeps errands due at the same time FIFO
     Vehicle* vehicle;
     CityPart* location;
     int delay_seconds;
 } ErrandInfo;
 
-/* Thread function for handling vehicle activities at destination */
-void* vehicle_errand_handler(void* arg) {
-    ErrandInfo* info = (ErrandInfo*)arg;
-    
-    // The vehicle is doing something at the destination (shopping, business, etc.)
-    sleep(info->delay_seconds);
-    
-    // Now the vehicle is ready to return home
-    info->vehicle->ready_for_return = 0;
-    
-    // Record return time before adding to queue for accurate timing statistics
-    // Critical for maintaining proper chronological order in timing measurements
-    time_t current_time = time(NULL);
-    info->vehicle->arrival_time_return = current_time;
-    
-    // Reset these timestamps to avoid random garbage values
-    info->vehicle->toll_entry_time_return = 0;
-    info->vehicle->waiting_area_time_return = 0;
-    info->vehicle->boarding_time_return = 0;
-    info->vehicle->complete_time = 0;
+/* Binary min-heap of pending errands plus the worker pool that services it */
+typedef struct {
+    ErrandInfo* errands;
+    int size;
+    int capacity;             // Starts at VEHICLE_QUEUE_MIN_STORAGE and doubles with the errands in flight
+    long long next_sequence;
+    pthread_mutex_t mutex;    // Protects everything above and running
+    pthread_cond_t changed;   // Signalled when the earliest errand changes or on shutdown (set up by errand_timer_start)
+    pthread_t* workers;
+    int num_workers;
+    int running;
+} ErrandTimer;
+
+ErrandTimer errand_timer = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * Discrete-event calendar for virtual clock mode
+ * Every delay that the threaded simulation sleeps through becomes a future event
+ */
+/* Kinds of future events on the simulated timeline */
+typedef enum {
+    EVENT_BOOTH_DONE,     // A toll booth finished processing its vehicle
+    EVENT_ERRAND_DONE,    // A vehicle finished its errand and joins the return queue
+    EVENT_FERRY_WAKE,     // The ferry re-evaluates its situation
+    EVENT_FERRY_DEPART,   // The "last-minute" wait before departure is over
+    EVENT_FERRY_ARRIVE,   // The ferry reached the other side
+    EVENT_FERRY_UNLOADED, // Unloading time is over
+    EVENT_ARRIVAL,        // A new vehicle reaches a terminal (streaming arrivals)
+    EVENT_FERRY_DEADLINE  // An adaptive departure deadline is due (flag = deadline generation)
+} EventType;
+
+/* A single entry in the event calendar */
+typedef struct {
+    long long time_us;    // Simulated time the event fires at
+    long long sequence;   // Scheduling order - keeps simultaneous events FIFO
+    EventType type;
+    Vehicle* vehicle;
+    CityPart* city;
+    TollBooth* booth;
+    Ferry* ferry;
+    int flag;             // Event specific: unload on arrival, booth number, ...
+} SimEvent;
+
+/* Binary min-heap ordered by (time_us, sequence) */
+typedef struct {
+    SimEvent* events;
+    int size;
+    int capacity;
+    long long next_sequence;
+} EventCalendar;
+
+EventCalendar event_calendar;
+
+void schedule_event(EventType type, long long delay_us, Vehicle* vehicle, CityPart* city,
+                    TollBooth* booth, Ferry* ferry, int flag);
+void wake_ferry(Ferry* ferry);
+
+/* Heap order: earlier due time first, ties in start order */
+int errand_before(const ErrandInfo* a, const ErrandInfo* b) {
+    if (a->due_us != b->due_us) {
+        return a->due_us < b->due_us;
+    }
+    return a->sequence < b->sequence;
+}
+
+/* Removes the earliest errand - caller must hold errand_timer.mutex and the heap must not be empty */
+ErrandInfo errand_timer_pop() {
+    ErrandInfo* heap = errand_timer.errands;
+    ErrandInfo earliest = heap[0];
     
-    // Add to queue for return journey
-    printf("After spending %d seconds at %s, %s_%d is now joining the return queue\n", 
-           info->delay_seconds,
-           info->location->name,
-           info->vehicle->type_name, 
-           info->vehicle->id);
+    // Move the last errand to the root and sift it down
+    heap[0] = heap[--errand_timer.size];
+    int i = 0;
+    for (;;) {
+        int smallest = i;
+        int left = 2 * i + 1;
+        int right = left + 1;
+        if (left < errand_timer.size && errand_before(&heap[left], &heap[smallest])) smallest = left;
+        if (right < errand_timer.size && errand_before(&heap[right], &heap[smallest])) smallest = right;
+        if (smallest == i) {
+            break;
+        }
+        ErrandInfo temp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = temp;
+        i = smallest;
+    }
+    return earliest;
+}
+
+/* Worker thread - returns vehicles to the queue as their errands become due */
+void* errand_worker(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&errand_timer.mutex);
     
-    add_vehicle_to_queue(info->location, info->vehicle);
+    while (errand_timer.running) {
+        if (errand_timer.size == 0) {
+            pthread_cond_wait(&errand_timer.changed, &errand_timer.mutex);
+            continue;
+        }
+        
+        // The vehicle is doing something at the destination (shopping, business, etc.)
+        long long due_us = errand_timer.errands[0].due_us;
+        if (deadline_clock_us() < due_us) {
+            struct timespec deadline = { (time_t)(due_us / 1000000LL), (long)(due_us % 1000000LL) * 1000L };
+            pthread_cond_timedwait(&errand_timer.changed, &errand_timer.mutex, &deadline);
+            continue;
+        }
+        
+        ErrandInfo errand = errand_timer_pop();
+        
+        // More errands may be due right now - let another worker take them
+        if (errand_timer.size > 0) {
+            pthread_cond_signal(&errand_timer.changed);
+        }
+        
+        pthread_mutex_unlock(&errand_timer.mutex);
+        complete_vehicle_errand(errand.vehicle, errand.location, errand.delay_seconds);
+        pthread_mutex_lock(&errand_timer.mutex);
+    }
     
-    // Memory cleanup to prevent leaks
-    free(info);
+    pthread_mutex_unlock(&errand_timer.mutex);
     return NULL;
 }
 
-/**
- * Vehicle functions implementation
- */
-
-/* Creates a new vehicle with specified ID and type */
-Vehicle* create_vehicle(int id, VehicleType type) {
-    Vehicle* vehicle = (Vehicle*)malloc(sizeof(Vehicle));
-    if (!vehicle) {
-        perror("Failed to allocate memory for vehicle");
+/* Allocates a small errand heap (it grows in start_vehicle_errand) and starts the worker pool */
+void errand_timer_start(int num_workers) {
+    errand_timer.capacity = VEHICLE_QUEUE_MIN_STORAGE;
+    errand_timer.errands = (ErrandInfo*)malloc(errand_timer.capacity * sizeof(ErrandInfo));
+    errand_timer.workers = (pthread_t*)malloc(num_workers * sizeof(pthread_t));
+    if (!errand_timer.errands || !errand_timer.workers) {
+        perror("Failed to allocate memory for errand timer");
         exit(EXIT_FAILURE);
     }
+    errand_timer.size = 0;
+    errand_timer.next_sequence = 0;
+    errand_timer.running = 1;
+    errand_timer.num_workers = num_workers;
+    platform_cond_init(&errand_timer.changed);
     
-    vehicle->id = id;
-    vehicle->type = type;
-    vehicle->quota = type; // Quota equals type value for simplified resource management
+    for (int i = 0; i < num_workers; i++) {
+        platform_thread_create(&errand_timer.workers[i], errand_worker, NULL, -1);
+    }
+}
+
+/* Stops and joins the worker pool - errands still pending stay in the heap */
+void errand_timer_stop() {
+    pthread_mutex_lock(&errand_timer.mutex);
+    errand_timer.running = 0;
+    pthread_cond_broadcast(&errand_timer.changed);
+    pthread_mutex_unlock(&errand_timer.mutex);
     
-    // Set the type name for logging
-    switch(type) {
-        case CAR:
-            strcpy(vehicle->type_name, "CAR");
-            break;
-        case MINIBUS:
-            strcpy(vehicle->type_name, "MINIBUS");
-            break;
-        case TRUCK:
-            strcpy(vehicle->type_name, "TRUCK");
-            break;
+    for (int i = 0; i < errand_timer.num_workers; i++) {
+        pthread_join(errand_timer.workers[i], NULL);
     }
+    errand_timer.num_workers = 0;
+    pthread_cond_destroy(&errand_timer.changed);
+}
+
+/* Frees the heap - vehicles whose errands never finished go with the arena */
+void errand_timer_destroy() {
+    free(errand_timer.errands);
+    free(errand_timer.workers);
+    errand_timer.errands = NULL;
+    errand_timer.workers = NULL;
+    errand_timer.size = 0;
+    errand_timer.capacity = 0;
+    pthread_mutex_destroy(&errand_timer.mutex);
+}
+
+/* Sends a freshly unloaded vehicle off on its errand at the destination */
+void start_vehicle_errand(Vehicle* vehicle, CityPart* location) {
+    trace_vehicle(TRACE_ERRAND_START, vehicle, location->id, -1, 0);
     
-    // Initialize all the timestamps for outbound journey
-    vehicle->arrival_time = 0;
-    vehicle->toll_entry_time = 0;
-    vehicle->waiting_area_time = 0;
-    vehicle->boarding_time = 0;
-    vehicle->unload_time = 0;
+    if (config.virtual_clock) {
+        // No thread needed - the errand simply ends at a future point on the timeline
+        schedule_event(EVENT_ERRAND_DONE, vehicle->errand_time * 1000000LL,
+                       vehicle, location, NULL, NULL, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&errand_timer.mutex);
     
-    // Initialize timestamps for return journey 
-    vehicle->arrival_time_return = 0;
-    vehicle->toll_entry_time_return = 0;
-    vehicle->waiting_area_time_return = 0;
-    vehicle->boarding_time_return = 0;
-    vehicle->complete_time = 0;
+    // Double the heap when it is full - it only ever holds the errands in flight
+    if (errand_timer.size == errand_timer.capacity) {
+        int capacity = errand_timer.capacity * 2;
+        ErrandInfo* errands = (ErrandInfo*)realloc(errand_timer.errands, capacity * sizeof(ErrandInfo));
+        if (!errands) {
+            perror("Failed to allocate memory for errand timer");
+            exit(EXIT_FAILURE);
+        }
+        errand_timer.errands = errands;
+        errand_timer.capacity = capacity;
+    }
     
-    // Set status flags to initial values
-    vehicle->is_transported = 0; // 0 = not transported, 1 = A->B complete, 2 = round trip complete
-    vehicle->outbound_trip_number = 0;
-    vehicle->return_trip_number = 0;
-    vehicle->ready_for_return = 0;
-    vehicle->errand_time = 0;    // Time to spend on destination side before return
+    // Sift the new errand up from the end of the heap
+    ErrandInfo* heap = errand_timer.errands;
+    int i = errand_timer.size++;
+    heap[i].due_us = deadline_clock_us() + vehicle->errand_time * 1000000LL;
+    heap[i].sequence = errand_timer.next_sequence++;
+    heap[i].vehicle = vehicle;
+    heap[i].location = location;
+    heap[i].delay_seconds = vehicle->errand_time;
+    while (i > 0 && errand_before(&heap[i], &heap[(i - 1) / 2])) {
+        ErrandInfo temp = heap[i];
+        heap[i] = heap[(i - 1) / 2];
+        heap[(i - 1) / 2] = temp;
+        i = (i - 1) / 2;
+    }
     
-    // Origin side assigned in create_vehicles function
+    // A new earliest errand shortens the workers' sleep
+    if (i == 0) {
+        pthread_cond_signal(&errand_timer.changed);
+    }
     
-    return vehicle;
+    pthread_mutex_unlock(&errand_timer.mutex);
 }
 
-/* Free memory for a vehicle when it's no longer needed */
-void destroy_vehicle(Vehicle* vehicle) {
-    if (vehicle) {
-        free(vehicle);
-    }
+/* Errand is over - the vehicle is ready to return home */
+void complete_vehicle_errand(Vehicle* vehicle, CityPart* location, int delay_seconds) {
+    vehicle->ready_for_return = 0;
+
+    // Record return time before adding to queue for accurate timing statistics
+    // Critical for maintaining proper chronological order in timing measurements
+    SimTime current_time = sim_now();
+    vehicle->timing->arrival_time_return = current_time;
+    trace_vehicle(TRACE_ERRAND_END, vehicle, location->id, -1, 0);
+
+    // Reset these timestamps to avoid random garbage values
+    vehicle->timing->toll_entry_time_return = 0;
+    vehicle->timing->waiting_area_time_return = 0;
+    vehicle->timing->boarding_time_return = 0;
+    vehicle->timing->complete_time = 0;
+
+    // Add to queue for return journey
+    sim_log(LOG_INFO, LOG_EVENT_ERRAND, vehicle->id, location->id, -1, "After spending %d seconds at %s, %s_%d is now joining the return queue\n",
+           delay_seconds,
+           location->name,
+           vehicle_type_names[vehicle->type],
+           vehicle->id);
+
+    add_vehicle_to_queue(location, vehicle);
 }
 
 /**
- * Toll booth functions implementation
+ * Arrival generator functions implementation
+ * Instead of queueing the whole fleet at the start, vehicles can reach the terminals over
+ * time: a Poisson process per terminal (--arrival-rate) or a recorded arrival list
+ * (--arrival-file). Each vehicle is created from the arena pool when it arrives and its slot
+ * is recycled after the round trip, so memory follows the vehicles in flight. The fleet
+ * counts still fix how many vehicles arrive in total, so a run ends as before.
  */
 
-/* Sets up a toll booth with its name */
-void initialize_toll_booth(TollBooth* booth, const char* name) {
-    strcpy(booth->name, name);
-    booth->is_occupied = 0;
-    booth->current_vehicle = NULL;
-    booth->is_running = 0;
+/* One recorded arrival */
+typedef struct {
+    long long time_us;            // Since the start of the simulation
+    SideId side;
+    VehicleType type;
+    int line;                     // Line in the arrival file - keeps equal times in file order
+} ArrivalRecord;
+
+typedef struct {
+    Rng rng;                      // Gaps, types and destinations - only drawn by the generator
+    double mean_gap_us;           // Mean time between arrivals at one terminal
+    long long next_us[MAX_TERMINALS]; // Next Poisson arrival at each terminal
+    int remaining[TRUCK + 1];     // Vehicles of each type that have not arrived yet
+    ArrivalRecord* records;       // Recorded arrivals in time order (--arrival-file)
+    int record_count;
+    int position;                 // Next record to replay
+    int next_id;
+    pthread_t thread;             // Injects arrivals in real-time mode
+    pthread_mutex_t mutex;
+    pthread_cond_t stop_changed;  // Set up by arrivals_start
+    int running;
+} ArrivalGenerator;
+
+ArrivalGenerator arrivals = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* 1 if vehicles arrive over time rather than all at the start */
+int streaming_arrivals() {
+    return config.arrival_rate > 0 || config.arrival_file[0] != '\0';
 }
 
-/* Each toll booth runs as a separate thread */
-void* toll_booth_process_vehicle(void* arg) {
-    TollBoothArg* booth_arg = (TollBoothArg*)arg;
-    TollBooth* booth = booth_arg->booth;
-    CityPart* city = booth_arg->city;
-    int booth_id = 1; // Default to 1 if parsing fails
-    
-    // Extract booth number from name (format: Side_X_Booth_N)
-    // Proper indexing required for booth identification
-    if (sscanf(booth->name, "%*[^_]_Booth_%d", &booth_id) != 1) {
-        // If parsing fails, keep default value of 1
-        booth_id = 1;
+/* qsort comparator - orders arrival records by time, then by their line in the file */
+int compare_arrivals(const void* a, const void* b) {
+    const ArrivalRecord* left = (const ArrivalRecord*)a;
+    const ArrivalRecord* right = (const ArrivalRecord*)b;
+    if (left->time_us != right->time_us) {
+        return (left->time_us > right->time_us) - (left->time_us < right->time_us);
+    }
+    return (left->line > right->line) - (left->line < right->line);
+}
+
+/* Loads "time_seconds,side,type" lines and sets the fleet counts to the vehicles they contain.
+ * side is a terminal name (Side_A) or index, type is CAR, MINIBUS or TRUCK; '#' starts a
+ * comment and a first line that does not start with a number is taken as a header. */
+int load_arrival_file(const char* path, SimConfig* cfg) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open arrival file");
+        return -1;
     }
     
-    booth->is_running = 1;
+    char line[MAX_CONFIG_LINE];
+    int line_number = 0;
+    int capacity = 0;
+    int result = 0;
+    int counts[TRUCK + 1] = { 0, 0, 0, 0 };
+    arrivals.record_count = 0;
     
-    while (simulation_running) {
-        pthread_mutex_lock(&city->mutex);
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
         
-        // If the booth is free and there are vehicles waiting
-        if (!booth->is_occupied && city->queue_size > 0) {
-            // Take the next vehicle from the queue
-            Vehicle* vehicle = city->vehicle_queue[0];
-            
-            // Remove from queue by shifting all elements
-            for (int i = 0; i < city->queue_size - 1; i++) {
-                city->vehicle_queue[i] = city->vehicle_queue[i + 1];
-            }
-            city->queue_size--;
-            
-            // Process the vehicle
-            booth->is_occupied = 1;
-            booth->current_vehicle = vehicle;
-            
-            // Store booth ID for later reference in statistics
-            vehicle->toll_entry_booth_id = booth_id;
-            
-            // Record the time - different for outbound vs return
-            if (vehicle->is_transported == 0) {
-                vehicle->toll_entry_time = time(NULL);
-            } else {
-                vehicle->toll_entry_time_return = time(NULL);
+        char side_name[MAX_NAME_LENGTH];
+        char type_name[MAX_NAME_LENGTH];
+        double seconds;
+        char extra;
+        int fields = sscanf(line, " %lf , %29[^, \t] , %29[^, \t] %c", &seconds, side_name, type_name, &extra);
+        if (fields <= 0) {
+            char first[2];
+            if (sscanf(line, " %1s", first) <= 0 || line_number == 1) {
+                continue; // Blank line, comment or header
             }
-            
-            printf("%s_%d (%d quota) is being processed at %s\n", 
-                   vehicle->type_name, vehicle->id, vehicle->quota, booth->name);
-            
-            pthread_mutex_unlock(&city->mutex);
-            
-            // Toll processing takes some time (0.5-1.5 seconds)
-            int processing_time = 500000 + rand() % 1000000; // microseconds
-            usleep(processing_time);
-            
-            pthread_mutex_lock(&city->mutex);
-            
-            // After processing, send to waiting area
-            add_to_waiting_area(city, vehicle);
-            
-            // Free up the toll booth
-            booth->is_occupied = 0;
-            booth->current_vehicle = NULL;
-            
-            pthread_mutex_unlock(&city->mutex);
-        } else {
-            pthread_mutex_unlock(&city->mutex);
-            usleep(100000); // 0.1 seconds - prevent excessive CPU usage when idle
         }
+        if (fields != 3 || seconds < 0.0 || seconds > 1e12) {
+            fprintf(stderr, "%s:%d: expected \"time_seconds,side,type\"\n", path, line_number);
+            result = -1;
+            break;
+        }
+        
+        int side = parse_option_name(side_name, side_names, cfg->num_terminals);
+        if (side == cfg->num_terminals) {
+            side = parse_config_int(side_name);
+        }
+        int type = parse_option_name(type_name, vehicle_type_names, TRUCK + 1);
+        if (side < 0 || side >= cfg->num_terminals || type < CAR || type > TRUCK) {
+            fprintf(stderr, "%s:%d: unknown terminal or vehicle type (%s, %s)\n", path, line_number,
+                    side_name, type_name);
+            result = -1;
+            break;
+        }
+        
+        if (arrivals.record_count == capacity) {
+            capacity = capacity ? capacity * 2 : 256;
+            ArrivalRecord* records = (ArrivalRecord*)realloc(arrivals.records, capacity * sizeof(ArrivalRecord));
+            if (!records) {
+                perror("Failed to allocate memory for arrival records");
+                exit(EXIT_FAILURE);
+            }
+            arrivals.records = records;
+        }
+        ArrivalRecord* record = &arrivals.records[arrivals.record_count++];
+        record->time_us = (long long)(seconds * 1000000.0);
+        record->side = (SideId)side;
+        record->type = (VehicleType)type;
+        record->line = line_number;
+        counts[type]++;
     }
+    fclose(file);
     
-    booth->is_running = 0;
-    free(booth_arg);
-    return NULL;
+    if (result == 0 && arrivals.record_count == 0) {
+        fprintf(stderr, "Arrival file %s contains no arrivals\n", path);
+        result = -1;
+    }
+    if (result != 0) {
+        arrivals_destroy();
+        return -1;
+    }
+    
+    // Records are replayed in time order
+    qsort(arrivals.records, arrivals.record_count, sizeof(ArrivalRecord), compare_arrivals);
+    cfg->num_cars = counts[CAR];
+    cfg->num_minibuses = counts[MINIBUS];
+    cfg->num_trucks = counts[TRUCK];
+    return 0;
 }
 
-/**
- * City part functions implementation
- */
-
-/* Sets up a city side with its name and initializes components */
-void initialize_city_part(CityPart* city, const char* name) {
-    strcpy(city->name, name);
-    city->queue_size = 0;
-    city->waiting_area_size = 0;
-    
-    // Setting up thread synchronization
-    pthread_mutex_init(&city->mutex, NULL);
+/* Seeds the generator and draws the first arrival at every terminal */
+void arrivals_init() {
+    rng_init(&arrivals.rng, run_seed, RNG_STREAM_ARRIVALS);
+    arrivals.remaining[CAR] = config.num_cars;
+    arrivals.remaining[MINIBUS] = config.num_minibuses;
+    arrivals.remaining[TRUCK] = config.num_trucks;
+    arrivals.position = 0;
+    arrivals.next_id = 1;
+    arrivals.running = 0;
     
-    // Creating toll booths for this city side
-    char booth_name[MAX_NAME_LENGTH];
-    for (int i = 0; i < NUM_TOLL_BOOTHS; i++) {
-        snprintf(booth_name, MAX_NAME_LENGTH, "%s_Booth_%d", name, i+1);
-        initialize_toll_booth(&city->booths[i], booth_name);
+    if (config.arrival_rate > 0) {
+        arrivals.mean_gap_us = 3600.0 * 1000000.0 / config.arrival_rate;
+        for (int side = 0; side < num_terminals; side++) {
+            arrivals.next_us[side] = rng_exponential(&arrivals.rng, arrivals.mean_gap_us);
+        }
     }
 }
 
-/* Adds a vehicle to the queue for toll processing */
-void add_vehicle_to_queue(CityPart* city, Vehicle* vehicle) {
-    pthread_mutex_lock(&city->mutex);
+/* Takes the next arrival in time order - returns 0 once the whole fleet has arrived */
+int arrival_next(long long* at_us, SideId* side, VehicleType* type) {
+    if (arrivals.records) {
+        if (arrivals.position >= arrivals.record_count) {
+            return 0;
+        }
+        const ArrivalRecord* record = &arrivals.records[arrivals.position++];
+        arrivals.remaining[record->type]--;
+        *at_us = record->time_us;
+        *side = record->side;
+        *type = record->type;
+        return 1;
+    }
     
-    time_t current_time = time(NULL);
+    int total = arrivals.remaining[CAR] + arrivals.remaining[MINIBUS] + arrivals.remaining[TRUCK];
+    if (total == 0) {
+        return 0;
+    }
     
-    if (city->queue_size < MAX_VEHICLES) {
-        // For first-time arrivals (not returning)
-        if (vehicle->is_transported == 0) {
-            vehicle->arrival_time = current_time;
-            strcpy(vehicle->origin, city->name);  // Record origin location
-            
-            printf("%s_%d (%d quota) arrived at %s and joined the queue\n", 
-                   vehicle->type_name, vehicle->id, vehicle->quota, city->name);
+    // Earliest terminal, then the type drawn from what is left of the fleet mix
+    int next = 0;
+    for (int s = 1; s < num_terminals; s++) {
+        if (arrivals.next_us[s] < arrivals.next_us[next]) {
+            next = s;
         }
-        // For returning vehicles, arrival_time_return was set in vehicle_errand_handler
-        
-        // Add to the back of the queue
-        city->vehicle_queue[city->queue_size] = vehicle;
-        city->queue_size++;
-    } else {
-        printf("Queue full at %s, cannot add vehicle %s_%d\n", 
-               city->name, vehicle->type_name, vehicle->id);
     }
+    int pick = rng_below(&arrivals.rng, total);
+    int t = CAR;
+    while (pick >= arrivals.remaining[t]) {
+        pick -= arrivals.remaining[t];
+        t++;
+    }
+    arrivals.remaining[t]--;
     
-    pthread_mutex_unlock(&city->mutex);
+    *at_us = arrivals.next_us[next];
+    *side = (SideId)next;
+    *type = (VehicleType)t;
+    arrivals.next_us[next] += rng_exponential(&arrivals.rng, arrivals.mean_gap_us);
+    return 1;
 }
 
-/* After toll processing, vehicles go to the waiting area */
-void add_to_waiting_area(CityPart* city, Vehicle* vehicle) {
-    if (city->waiting_area_size < MAX_VEHICLES) {
-        // Log completion of toll processing first
-        printf("%s_%d (%d quota) completed toll processing at %s_Booth_%d\n", 
-               vehicle->type_name, vehicle->id, vehicle->quota, city->name, 
-               vehicle->toll_entry_booth_id);
-        
-        // Record entry time to waiting area
-        vehicle->waiting_area_time = time(NULL);
-        
-        // Add to waiting area
-        city->waiting_area[city->waiting_area_size] = vehicle;
-        city->waiting_area_size++;
-        
-        // Log entry to waiting area
-        printf("%s_%d (%d quota) entered the waiting area at %s\n", 
-               vehicle->type_name, vehicle->id, vehicle->quota, city->name);
-    } else {
-        printf("Waiting area full at %s, cannot add vehicle %s_%d\n", 
-               city->name, vehicle->type_name, vehicle->id);
+/* Vehicles of one type that have not arrived yet */
+int arrivals_pending(VehicleType type) {
+    return streaming_arrivals() ? arrivals.remaining[type] : 0;
+}
+
+/* Creates an arriving vehicle and sends it to the terminal's toll queue */
+void inject_arrival(SideId side, VehicleType type) {
+    CityPart* origin = &city_parts[side];
+    Vehicle* vehicle = create_vehicle(arrivals.next_id++, type);
+    vehicle->origin_side = origin->id;
+    vehicle->current_side = origin->id;
+    vehicle->destination_side = pick_destination(&arrivals.rng, origin->id);
+    add_vehicle_to_queue(origin, vehicle);
+}
+
+/* Puts the next arrival on the event calendar (virtual clock mode) */
+void arrivals_schedule_next() {
+    long long at_us;
+    SideId side;
+    VehicleType type;
+    if (arrival_next(&at_us, &side, &type)) {
+        long long delay_us = at_us > virtual_clock_us ? at_us - virtual_clock_us : 0;
+        schedule_event(EVENT_ARRIVAL, delay_us, NULL, &city_parts[side], NULL, NULL, type);
     }
 }
 
-/* Starts the toll booth threads for a city side */
-void start_toll_booths(CityPart* city) {
-    for (int i = 0; i < NUM_TOLL_BOOTHS; i++) {
-        TollBoothArg* arg = (TollBoothArg*)malloc(sizeof(TollBoothArg));
-        arg->booth = &city->booths[i];
-        arg->city = city;
+/* Generator thread - sleeps until each arrival is due, then injects it */
+void* arrival_generator_thread(void* arg) {
+    (void)arg;
+    long long at_us;
+    SideId side;
+    VehicleType type;
+    
+    pthread_mutex_lock(&arrivals.mutex);
+    while (arrivals.running && arrival_next(&at_us, &side, &type)) {
+        for (;;) {
+            long long delay_us = at_us - (long long)((sim_now() - start_time) / 1000);
+            if (!arrivals.running || delay_us <= 0) {
+                break;
+            }
+            struct timespec deadline;
+            make_deadline(delay_us, &deadline);
+            pthread_cond_timedwait(&arrivals.stop_changed, &arrivals.mutex, &deadline);
+        }
+        if (!arrivals.running) {
+            break;
+        }
         
-        pthread_create(&city->booths[i].thread, NULL, toll_booth_process_vehicle, arg);
+        pthread_mutex_unlock(&arrivals.mutex);
+        inject_arrival(side, type);
+        pthread_mutex_lock(&arrivals.mutex);
     }
+    pthread_mutex_unlock(&arrivals.mutex);
+    return NULL;
 }
 
-/**
- * Utility functions
- */
-/* Utility function to prevent negative time differences */
-double safe_difftime(time_t end, time_t start) {
-    if (end < start) {
-        return 0.0; // Return 0 instead of negative value
+/* Starts the generator thread (real-time mode) */
+void arrivals_start() {
+    arrivals.running = 1;
+    platform_cond_init(&arrivals.stop_changed);
+    if (platform_thread_create(&arrivals.thread, arrival_generator_thread, NULL, -1) != 0) {
+        perror("Failed to create arrival generator thread");
+        exit(EXIT_FAILURE);
     }
-    return difftime(end, start);
 }
 
-/**
- * Ferry functions implementation
- */
-
-/* Set up a new ferry with specified capacity */
-void initialize_ferry(Ferry* ferry, int capacity) {
-    ferry->capacity = capacity;
-    ferry->current_load = 0;
-    ferry->vehicle_count = 0;
-    ferry->is_loading = 0;
-    ferry->is_moving = 0;
-    ferry->is_unloading = 0;
-    ferry->is_running = 0;
-    pthread_mutex_init(&ferry->mutex, NULL);
+/* Stops the generator thread and waits for it */
+void arrivals_stop() {
+    pthread_mutex_lock(&arrivals.mutex);
+    arrivals.running = 0;
+    pthread_cond_broadcast(&arrivals.stop_changed);
+    pthread_mutex_unlock(&arrivals.mutex);
+    pthread_join(arrivals.thread, NULL);
+    pthread_cond_destroy(&arrivals.stop_changed);
 }
 
-/* Dock the ferry at a city side */
-void dock_at(Ferry* ferry, CityPart* city_part) {
-    ferry->location = city_part;
-    printf("Ferry docked at %s\n", city_part->name);
+/* Releases the recorded arrivals */
+void arrivals_destroy() {
+    free(arrivals.records);
+    arrivals.records = NULL;
+    arrivals.record_count = 0;
 }
 
-/* Load a vehicle onto the ferry */
-int load_vehicle(Ferry* ferry, Vehicle* vehicle) {
-    pthread_mutex_lock(&ferry->mutex);
-    
-    if (ferry->current_load + vehicle->quota <= ferry->capacity) {
-        // Check if this is a return journey
-        int is_return_journey = vehicle->is_transported == 1;
-        
-        if (!is_return_journey) {
-            // Outbound journey (first trip)
-            vehicle->boarding_time = time(NULL);
-            vehicle->outbound_trip_number = trip_count + 1; // Track which trip this is
-            
-            // Calculate waiting times for reporting
-            double queue_wait_time = difftime(vehicle->toll_entry_time, vehicle->arrival_time);
-            double waiting_area_time = difftime(vehicle->boarding_time, vehicle->waiting_area_time);
-            
-            // Ensure times are never negative (chronological order preserved)
-            if (queue_wait_time < 0) queue_wait_time = 0;
-            if (waiting_area_time < 0) waiting_area_time = 0;
-            
-            // Total time is sum of components
-            double total_wait_time = queue_wait_time + waiting_area_time;
-            
-            printf("%s_%d (%d quota) boarded the ferry for outbound journey (Used: %d/%d, Remaining: %d)\n",
-                   vehicle->type_name, vehicle->id, vehicle->quota,
-                   ferry->current_load + vehicle->quota, ferry->capacity, 
-                   ferry->capacity - (ferry->current_load + vehicle->quota));
-            
-            printf("  - %s_%d waiting times: In queue: %.1f sec, In waiting area: %.1f sec, Total: %.1f sec\n",
-                   vehicle->type_name, vehicle->id, queue_wait_time, waiting_area_time, total_wait_time);
-        } else {
-            // Return journey
-            vehicle->boarding_time_return = time(NULL);
-            vehicle->return_trip_number = trip_count + 1; // Track return trip number
-            
-            // Fix return waiting times calculation
-            double queue_wait = safe_difftime(vehicle->toll_entry_time_return, vehicle->arrival_time_return);
-            double waiting_area_wait = safe_difftime(vehicle->boarding_time_return, vehicle->toll_entry_time_return);
-            
-            // Ensure times are never negative
-            if (queue_wait < 0) queue_wait = 0;
-            if (waiting_area_wait < 0) waiting_area_wait = 0;
-            
-            // Total time is sum of components
-            double total_wait = queue_wait + waiting_area_wait;
-            
-            printf("%s_%d (%d quota) boarded the ferry for return journey (Used: %d/%d, Remaining: %d)\n",
-                   vehicle->type_name, vehicle->id, vehicle->quota,
-                   ferry->current_load + vehicle->quota, ferry->capacity, 
-                   ferry->capacity - (ferry->current_load + vehicle->quota));
-            
-            printf("  - %s_%d return waiting times: In queue: %.1f sec, In waiting area: %.1f sec, Total: %.1f sec\n", 
-                   vehicle->type_name, vehicle->id, queue_wait, waiting_area_wait, total_wait);
-        }
-        
-        // Add vehicle to ferry
-        ferry->vehicles[ferry->vehicle_count] = vehicle;
-        ferry->vehicle_count++;
-        ferry->current_load += vehicle->quota;
-        
-        pthread_mutex_unlock(&ferry->mutex);
-        return 1; // Successfully loaded
-    }
-    
-    pthread_mutex_unlock(&ferry->mutex);
-    return 0; // Could not load (ferry would exceed capacity)
-}
+/**
+ * Asynchronous log
+ * Threads format a message into a slot of a bounded ring and return - a single writer
+ * thread drains the ring to stdout, so no terminal I/O happens while a simulation lock is
+ * held. Slots are claimed with an atomic counter and handed over with a per-slot sequence
+ * number, so producers never take a lock (a bounded MPSC queue in the style of Vyukov's).
+ */
+/* One structured log record */
+typedef struct {
+    atomic_ulong sequence;        // == position: free for a producer, == position + 1: ready
+    SimTime time_ns;
+    LogLevel level;
+    LogEvent event;
+    int vehicle_id;               // -1 if not about a single vehicle
+    int side;                     // SideId, -1 if none
+    int booth;                    // 1-based booth number at that side, -1 if none
+    char text[LOG_TEXT_LENGTH];   // Formatted message, including its newline
+} LogRecord;
 
-/* Trip count is now defined globally */
+/* The ring plus the writer thread that drains it */
+typedef struct {
+    LogRecord* records;
+    atomic_ulong head;            // Next position a producer claims
+    unsigned long tail;           // Next position the writer reads - writer thread only
+    atomic_int writer_waiting;    // Writer is (about to be) asleep on available
+    unsigned long written;        // Records written so far, protected by mutex
+    pthread_mutex_t mutex;
+    pthread_cond_t available;     // Signalled when a record is published while the writer waits
+    pthread_cond_t drained;       // Broadcast when the writer catches up with head
+    pthread_t writer;
+    int running;                  // Protected by mutex
+    int started;
+} LogRing;
 
-/* Number of required vehicles to be transported */
-#define TOTAL_VEHICLES 30
+LogRing log_ring = { NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+                     PTHREAD_COND_INITIALIZER, 0, 0, 0 };
 
-/* Check if the ferry can depart based on the rules */
-int can_depart(Ferry* ferry) {
-    static time_t last_message_time = 0;      // Time when last message was displayed
-    static int last_vehicles_needed = 0;       // Number of vehicles in last message
-    static int last_unfilled_quota = 0;        // Amount of quota in last message
-    static int last_state = 0;                // Previous departure state
+/* Returns 1 if messages of this level are written */
+int log_enabled(LogLevel level) {
+    return level != LOG_SILENT && level <= config.log_level;
+}
+
+/* Formats a message into the ring - never blocks on I/O, only yields while the ring is full */
+void sim_log(LogLevel level, LogEvent event, int vehicle_id, int side, int booth, const char* format, ...) {
+    if (!log_enabled(level)) {
+        return; // Nothing is formatted for suppressed levels
+    }
+    if (!log_ring.started) {
+        // No writer yet (or any more) - write directly
+        va_list args;
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
     
-    // Only lock mutex when accessing shared data
-    CityPart* location = ferry->location;
-    int vehicle_count = ferry->vehicle_count;
-    int current_load = ferry->current_load;
-    int capacity = ferry->capacity;
+    unsigned long position = atomic_fetch_add_explicit(&log_ring.head, 1, memory_order_relaxed);
+    LogRecord* record = &log_ring.records[position & (LOG_RING_SIZE - 1)];
     
-    // First check if there are any vehicles on the ferry
-    if (vehicle_count == 0) {
-        return 0;
+    // Wait for the writer to free the slot if the ring has wrapped around
+    while (atomic_load_explicit(&record->sequence, memory_order_acquire) != position) {
+        sched_yield();
     }
     
-    // Calculate remaining vehicles requiring transport
-    int remaining_vehicles = TOTAL_VEHICLES - total_vehicles_transported;
-    int can_leave = 0;
-    int departure_reason = 0; // 1=full, 2=partial with no waiting, 3=other side needs
+    record->time_ns = sim_now();
+    record->level = level;
+    record->event = event;
+    record->vehicle_id = vehicle_id;
+    record->side = side;
+    record->booth = booth;
+    va_list args;
+    va_start(args, format);
+    vsnprintf(record->text, LOG_TEXT_LENGTH, format, args);
+    va_end(args);
     
-    // Rule 1: Ferry is completely full
-    if (current_load == capacity) {
-        can_leave = 1;
-        departure_reason = 1;
+    // Publish, then wake the writer only if it went to sleep (see log_writer)
+    atomic_store(&record->sequence, position + 1);
+    if (atomic_load(&log_ring.writer_waiting)) {
+        pthread_mutex_lock(&log_ring.mutex);
+        pthread_cond_signal(&log_ring.available);
+        pthread_mutex_unlock(&log_ring.mutex);
     }
-            // Check potential for additional capacity filling
-    else {
-        int unfilled_quota = capacity - current_load;
-        
-        // Find all potential vehicles for loading
-        Vehicle* potential_vehicles[MAX_VEHICLES];
-        int potential_count = 0;
-        
-        pthread_mutex_lock(&location->mutex);
-        
-        // Check waiting area first - these are ready to board
-        for (int i = 0; i < location->waiting_area_size; i++) {
-            if (location->waiting_area[i]->quota <= unfilled_quota) {
-                potential_vehicles[potential_count++] = location->waiting_area[i];
-            }
-        }
-        
-        // Then check any vehicles in toll booths
-        for (int i = 0; i < NUM_TOLL_BOOTHS; i++) {
-            if (location->booths[i].is_occupied && 
-                location->booths[i].current_vehicle != NULL &&
-                location->booths[i].current_vehicle->quota <= unfilled_quota) {
-                potential_vehicles[potential_count++] = location->booths[i].current_vehicle;
-            }
+}
+
+/* Writes one record to stdout */
+void log_write_record(const LogRecord* record) {
+    if (config.log_level >= LOG_DEBUG) {
+        // Leading newlines stay in front of the prefix so blank separator lines survive
+        const char* text = record->text;
+        while (*text == '\n') {
+            fputc('\n', stdout);
+            text++;
         }
-        
-        // Finally check the queue
-        for (int i = 0; i < location->queue_size; i++) {
-            if (location->vehicle_queue[i]->quota <= unfilled_quota) {
-                potential_vehicles[potential_count++] = location->vehicle_queue[i];
-                if (potential_count >= MAX_VEHICLES - 1) break; // Safety check
-            }
+        fprintf(stdout, "[%13.6f] %-9s v=%-5d side=%-2d booth=%-2d | ",
+                record->time_ns / 1e9, log_event_names[record->event],
+                record->vehicle_id, record->side, record->booth);
+        fputs(text, stdout);
+    } else {
+        fputs(record->text, stdout);
+    }
+}
+
+/* Writer thread - drains published records in order and sleeps when the ring is empty */
+void* log_writer(void* arg) {
+    (void)arg;
+    
+    for (;;) {
+        LogRecord* record = &log_ring.records[log_ring.tail & (LOG_RING_SIZE - 1)];
+        if (atomic_load_explicit(&record->sequence, memory_order_acquire) == log_ring.tail + 1) {
+            log_write_record(record);
+            // Hand the slot back for the producer one lap ahead
+            atomic_store_explicit(&record->sequence, log_ring.tail + LOG_RING_SIZE, memory_order_release);
+            log_ring.tail++;
+            continue;
         }
         
-        pthread_mutex_unlock(&location->mutex);
-        
-        // Calculate potential for reaching full capacity
-        // Sort vehicles by quota size (larger first) for better packing
-        for (int i = 0; i < potential_count; i++) {
-            for (int j = i + 1; j < potential_count; j++) {
-                if (potential_vehicles[i]->quota < potential_vehicles[j]->quota) {
-                    Vehicle* temp = potential_vehicles[i];
-                    potential_vehicles[i] = potential_vehicles[j];
-                    potential_vehicles[j] = temp;
-                }
-            }
-        }
+        // Caught up - flush stdout once per batch rather than per line
+        fflush(stdout);
         
-        // Try to fit vehicles optimally
-        int remaining = unfilled_quota;
-        int vehicles_fitted = 0;
-        int total_quota_fitted = 0;
+        pthread_mutex_lock(&log_ring.mutex);
+        log_ring.written = log_ring.tail;
+        pthread_cond_broadcast(&log_ring.drained);
         
-        // First try for perfect fit (prefer larger vehicles)
-        for (int i = 0; i < potential_count; i++) {
-            if (potential_vehicles[i]->quota == remaining) {
-                // Perfect fit!
-                total_quota_fitted += potential_vehicles[i]->quota;
-                vehicles_fitted++;
-                remaining = 0;
+        // Announce the wait before the final check, so a producer publishing after the
+        // check is guaranteed to see writer_waiting and signal
+        atomic_store(&log_ring.writer_waiting, 1);
+        int stop = 0;
+        while (atomic_load(&record->sequence) != log_ring.tail + 1) {
+            if (!log_ring.running && atomic_load(&log_ring.head) == log_ring.tail) {
+                stop = 1;
                 break;
             }
+            pthread_cond_wait(&log_ring.available, &log_ring.mutex);
         }
+        atomic_store(&log_ring.writer_waiting, 0);
+        pthread_mutex_unlock(&log_ring.mutex);
         
-        // If no perfect fit, try to add as many as possible
-        if (remaining > 0) {
-            for (int i = 0; i < potential_count; i++) {
-                if (potential_vehicles[i]->quota <= remaining) {
-                    remaining -= potential_vehicles[i]->quota;
-                    total_quota_fitted += potential_vehicles[i]->quota;
-                    vehicles_fitted++;
-                    if (remaining == 0) break;
-                }
-            }
-        }
-        
-        // Different departure conditions
-        
-        // Condition 1: Ferry can potentially reach full capacity - wait for these vehicles
-        if (total_quota_fitted >= unfilled_quota) {
-            // Only show message when status changes or periodically
-            time_t current_time = time(NULL);
-            if (last_vehicles_needed != vehicles_fitted || last_unfilled_quota != unfilled_quota || 
-                difftime(current_time, last_message_time) >= 5.0) { // Show message every 5 seconds
-                
-                printf("Waiting for %d more vehicles to reach full capacity before departing (%d/%d quotas filled)\n", 
-                       vehicles_fitted, current_load, capacity);
-                
-                // Update status
-                last_message_time = current_time;
-                last_vehicles_needed = vehicles_fitted;
-                last_unfilled_quota = unfilled_quota;
-                last_state = 0;
-            }
-            can_leave = 0;
-        }
-        // Condition 2: Only 1 quota left unfilled and no cars available
-        else if (unfilled_quota == 1 && total_quota_fitted == 0) {
-            if (last_state != 2) {
-                printf("Only 1 quota left unfilled and no cars available - ready to depart\n");
-                last_state = 2;
-            }
-            can_leave = 1;
-            departure_reason = 2;
-        }
-        // Condition 3: Only 2 quotas left unfilled and no fitting vehicles
-        else if (unfilled_quota == 2 && total_quota_fitted == 0) {
-            if (last_state != 3) {
-                printf("Only 2 quotas left unfilled and no fitting vehicles available - ready to depart\n");
-                last_state = 3;
-            }
-            can_leave = 1;
-            departure_reason = 2;
-        }
-        // Condition 4: Only 3 quotas left unfilled and no fitting vehicles
-        else if (unfilled_quota == 3 && total_quota_fitted == 0) {
-            if (last_state != 4) {
-                printf("Only 3 quotas left unfilled and no fitting vehicles available - ready to depart\n");
-                last_state = 4;
-            }
-            can_leave = 1;
-            departure_reason = 2;
-        }
-        // Condition 5: Final trip - ferry has all remaining vehicles
-        else if (vehicle_count == remaining_vehicles && total_quota_fitted == 0) {
-            if (last_state != 5) {
-                printf("Final trip: Ferry has all remaining %d vehicles - ready to depart\n", remaining_vehicles);
-                last_state = 5;
-            }
-            can_leave = 1;
-            departure_reason = 2;
-        }
-        // Condition 6: No more vehicles here but vehicles waiting on other side
-        else if (total_quota_fitted == 0) {
-            // Check for vehicles on the other side
-            CityPart* other_side = (location == &side_a) ? &side_b : &side_a;
-            pthread_mutex_lock(&other_side->mutex);
-            int other_side_has_vehicles = (other_side->queue_size > 0 || other_side->waiting_area_size > 0);
-            pthread_mutex_unlock(&other_side->mutex);
-            
-            if (other_side_has_vehicles) {
-                if (last_state != 6) {
-                    printf("No more vehicles at current side, but vehicles waiting at other side - ferry departing\n");
-                    last_state = 6;
-                }
-                can_leave = 1;
-                departure_reason = 3;
-            } else {
-                // Both sides empty
-                if (last_state != 7) {
-                    printf("Both sides empty, ferry departing with partial load: %d/%d quotas\n", 
-                          current_load, capacity);
-                    last_state = 7;
-                }
-                can_leave = 1;
-                departure_reason = 2;
-            }
+        if (stop) {
+            break;
         }
     }
+    return NULL;
+}
 
-    // Only report status change
-    if (can_leave && departure_reason == 1 && last_state != 1) {
-        printf("Ferry is at full capacity and ready to depart\n");
-        last_state = 1;
+/* Allocates the ring and starts the writer thread */
+void log_start() {
+    if (config.log_level == LOG_SILENT) {
+        return; // Nothing will ever be logged
     }
     
-    return can_leave;
+    log_ring.records = (LogRecord*)malloc(LOG_RING_SIZE * sizeof(LogRecord));
+    if (!log_ring.records) {
+        perror("Failed to allocate memory for log ring");
+        exit(EXIT_FAILURE);
+    }
+    for (unsigned long i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&log_ring.records[i].sequence, i);
+    }
+    atomic_store(&log_ring.head, 0);
+    log_ring.tail = 0;
+    log_ring.written = 0;
+    log_ring.running = 1;
+    log_ring.started = 1;
+    
+    platform_thread_create(&log_ring.writer, log_writer, NULL, -1);
 }
 
-/* Structure for storing comprehensive vehicle statistics */
-#define MAX_VEHICLE_RECORDS 100
-typedef struct {
-    int id;
-    char type_name[MAX_NAME_LENGTH];
-    int quota;
-    char origin[MAX_NAME_LENGTH];
-    double outbound_queue_time;
-    double outbound_journey_time;
-    int outbound_trip_number;
-    double return_queue_time;
-    double return_journey_time;
-    int return_trip_number;
-    double total_round_trip_time;
-    double time_at_destination;    // Time spent at destination before return
-    int completed_round_trip;
-} VehicleRecord;
-
-VehicleRecord vehicle_records[MAX_VEHICLE_RECORDS];
-int recorded_vehicle_count = 0;
-pthread_mutex_t vehicle_records_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-/* Adds a completed vehicle to the statistics records */
-void record_transported_vehicle(Vehicle* vehicle) {
-    pthread_mutex_lock(&vehicle_records_mutex);
+/* Blocks until everything logged so far has been written */
+void log_flush() {
+    if (!log_ring.started) {
+        fflush(stdout);
+        return;
+    }
     
-    if (recorded_vehicle_count < MAX_VEHICLE_RECORDS) {
-        VehicleRecord* record = &vehicle_records[recorded_vehicle_count];
-        record->id = vehicle->id;
-        strcpy(record->type_name, vehicle->type_name);
-        record->quota = vehicle->quota;
-        strcpy(record->origin, vehicle->origin);  // Where the vehicle started
-        record->completed_round_trip = 0;
-        
-        // Safety checks to ensure all timestamps are valid before calculations
-        // If any timestamps aren't set or are wrong, fix them
-        
-        // Initialize with arrival time if not set
-        if (vehicle->toll_entry_time == 0)
-            vehicle->toll_entry_time = vehicle->arrival_time;
-        if (vehicle->boarding_time == 0)
-            vehicle->boarding_time = vehicle->arrival_time;
-        if (vehicle->unload_time == 0)
-            vehicle->unload_time = vehicle->boarding_time;
-        
-        // Ensure outbound timestamps are in correct chronological order
-        if (vehicle->toll_entry_time < vehicle->arrival_time)
-            vehicle->toll_entry_time = vehicle->arrival_time;
-        if (vehicle->boarding_time < vehicle->toll_entry_time)
-            vehicle->boarding_time = vehicle->toll_entry_time;
-        if (vehicle->unload_time < vehicle->boarding_time)
-            vehicle->unload_time = vehicle->boarding_time;
+    unsigned long target = atomic_load(&log_ring.head);
+    pthread_mutex_lock(&log_ring.mutex);
+    while (log_ring.written < target) {
+        pthread_cond_signal(&log_ring.available);
+        pthread_cond_wait(&log_ring.drained, &log_ring.mutex);
+    }
+    pthread_mutex_unlock(&log_ring.mutex);
+}
+
+/* Writes what is left, stops the writer and frees the ring - later messages go straight to stdout */
+void log_stop() {
+    if (!log_ring.started) {
+        fflush(stdout);
+        return;
+    }
+    
+    pthread_mutex_lock(&log_ring.mutex);
+    log_ring.running = 0;
+    pthread_cond_signal(&log_ring.available);
+    pthread_mutex_unlock(&log_ring.mutex);
+    pthread_join(log_ring.writer, NULL);
+    
+    log_ring.started = 0;
+    free(log_ring.records);
+    log_ring.records = NULL;
+    pthread_mutex_destroy(&log_ring.mutex);
+    pthread_cond_destroy(&log_ring.available);
+    pthread_cond_destroy(&log_ring.drained);
+    fflush(stdout);
+}
+
+/**
+ * Live metrics
+ * Counters are bumped with relaxed atomics at the point of change. A stats thread writes
+ * them in Prometheus text exposition format every stats_interval seconds - to a temporary
+ * file that is then renamed, so a scraper (e.g. node_exporter's textfile collector) never
+ * sees a half-written snapshot.
+ */
+/* The stats publisher thread */
+typedef struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t stop;          // Signalled when the simulation ends (set up by stats_start)
+    int running;                  // Protected by mutex
+    int started;
+} StatsPublisher;
+
+StatsPublisher stats_publisher = { .mutex = PTHREAD_MUTEX_INITIALIZER };
+
+/* Adjusts a live counter - never orders other memory accesses */
+void metric_add(atomic_int* counter, int delta) {
+    atomic_fetch_add_explicit(counter, delta, memory_order_relaxed);
+}
+
+/* Opens a group of counter updates that snapshots see whole or not at all. This is a seqlock
+ * for many writers: writers never wait for each other or for readers, and groups may nest.
+ * The fence keeps the group's updates from becoming visible before writers does */
+void metric_update_begin() {
+    atomic_fetch_add_explicit(&live_metrics.writers, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/* Closes a group opened by metric_update_begin */
+void metric_update_end() {
+    atomic_fetch_add_explicit(&live_metrics.epoch, 1, memory_order_release);
+    atomic_fetch_sub_explicit(&live_metrics.writers, 1, memory_order_release);
+}
+
+/* Locks a measured mutex. The uncontended path is a single trylock; only when it fails is
+ * the wait timed and added to lock_stats */
+void lock_mutex(pthread_mutex_t* mutex, LockClass lock_class) {
+    if (pthread_mutex_trylock(mutex) == 0) {
+        return;
+    }
+    SimTime wait_start = monotonic_ns();
+    pthread_mutex_lock(mutex);
+    atomic_fetch_add_explicit(&lock_stats[lock_class].contended, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&lock_stats[lock_class].wait_ns, monotonic_ns() - wait_start, memory_order_relaxed);
+}
+
+/* Zeroes the counters and allocates the per-ferry ones - needs num_ferries */
+void live_metrics_init() {
+    for (int side = 0; side < MAX_TERMINALS; side++) {
+        atomic_init(&live_metrics.queue_depth[side], 0);
+        atomic_init(&live_metrics.waiting_area_size[side], 0);
+        atomic_init(&live_metrics.booths_busy[side], 0);
+        atomic_init(&live_metrics.booths_open[side], side < num_terminals ? city_parts[side].open_booths : 0);
+    }
+    live_metrics.ferry_load = (atomic_int*)malloc(num_ferries * sizeof(atomic_int));
+    live_metrics.ferry_vehicles = (atomic_int*)malloc(num_ferries * sizeof(atomic_int));
+    if (!live_metrics.ferry_load || !live_metrics.ferry_vehicles) {
+        perror("Failed to allocate memory for live metrics");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < num_ferries; i++) {
+        atomic_init(&live_metrics.ferry_load[i], 0);
+        atomic_init(&live_metrics.ferry_vehicles[i], 0);
+    }
+    atomic_init(&live_metrics.trips_completed, 0);
+    atomic_init(&live_metrics.vehicles_transported, 0);
+    atomic_init(&live_metrics.vehicles_dropped, 0);
+    atomic_init(&live_metrics.clock_ns, 0);
+    atomic_init(&live_metrics.events, 0);
+    atomic_init(&live_metrics.writers, 0);
+    atomic_init(&live_metrics.epoch, 0);
+    atomic_init(&live_metrics.snapshot_retries, 0);
+    atomic_init(&live_metrics.snapshots_torn, 0);
+    for (int i = 0; i < LOCK_CLASS_COUNT; i++) {
+        atomic_init(&lock_stats[i].contended, 0);
+        atomic_init(&lock_stats[i].wait_ns, 0);
+    }
+}
+
+void live_metrics_destroy() {
+    free(live_metrics.ferry_load);
+    free(live_metrics.ferry_vehicles);
+    live_metrics.ferry_load = NULL;
+    live_metrics.ferry_vehicles = NULL;
+}
+
+/* Reads a counter for a snapshot */
+int metric_read(atomic_int* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/* Sizes a snapshot for the fleet - needs num_ferries */
+void metrics_snapshot_init(MetricsSnapshot* snapshot) {
+    snapshot->ferry_load = (int*)malloc(num_ferries * sizeof(int));
+    snapshot->ferry_vehicles = (int*)malloc(num_ferries * sizeof(int));
+    if (!snapshot->ferry_load || !snapshot->ferry_vehicles) {
+        perror("Failed to allocate memory for a metrics snapshot");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void metrics_snapshot_destroy(MetricsSnapshot* snapshot) {
+    free(snapshot->ferry_load);
+    free(snapshot->ferry_vehicles);
+    snapshot->ferry_load = NULL;
+    snapshot->ferry_vehicles = NULL;
+}
+
+/* Copies the moving counters without taking any lock. The copy is retried while an update
+ * group is in progress or completed during the read - returns 1 for a coherent copy, 0 if
+ * writers kept getting in the way and the last copy may be torn */
+int metrics_snapshot(MetricsSnapshot* snapshot) {
+    for (int attempt = 1; ; attempt++) {
+        unsigned long epoch = atomic_load_explicit(&live_metrics.epoch, memory_order_acquire);
+        int writers = atomic_load_explicit(&live_metrics.writers, memory_order_acquire);
+        
+        for (int side = 0; side < num_terminals; side++) {
+            snapshot->queue_depth[side] = metric_read(&live_metrics.queue_depth[side]);
+            snapshot->waiting_area_size[side] = metric_read(&live_metrics.waiting_area_size[side]);
+            snapshot->booths_busy[side] = metric_read(&live_metrics.booths_busy[side]);
+            snapshot->booths_open[side] = metric_read(&live_metrics.booths_open[side]);
+        }
+        for (int i = 0; i < num_ferries; i++) {
+            snapshot->ferry_load[i] = metric_read(&live_metrics.ferry_load[i]);
+            snapshot->ferry_vehicles[i] = metric_read(&live_metrics.ferry_vehicles[i]);
+        }
+        snapshot->trips_completed = metric_read(&live_metrics.trips_completed);
+        snapshot->vehicles_transported = metric_read(&live_metrics.vehicles_transported);
+        snapshot->vehicles_dropped = metric_read(&live_metrics.vehicles_dropped);
+        
+        // A group that touched what was read has raised writers by now - and if it has
+        // already finished, the acquire on writers makes its epoch increment visible
+        atomic_thread_fence(memory_order_seq_cst);
+        writers += atomic_load_explicit(&live_metrics.writers, memory_order_acquire);
+        if (writers == 0 && atomic_load_explicit(&live_metrics.epoch, memory_order_relaxed) == epoch) {
+            return 1;
+        }
+        if (attempt == SNAPSHOT_MAX_ATTEMPTS) {
+            atomic_fetch_add_explicit(&live_metrics.snapshots_torn, 1, memory_order_relaxed);
+            return 0;
+        }
+        atomic_fetch_add_explicit(&live_metrics.snapshot_retries, 1, memory_order_relaxed);
+        sched_yield();
+    }
+}
+
+/* Writes one snapshot of every counter to path - returns 0 on success */
+int write_live_metrics(const char* path) {
+    char temp_path[MAX_CONFIG_LINE + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    FILE* file = fopen(temp_path, "w");
+    if (!file) {
+        return -1;
+    }
+    
+    // Queues, booths and ferries are read as one coherent snapshot
+    MetricsSnapshot snapshot;
+    metrics_snapshot_init(&snapshot);
+    int coherent = metrics_snapshot(&snapshot);
+    
+    SimTime now = config.virtual_clock ?
+                  atomic_load_explicit(&live_metrics.clock_ns, memory_order_relaxed) : sim_now();
+    fprintf(file, "# HELP ferry_sim_elapsed_seconds Simulated time since the run started.\n");
+    fprintf(file, "# TYPE ferry_sim_elapsed_seconds gauge\n");
+    fprintf(file, "ferry_sim_elapsed_seconds %.3f\n", (double)(now - start_time) / NS_PER_SECOND);
+    fprintf(file, "# HELP ferry_sim_running 1 while the simulation is running.\n");
+    fprintf(file, "# TYPE ferry_sim_running gauge\n");
+    fprintf(file, "ferry_sim_running %d\n", simulation_running ? 1 : 0);
+    
+    fprintf(file, "# HELP ferry_sim_queue_depth Vehicles waiting for a toll booth.\n");
+    fprintf(file, "# TYPE ferry_sim_queue_depth gauge\n");
+    for (int side = 0; side < num_terminals; side++) {
+        fprintf(file, "ferry_sim_queue_depth{side=\"%s\"} %d\n", side_names[side],
+                snapshot.queue_depth[side]);
+    }
+    fprintf(file, "# HELP ferry_sim_waiting_area_vehicles Vehicles in the waiting area.\n");
+    fprintf(file, "# TYPE ferry_sim_waiting_area_vehicles gauge\n");
+    for (int side = 0; side < num_terminals; side++) {
+        fprintf(file, "ferry_sim_waiting_area_vehicles{side=\"%s\"} %d\n", side_names[side],
+                snapshot.waiting_area_size[side]);
+    }
+    fprintf(file, "# HELP ferry_sim_booths_busy Toll booths processing a vehicle.\n");
+    fprintf(file, "# TYPE ferry_sim_booths_busy gauge\n");
+    for (int side = 0; side < num_terminals; side++) {
+        fprintf(file, "ferry_sim_booths_busy{side=\"%s\"} %d\n", side_names[side],
+                snapshot.booths_busy[side]);
+    }
+    fprintf(file, "# HELP ferry_sim_booths Toll booths per side.\n");
+    fprintf(file, "# TYPE ferry_sim_booths gauge\n");
+    fprintf(file, "ferry_sim_booths %d\n", config.booths_per_side);
+    fprintf(file, "# HELP ferry_sim_booths_open Toll booths currently open.\n");
+    fprintf(file, "# TYPE ferry_sim_booths_open gauge\n");
+    for (int side = 0; side < num_terminals; side++) {
+        fprintf(file, "ferry_sim_booths_open{side=\"%s\"} %d\n", side_names[side],
+                snapshot.booths_open[side]);
+    }
+    
+    fprintf(file, "# HELP ferry_sim_ferry_load_quota Quota currently aboard each ferry.\n");
+    fprintf(file, "# TYPE ferry_sim_ferry_load_quota gauge\n");
+    for (int i = 0; i < num_ferries; i++) {
+        fprintf(file, "ferry_sim_ferry_load_quota{ferry=\"Ferry_%d\"} %d\n", i + 1,
+                snapshot.ferry_load[i]);
+    }
+    fprintf(file, "# HELP ferry_sim_ferry_vehicles Vehicles currently aboard each ferry.\n");
+    fprintf(file, "# TYPE ferry_sim_ferry_vehicles gauge\n");
+    for (int i = 0; i < num_ferries; i++) {
+        fprintf(file, "ferry_sim_ferry_vehicles{ferry=\"Ferry_%d\"} %d\n", i + 1,
+                snapshot.ferry_vehicles[i]);
+    }
+    fprintf(file, "# HELP ferry_sim_ferry_capacity_quota Capacity of each ferry.\n");
+    fprintf(file, "# TYPE ferry_sim_ferry_capacity_quota gauge\n");
+    fprintf(file, "ferry_sim_ferry_capacity_quota %d\n", config.ferry_capacity);
+    
+    fprintf(file, "# HELP ferry_sim_trips_completed_total Completed ferry crossings.\n");
+    fprintf(file, "# TYPE ferry_sim_trips_completed_total counter\n");
+    fprintf(file, "ferry_sim_trips_completed_total %d\n", snapshot.trips_completed);
+    fprintf(file, "# HELP ferry_sim_vehicles_transported_total Vehicles that completed their round trip.\n");
+    fprintf(file, "# TYPE ferry_sim_vehicles_transported_total counter\n");
+    fprintf(file, "ferry_sim_vehicles_transported_total %d\n", snapshot.vehicles_transported);
+    fprintf(file, "# HELP ferry_sim_vehicles_dropped_total Vehicles turned away by a full toll queue or waiting area.\n");
+    fprintf(file, "# TYPE ferry_sim_vehicles_dropped_total counter\n");
+    fprintf(file, "ferry_sim_vehicles_dropped_total %d\n", snapshot.vehicles_dropped);
+    fprintf(file, "# HELP ferry_sim_fleet_vehicles Vehicles in the simulated fleet.\n");
+    fprintf(file, "# TYPE ferry_sim_fleet_vehicles gauge\n");
+    fprintf(file, "ferry_sim_fleet_vehicles %d\n", total_fleet_size());
+    fprintf(file, "# HELP ferry_sim_events_total Vehicle and ferry events processed.\n");
+    fprintf(file, "# TYPE ferry_sim_events_total counter\n");
+    fprintf(file, "ferry_sim_events_total %lld\n", atomic_load_explicit(&live_metrics.events, memory_order_relaxed));
+    fprintf(file, "# HELP ferry_sim_snapshot_coherent 1 if this snapshot's queue, booth and ferry figures were read coherently.\n");
+    fprintf(file, "# TYPE ferry_sim_snapshot_coherent gauge\n");
+    fprintf(file, "ferry_sim_snapshot_coherent %d\n", coherent);
+    fprintf(file, "# HELP ferry_sim_snapshot_retries_total Snapshot reads repeated because counters were being updated.\n");
+    fprintf(file, "# TYPE ferry_sim_snapshot_retries_total counter\n");
+    fprintf(file, "ferry_sim_snapshot_retries_total %lld\n",
+            atomic_load_explicit(&live_metrics.snapshot_retries, memory_order_relaxed));
+    fprintf(file, "# HELP ferry_sim_lock_wait_seconds_total Time threads spent blocked on each mutex family.\n");
+    fprintf(file, "# TYPE ferry_sim_lock_wait_seconds_total counter\n");
+    for (int i = 0; i < LOCK_CLASS_COUNT; i++) {
+        fprintf(file, "ferry_sim_lock_wait_seconds_total{lock=\"%s\"} %.6f\n", lock_class_names[i],
+                (double)atomic_load_explicit(&lock_stats[i].wait_ns, memory_order_relaxed) / NS_PER_SECOND);
+    }
+    
+    metrics_snapshot_destroy(&snapshot);
+    if (fclose(file) != 0 || rename(temp_path, path) != 0) {
+        remove(temp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/* Stats thread - publishes a snapshot every stats_interval seconds until stopped */
+void* stats_publisher_loop(void* arg) {
+    (void)arg;
+    
+    pthread_mutex_lock(&stats_publisher.mutex);
+    while (stats_publisher.running) {
+        pthread_mutex_unlock(&stats_publisher.mutex);
+        if (write_live_metrics(config.stats_file) != 0) {
+            perror("Failed to write live metrics");
+        }
+        pthread_mutex_lock(&stats_publisher.mutex);
+        
+        struct timespec deadline;
+        make_deadline(config.stats_interval * 1000000LL, &deadline);
+        while (stats_publisher.running &&
+               pthread_cond_timedwait(&stats_publisher.stop, &stats_publisher.mutex, &deadline) == 0) {
+            // Woken early - loop until the interval is over or the simulation stops
+        }
+    }
+    pthread_mutex_unlock(&stats_publisher.mutex);
+    return NULL;
+}
+
+/* Starts the stats thread if a metrics file was requested */
+void stats_start() {
+    if (!config.stats_file[0]) {
+        return;
+    }
+    stats_publisher.running = 1;
+    stats_publisher.started = 1;
+    platform_cond_init(&stats_publisher.stop);
+    platform_thread_create(&stats_publisher.thread, stats_publisher_loop, NULL, -1);
+}
+
+/* Stops the stats thread and publishes the final state */
+void stats_stop() {
+    if (!stats_publisher.started) {
+        return;
+    }
+    pthread_mutex_lock(&stats_publisher.mutex);
+    stats_publisher.running = 0;
+    pthread_cond_signal(&stats_publisher.stop);
+    pthread_mutex_unlock(&stats_publisher.mutex);
+    pthread_join(stats_publisher.thread, NULL);
+    pthread_cond_destroy(&stats_publisher.stop);
+    stats_publisher.started = 0;
+    
+    if (write_live_metrics(config.stats_file) != 0) {
+        perror("Failed to write live metrics");
+    }
+}
+
+/**
+ * Binary event trace
+ * Every lifecycle event is appended as a fixed-size record to a memory-mapped file, so
+ * tracing costs a copy into the page cache instead of text formatting and a write call.
+ * The mapping grows by doubling; replay_trace() rebuilds the report from the file offline.
+ */
+/* The open trace file and its mapping */
+typedef struct {
+    int fd;
+    TraceHeader* header;          // Start of the mapping, records follow it
+    TraceRecord* records;
+    size_t capacity;              // Records the mapping has room for
+    size_t count;
+    pthread_mutex_t mutex;        // Protects appends - held only for the copy (or a remap)
+} TraceFile;
+
+TraceFile trace = { -1, NULL, NULL, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+/* Maps room for capacity records - caller must hold trace.mutex. Returns 0 on success */
+int trace_map(size_t capacity) {
+    size_t bytes = sizeof(TraceHeader) + capacity * sizeof(TraceRecord);
+    if (ftruncate(trace.fd, (off_t)bytes) != 0) {
+        return -1;
+    }
+    void* map = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, trace.fd, 0);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    trace.header = (TraceHeader*)map;
+    trace.records = (TraceRecord*)(trace.header + 1);
+    trace.capacity = capacity;
+    return 0;
+}
+
+/* Creates the trace file - returns 0 on success */
+int trace_open(const char* path) {
+    trace.fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (trace.fd < 0) {
+        perror("Failed to create trace file");
+        return -1;
+    }
+    
+    // About a dozen events per vehicle for a round trip, plus the crossings
+    if (trace_map((size_t)total_fleet_size() * 12 + 1024) != 0) {
+        perror("Failed to map trace file");
+        close(trace.fd);
+        trace.fd = -1;
+        return -1;
+    }
+    trace.count = 0;
+    
+    TraceHeader* header = trace.header;
+    memcpy(header->magic, TRACE_MAGIC, sizeof(header->magic));
+    header->version = TRACE_VERSION;
+    header->record_size = sizeof(TraceRecord);
+    header->num_cars = config.num_cars;
+    header->num_minibuses = config.num_minibuses;
+    header->num_trucks = config.num_trucks;
+    header->ferry_capacity = config.ferry_capacity;
+    header->num_ferries = config.num_ferries;
+    header->booths_per_side = config.booths_per_side;
+    header->loading_policy = config.loading_policy;
+    header->virtual_clock = config.virtual_clock;
+    header->record_count = 0;
+    header->duration_ns = 0;
+    return 0;
+}
+
+/* Appends one record */
+void trace_append(const TraceRecord* record) {
+    pthread_mutex_lock(&trace.mutex);
+    
+    if (trace.count == trace.capacity) {
+        size_t old_bytes = sizeof(TraceHeader) + trace.capacity * sizeof(TraceRecord);
+        munmap(trace.header, old_bytes);
+        if (trace_map(trace.capacity * 2) != 0) {
+            perror("Failed to grow trace file");
+            exit(EXIT_FAILURE);
+        }
+    }
+    trace.records[trace.count++] = *record;
+    
+    pthread_mutex_unlock(&trace.mutex);
+}
+
+/* Records a vehicle lifecycle event */
+void trace_vehicle(TraceEvent event, const Vehicle* vehicle, int side, int unit, int trip_number) {
+    atomic_fetch_add_explicit(&live_metrics.events, 1, memory_order_relaxed);
+    if (trace.fd < 0) {
+        return;
+    }
+    
+    TraceRecord record;
+    record.time_ns = sim_now();
+    record.id = vehicle->id;
+    record.trip_number = trip_number;
+    record.unit = unit;
+    record.quota = vehicle->quota;
+    record.vehicles = 0;
+    record.event = (uint8_t)event;
+    record.vehicle_type = (uint8_t)vehicle->type;
+    record.side = (uint8_t)side;
+    record.leg = vehicle->is_transported == 0 ? 0 : 1;
+    trace_append(&record);
+}
+
+/* Records a ferry departure or arrival, peer_side being the crossing's other end - caller
+ * must hold ferry->mutex */
+void trace_ferry(TraceEvent event, const Ferry* ferry, int side, int peer_side) {
+    atomic_fetch_add_explicit(&live_metrics.events, 1, memory_order_relaxed);
+    if (trace.fd < 0) {
+        return;
+    }
+    
+    TraceRecord record;
+    record.time_ns = sim_now();
+    record.id = (int32_t)(ferry - ferries);
+    record.trip_number = ferry->trip_number;
+    record.unit = peer_side;
+    record.quota = ferry->current_load;
+    record.vehicles = ferry->vehicle_count;
+    record.event = (uint8_t)event;
+    record.vehicle_type = 0;
+    record.side = (uint8_t)side;
+    record.leg = 0;
+    trace_append(&record);
+}
+
+/* Finalises the header and truncates the file to the records actually written */
+void trace_close() {
+    if (trace.fd < 0) {
+        return;
+    }
+    
+    trace.header->record_count = (int64_t)trace.count;
+    trace.header->duration_ns = end_time - start_time;
+    
+    munmap(trace.header, sizeof(TraceHeader) + trace.capacity * sizeof(TraceRecord));
+    if (ftruncate(trace.fd, (off_t)(sizeof(TraceHeader) + trace.count * sizeof(TraceRecord))) != 0) {
+        perror("Failed to truncate trace file");
+    }
+    close(trace.fd);
+    trace.fd = -1;
+    trace.header = NULL;
+    trace.records = NULL;
+    pthread_mutex_destroy(&trace.mutex);
+}
+
+/**
+ * Arena functions implementation
+ */
+
+#define ARENA_HEADER_SIZE ARENA_ROUND(sizeof(ArenaBlock))
+
+/* Adds a block with room for at least bytes - caller must hold sim_arena.mutex */
+void arena_add_block(size_t bytes) {
+    size_t size = bytes > ARENA_MIN_BLOCK ? bytes : ARENA_MIN_BLOCK;
+    ArenaBlock* block = (ArenaBlock*)malloc(ARENA_HEADER_SIZE + size);
+    if (!block) {
+        perror("Failed to allocate memory for simulation arena");
+        exit(EXIT_FAILURE);
+    }
+    block->next = sim_arena.blocks;
+    block->size = size;
+    block->used = 0;
+    sim_arena.blocks = block;
+}
+
+/* Reserves the first block, sized so the whole fleet is allocated contiguously */
+void arena_init(size_t initial_bytes) {
+    pthread_mutex_lock(&sim_arena.mutex);
+    arena_add_block(initial_bytes);
+    pthread_mutex_unlock(&sim_arena.mutex);
+}
+
+/* Allocates bytes from the arena - the memory lives until arena_release */
+void* arena_alloc(size_t bytes) {
+    size_t aligned = ARENA_ROUND(bytes);
+    
+    pthread_mutex_lock(&sim_arena.mutex);
+    if (!sim_arena.blocks || sim_arena.blocks->size - sim_arena.blocks->used < aligned) {
+        arena_add_block(aligned);
+    }
+    ArenaBlock* block = sim_arena.blocks;
+    void* memory = (char*)block + ARENA_HEADER_SIZE + block->used;
+    block->used += aligned;
+    pthread_mutex_unlock(&sim_arena.mutex);
+    
+    return memory;
+}
+
+/* Adds count vehicle slots to the freelist. Hot records and their timing records come
+ * from two separate contiguous runs, so scans over vehicles never pull in timing data. */
+void vehicle_pool_reserve(int count) {
+    VehicleSlot* slots = (VehicleSlot*)arena_alloc(count * sizeof(VehicleSlot));
+    VehicleTiming* timings = (VehicleTiming*)arena_alloc(count * sizeof(VehicleTiming));
+    
+    pthread_mutex_lock(&sim_arena.mutex);
+    // Pushed in reverse so vehicles are handed out in address order
+    for (int i = count - 1; i >= 0; i--) {
+        slots[i].free_slot.timing = &timings[i];
+        slots[i].free_slot.next_free = sim_arena.free_vehicles;
+        sim_arena.free_vehicles = &slots[i];
+    }
+    pthread_mutex_unlock(&sim_arena.mutex);
+}
+
+/* Releases all arena memory in one step */
+void arena_release() {
+    ArenaBlock* block = sim_arena.blocks;
+    while (block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    sim_arena.blocks = NULL;
+    sim_arena.free_vehicles = NULL;
+}
+
+/**
+ * Vehicle functions implementation
+ */
+
+/* Creates a new vehicle with specified ID and type */
+Vehicle* create_vehicle(int id, VehicleType type) {
+    // Reuse the slot of a finished vehicle if there is one
+    pthread_mutex_lock(&sim_arena.mutex);
+    VehicleSlot* slot = sim_arena.free_vehicles;
+    if (slot) {
+        sim_arena.free_vehicles = slot->free_slot.next_free;
+    }
+    pthread_mutex_unlock(&sim_arena.mutex);
+    
+    if (!slot) {
+        // Fleet grew beyond the reservation - add another batch
+        vehicle_pool_reserve(VEHICLE_POOL_BATCH);
+        pthread_mutex_lock(&sim_arena.mutex);
+        slot = sim_arena.free_vehicles;
+        sim_arena.free_vehicles = slot->free_slot.next_free;
+        pthread_mutex_unlock(&sim_arena.mutex);
+    }
+    Vehicle* vehicle = &slot->vehicle;
+    
+    vehicle->id = id;
+    vehicle->type = type;
+    vehicle->quota = type; // Quota equals type value for simplified resource management
+    
+    // Initialize all the timestamps for outbound journey
+    vehicle->timing->arrival_time = 0;
+    vehicle->timing->toll_entry_time = 0;
+    vehicle->timing->waiting_area_time = 0;
+    vehicle->timing->boarding_time = 0;
+    vehicle->timing->unload_time = 0;
+    
+    // Initialize timestamps for return journey 
+    vehicle->timing->arrival_time_return = 0;
+    vehicle->timing->toll_entry_time_return = 0;
+    vehicle->timing->waiting_area_time_return = 0;
+    vehicle->timing->boarding_time_return = 0;
+    vehicle->timing->complete_time = 0;
+    
+    // Set status flags to initial values
+    vehicle->is_transported = 0; // 0 = not transported, 1 = A->B complete, 2 = round trip complete
+    vehicle->outbound_trip_number = 0;
+    vehicle->return_trip_number = 0;
+    vehicle->ready_for_return = 0;
+    vehicle->errand_time = 0;    // Time to spend on destination side before return
+    
+    vehicle->origin_side = 0;
+    vehicle->destination_side = 0;
+    vehicle->return_side = 0;
+    vehicle->current_side = 0;
+    vehicle->toll_entry_booth_id = 0;
+    vehicle->waiting_sequence = 0;
+    
+    // Origin side assigned in create_vehicles function
+    
+    return vehicle;
+}
+
+/* Returns a vehicle's slot to the arena freelist when it's no longer needed */
+void destroy_vehicle(Vehicle* vehicle) {
+    if (vehicle) {
+        VehicleSlot* slot = (VehicleSlot*)vehicle;
+        pthread_mutex_lock(&sim_arena.mutex);
+        slot->free_slot.next_free = sim_arena.free_vehicles;
+        sim_arena.free_vehicles = slot;
+        pthread_mutex_unlock(&sim_arena.mutex);
+    }
+}
+
+/* Takes a vehicle that found its toll queue or waiting area full out of the run. It is
+ * counted, so the run still ends once the rest of the fleet is through and the report
+ * adds up, and its slot goes back to the pool */
+void drop_vehicle(Vehicle* vehicle) {
+    pthread_mutex_lock(&mutex);
+    vehicles_dropped++;
+    vehicles_dropped_by_type[vehicle->type]++;
+    pthread_cond_broadcast(&simulation_progress);
+    pthread_mutex_unlock(&mutex);
+    metric_add(&live_metrics.vehicles_dropped, 1);
+    destroy_vehicle(vehicle);
+}
+
+/* Vehicles still to complete their round trip - neither transported nor dropped. Caller
+ * must hold mutex */
+int fleet_remaining() {
+    return total_fleet_size() - total_vehicles_transported - vehicles_dropped;
+}
+
+/**
+ * Vehicle queue functions implementation
+ */
+
+/* Sets up an empty queue that holds at most capacity vehicles. Storage starts small and
+ * doubles as the queue fills, so memory follows the vehicles actually present */
+void vehicle_queue_init(VehicleQueue* queue, int capacity) {
+    // Storage is rounded up to a power of two so wrapping is a single mask
+    int storage = 1;
+    while (storage < capacity && storage < VEHICLE_QUEUE_MIN_STORAGE) {
+        storage *= 2;
+    }
+    
+    queue->items = (Vehicle**)malloc(storage * sizeof(Vehicle*));
+    if (!queue->items) {
+        perror("Failed to allocate memory for vehicle queue");
+        exit(EXIT_FAILURE);
+    }
+    queue->capacity = capacity;
+    queue->mask = storage - 1;
+    queue->head = 0;
+    queue->size = 0;
+}
+
+/* Releases the queue storage (the vehicles themselves are not freed) */
+void vehicle_queue_destroy(VehicleQueue* queue) {
+    free(queue->items);
+    queue->items = NULL;
+    queue->size = 0;
+}
+
+/* Doubles the storage, moving the vehicles to the start in queue order */
+void vehicle_queue_grow(VehicleQueue* queue) {
+    int storage = (queue->mask + 1) * 2;
+    Vehicle** items = (Vehicle**)malloc(storage * sizeof(Vehicle*));
+    if (!items) {
+        perror("Failed to allocate memory for vehicle queue");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < queue->size; i++) {
+        items[i] = vehicle_queue_at(queue, i);
+    }
+    free(queue->items);
+    queue->items = items;
+    queue->mask = storage - 1;
+    queue->head = 0;
+}
+
+/* Appends a vehicle at the back - returns 0 if the queue is full */
+int vehicle_queue_push_back(VehicleQueue* queue, Vehicle* vehicle) {
+    if (queue->size >= queue->capacity) {
+        return 0;
+    }
+    if (queue->size > queue->mask) {
+        vehicle_queue_grow(queue);
+    }
+    queue->items[(queue->head + queue->size) & queue->mask] = vehicle;
+    queue->size++;
+    return 1;
+}
+
+/* Removes and returns the front vehicle, or NULL if the queue is empty */
+Vehicle* vehicle_queue_pop_front(VehicleQueue* queue) {
+    if (queue->size == 0) {
+        return NULL;
+    }
+    Vehicle* vehicle = queue->items[queue->head];
+    queue->head = (queue->head + 1) & queue->mask;
+    queue->size--;
+    return vehicle;
+}
+
+/* Vehicle at position index, counted from the front */
+Vehicle* vehicle_queue_at(const VehicleQueue* queue, int index) {
+    return queue->items[(queue->head + index) & queue->mask];
+}
+
+/* Exchanges the vehicles at two positions - used for shuffling */
+void vehicle_queue_swap(VehicleQueue* queue, int i, int j) {
+    Vehicle** a = &queue->items[(queue->head + i) & queue->mask];
+    Vehicle** b = &queue->items[(queue->head + j) & queue->mask];
+    Vehicle* temp = *a;
+    *a = *b;
+    *b = temp;
+}
+
+/**
+ * Network functions implementation
+ * Terminals are connected by routes in one of a few topologies and every ferry serves one
+ * route. A vehicle rides one route to its destination terminal and the same route back,
+ * so transfer terminals and hubs see the traffic of all their routes at their toll booths
+ * and in their shared waiting area.
+ */
+
+/* Sets up the routes between the first `terminals` terminals */
+void build_network(int terminals, Topology topology) {
+    num_terminals = terminals;
+    num_routes = 0;
+    for (int i = 1; i < terminals; i++) {
+        Route* route = &routes[num_routes++];
+        route->ends[0] = topology == TOPOLOGY_STAR ? SIDE_A : (SideId)(i - 1);
+        route->ends[1] = (SideId)i;
+    }
+    
+    // Closing a ring of two terminals would only duplicate the single route
+    if (topology == TOPOLOGY_RING && terminals > 2) {
+        routes[num_routes].ends[0] = (SideId)(terminals - 1);
+        routes[num_routes].ends[1] = SIDE_A;
+        num_routes++;
+    }
+}
+
+/* The route between two terminals, or NULL if they are not connected */
+const Route* find_route(SideId a, SideId b) {
+    for (int i = 0; i < num_routes; i++) {
+        if ((routes[i].ends[0] == a && routes[i].ends[1] == b) ||
+            (routes[i].ends[0] == b && routes[i].ends[1] == a)) {
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+/* The terminal across the route from city */
+CityPart* route_peer(const Route* route, const CityPart* city) {
+    return &city_parts[route->ends[0] == city->id ? route->ends[1] : route->ends[0]];
+}
+
+/* Terminal the vehicle is travelling to next - its destination, then back where it came from */
+SideId vehicle_heading(const Vehicle* vehicle) {
+    return vehicle->is_transported == 0 ? vehicle->destination_side : vehicle->return_side;
+}
+
+/* A random neighbour of origin - no random number is drawn when there is only one */
+SideId pick_destination(Rng* rng, SideId origin) {
+    SideId neighbours[MAX_TERMINALS];
+    int count = 0;
+    for (int i = 0; i < num_routes; i++) {
+        if (routes[i].ends[0] == origin) {
+            neighbours[count++] = routes[i].ends[1];
+        } else if (routes[i].ends[1] == origin) {
+            neighbours[count++] = routes[i].ends[0];
+        }
+    }
+    return count == 1 ? neighbours[0] : neighbours[rng_below(rng, count)];
+}
+
+/**
+ * Waiting area functions implementation
+ */
+
+/* Sets up empty lanes; each lane towards a neighbour of terminal can hold the whole capacity */
+void waiting_area_init(WaitingArea* area, int capacity, SideId terminal) {
+    for (int heading = 0; heading < MAX_TERMINALS; heading++) {
+        int reachable = heading < num_terminals && find_route(terminal, (SideId)heading) != NULL;
+        for (int quota = 0; quota <= TRUCK; quota++) {
+            vehicle_queue_init(&area->lanes[heading][quota], quota == 0 || !reachable ? 1 : capacity);
+        }
+        area->size_to[heading] = 0;
+    }
+    area->size = 0;
+    area->capacity = capacity;
+    area->next_sequence = 0;
+}
+
+/* Releases the lane storage (the vehicles themselves are not freed) */
+void waiting_area_destroy(WaitingArea* area) {
+    for (int heading = 0; heading < MAX_TERMINALS; heading++) {
+        for (int quota = 0; quota <= TRUCK; quota++) {
+            vehicle_queue_destroy(&area->lanes[heading][quota]);
+        }
+        area->size_to[heading] = 0;
+    }
+    area->size = 0;
+}
+
+/* Appends a vehicle to its heading's lane for its type - returns 0 if the waiting area is full */
+int waiting_area_push(WaitingArea* area, Vehicle* vehicle) {
+    if (area->size >= area->capacity) {
+        return 0;
+    }
+    SideId heading = vehicle_heading(vehicle);
+    vehicle->waiting_sequence = area->next_sequence++;
+    vehicle_queue_push_back(&area->lanes[heading][vehicle->quota], vehicle);
+    area->size_to[heading]++;
+    area->size++;
+    return 1;
+}
+
+/* Earliest-arrived vehicle among the lane fronts towards heading, or NULL if none qualifies.
+ * lane_limit[quota] > 0 selects which lanes are considered (NULL = all lanes). */
+Vehicle* waiting_area_front(const WaitingArea* area, SideId heading, const int* lane_limit) {
+    Vehicle* front = NULL;
+    for (int quota = CAR; quota <= TRUCK; quota++) {
+        const VehicleQueue* lane = &area->lanes[heading][quota];
+        if (lane->size == 0 || (lane_limit && lane_limit[quota] <= 0)) {
+            continue;
+        }
+        Vehicle* candidate = vehicle_queue_at(lane, 0);
+        if (!front || candidate->waiting_sequence < front->waiting_sequence) {
+            front = candidate;
+        }
+    }
+    return front;
+}
+
+/* Removes and returns the front vehicle of one lane */
+Vehicle* waiting_area_pop(WaitingArea* area, SideId heading, int quota) {
+    Vehicle* vehicle = vehicle_queue_pop_front(&area->lanes[heading][quota]);
+    if (vehicle) {
+        area->size_to[heading]--;
+        area->size--;
+    }
+    return vehicle;
+}
+
+/* Pushes a vehicle onto the handoff list - lock-free, safe from any number of booths */
+void waiting_handoff_push(WaitingHandoff* handoff, Vehicle* vehicle) {
+    atomic_fetch_add(&handoff->by_quota[vehicle_heading(vehicle)][vehicle->quota], 1);
+    
+    Vehicle* head = atomic_load_explicit(&handoff->head, memory_order_relaxed);
+    do {
+        vehicle->handoff_next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&handoff->head, &head, vehicle,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/* Takes every pushed vehicle at once, returned in push order. Only one consumer at a time
+ * (the holder of the side's mutex), and nothing is ever popped singly, so there is no ABA */
+Vehicle* waiting_handoff_take_all(WaitingHandoff* handoff) {
+    Vehicle* newest = atomic_exchange_explicit(&handoff->head, NULL, memory_order_acquire);
+    
+    // The list is newest first - reverse it
+    Vehicle* oldest = NULL;
+    while (newest) {
+        Vehicle* next = newest->handoff_next;
+        newest->handoff_next = oldest;
+        oldest = newest;
+        newest = next;
+    }
+    return oldest;
+}
+
+/* Moves handed-off vehicles into the waiting area lanes - caller must hold city->mutex */
+void collect_waiting_vehicles(CityPart* city) {
+    Vehicle* vehicle = waiting_handoff_take_all(&city->handoff);
+    while (vehicle) {
+        // waiting_area_push overwrites the link (it shares storage with waiting_sequence)
+        Vehicle* next = vehicle->handoff_next;
+        SideId heading = vehicle_heading(vehicle);
+        int pushed = waiting_area_push(&city->waiting_area, vehicle);
+        atomic_fetch_sub(&city->handoff.by_quota[heading][vehicle->quota], 1);
+        if (!pushed) {
+            metric_add(&live_metrics.waiting_area_size[city->id], -1);
+            sim_log(LOG_INFO, LOG_EVENT_WAITING_AREA, vehicle->id, city->id, -1, "Waiting area full at %s, dropping vehicle %s_%d\n", 
+                   city->name, vehicle_type_names[vehicle->type], vehicle->id);
+            drop_vehicle(vehicle);
+        }
+        vehicle = next;
+    }
+}
+
+/* Locks the side's waiting area and brings it up to date with the handoff */
+void city_lock(CityPart* city) {
+    lock_mutex(&city->mutex, LOCK_WAITING_AREA);
+    collect_waiting_vehicles(city);
+}
+
+/**
+ * Toll booth functions implementation
+ */
+
+/* Sets up a toll booth with its name and IDs */
+void initialize_toll_booth(TollBooth* booth, const char* name, SideId side, int id) {
+    strcpy(booth->name, name);
+    booth->id = id;
+    booth->side = side;
+    booth->is_occupied = 0;
+    atomic_init(&booth->current_vehicle, NULL);
+    rng_init(&booth->rng, run_seed, RNG_STREAM_BOOTH | ((uint64_t)side << 16) | (uint64_t)id);
+    booth->is_running = 0;
+    booth->is_open = 0;
+    booth->opened_at = 0;
+    booth->open_ns = 0;
+}
+
+/* Each toll booth runs as a separate thread */
+void* toll_booth_process_vehicle(void* arg) {
+    TollBooth* booth = (TollBooth*)arg;
+    CityPart* city = &city_parts[booth->side];
+    
+    booth->is_running = 1;
+
+    while (simulation_running) {
+        lock_mutex(&city->queue_mutex, LOCK_TOLL_QUEUE);
+
+        toll_booth_scale(city, sim_now());
+        
+        // Sleep until a vehicle is queued, or until the booth opens - no polling while idle
+        Vehicle* vehicle;
+        while ((vehicle = toll_booth_take_vehicle(city, booth)) == NULL && simulation_running) {
+            pthread_cond_wait(booth->is_open ? &city->queue_not_empty : &city->booths_changed, &city->queue_mutex);
+        }
+        pthread_mutex_unlock(&city->queue_mutex);
+
+        if (!vehicle) {
+            break; // Woken for shutdown
+        }
+
+        // Toll processing takes some time (0.5-1.5 seconds)
+        platform_sleep_us(toll_processing_time(booth));
+
+        // No side lock needed - the vehicle goes through the lock-free handoff
+        toll_booth_release_vehicle(city, booth, vehicle);
+    }
+    
+    booth->is_running = 0;
+    return NULL;
+}
+
+/* Moves the next queued vehicle into a free booth - caller must hold city->queue_mutex */
+Vehicle* toll_booth_take_vehicle(CityPart* city, TollBooth* booth) {
+    if (!booth->is_open || booth->is_occupied || city->vehicle_queue.size == 0) {
+        return NULL;
+    }
+
+    // Take the next vehicle from the front of the queue
+    Vehicle* vehicle = vehicle_queue_pop_front(&city->vehicle_queue);
+    SideId heading = vehicle_heading(vehicle);
+    atomic_fetch_add(&city->booth_by_quota[heading][vehicle->quota], 1);
+    atomic_fetch_sub(&city->queued_by_quota[heading][vehicle->quota], 1);
+    metric_update_begin();
+    metric_add(&live_metrics.queue_depth[city->id], -1);
+    metric_add(&live_metrics.booths_busy[city->id], 1);
+    metric_update_end();
+
+    // Process the vehicle
+    booth->is_occupied = 1;
+    atomic_store_explicit(&booth->current_vehicle, vehicle, memory_order_release);
+
+    // Store booth ID for later reference in statistics
+    vehicle->toll_entry_booth_id = booth->id;
+
+    // Record the time - different for outbound vs return
+    if (vehicle->is_transported == 0) {
+        vehicle->timing->toll_entry_time = sim_now();
+    } else {
+        vehicle->timing->toll_entry_time_return = sim_now();
+    }
+    trace_vehicle(TRACE_TOLL_ENTRY, vehicle, city->id, booth->id, 0);
+
+    sim_log(LOG_INFO, LOG_EVENT_TOLL, vehicle->id, city->id, booth->id, "%s_%d (%d quota) is being processed at %s\n",
+           vehicle_type_names[vehicle->type], vehicle->id, vehicle->quota, booth->name);
+
+    return vehicle;
+}
+
+/* Toll processing finished - takes no lock, the booth owns its own state */
+void toll_booth_release_vehicle(CityPart* city, TollBooth* booth, Vehicle* vehicle) {
+    // Free up the toll booth
+    booth->is_occupied = 0;
+    atomic_store_explicit(&booth->current_vehicle, NULL, memory_order_release);
+    
+    // After processing, send to waiting area - counted there before it leaves the booth
+    add_to_waiting_area(city, vehicle);
+}
+
+/* Toll processing takes some time (0.5-1.5 seconds), in microseconds */
+int toll_processing_time(TollBooth* booth) {
+    return 500000 + rng_below(&booth->rng, 1000000);
+}
+
+/**
+ * City part functions implementation
+ */
+
+/* Sets up a city side with its name and initializes components */
+void initialize_city_part(CityPart* city, const char* name, SideId id) {
+    strcpy(city->name, name);
+    city->id = id;
+    // Queues are sized from the configuration - by default the whole fleet fits on one side
+    int queue_capacity = config.queue_capacity > 0 ? config.queue_capacity : total_fleet_size();
+    vehicle_queue_init(&city->vehicle_queue, queue_capacity);
+    waiting_area_init(&city->waiting_area, queue_capacity, id);
+    atomic_init(&city->handoff.head, NULL);
+    for (int heading = 0; heading < MAX_TERMINALS; heading++) {
+        for (int quota = 0; quota <= TRUCK; quota++) {
+            atomic_init(&city->queued_by_quota[heading][quota], 0);
+            atomic_init(&city->booth_by_quota[heading][quota], 0);
+            atomic_init(&city->handoff.by_quota[heading][quota], 0);
+        }
+        city->arrivals_to[heading] = (ArrivalEstimate){ 0, 0.0, 0.0, 0 };
+        city->loading_ferry[heading] = NULL;
+        city->ferries_docked[heading] = 0;
+        city->ferries_inbound[heading] = 0;
+    }
+    
+    // Setting up thread synchronization
+    pthread_mutex_init(&city->queue_mutex, NULL);
+    pthread_mutex_init(&city->mutex, NULL);
+    platform_cond_init(&city->queue_not_empty);
+    platform_cond_init(&city->booths_changed);
+    platform_cond_init(&city->waiting_area_changed);
+    atomic_init(&city->waiting_area_version, 0);
+    atomic_init(&city->waiting_area_sleepers, 0);
+    
+    // Creating toll booths for this city side - all that may open, the first booths_per_side open
+    city->num_booths = config.booths_max > config.booths_per_side ? config.booths_max : config.booths_per_side;
+    city->booths = (TollBooth*)malloc(city->num_booths * sizeof(TollBooth));
+    if (!city->booths) {
+        perror("Failed to allocate memory for toll booths");
+        exit(EXIT_FAILURE);
+    }
+    
+    char booth_name[MAX_NAME_LENGTH];
+    for (int i = 0; i < city->num_booths; i++) {
+        snprintf(booth_name, MAX_NAME_LENGTH, "%s_Booth_%d", name, i+1);
+        initialize_toll_booth(&city->booths[i], booth_name, id, i + 1);
+    }
+    city->open_booths = 0;
+    for (int i = 0; i < config.booths_per_side; i++) {
+        toll_booth_set_open(city, &city->booths[i], 1, sim_now());
+    }
+    city->peak_open_booths = city->open_booths;
+    city->booth_openings = 0;
+    city->booth_closings = 0;
+    city->last_booth_change = 0;
+}
+
+/* Adds a vehicle to the queue for toll processing */
+void add_vehicle_to_queue(CityPart* city, Vehicle* vehicle) {
+    lock_mutex(&city->queue_mutex, LOCK_TOLL_QUEUE);
+    
+    SimTime current_time = sim_now();
+    
+    if (city->vehicle_queue.size < city->vehicle_queue.capacity) {
+        // For first-time arrivals (not returning)
+        if (vehicle->is_transported == 0) {
+            vehicle->timing->arrival_time = current_time;
+            vehicle->origin_side = city->id;  // Record origin location
+            
+            sim_log(LOG_INFO, LOG_EVENT_QUEUE, vehicle->id, city->id, -1, "%s_%d (%d quota) arrived at %s and joined the queue\n", 
+                   vehicle_type_names[vehicle->type], vehicle->id, vehicle->quota, city->name);
+        }
+        // For returning vehicles, arrival_time_return was set in complete_vehicle_errand
+        trace_vehicle(TRACE_ARRIVAL, vehicle, city->id, -1, 0);
+        
+        // Add to the back of the queue
+        vehicle_queue_push_back(&city->vehicle_queue, vehicle);
+        atomic_fetch_add(&city->queued_by_quota[vehicle_heading(vehicle)][vehicle->quota], 1);
+        arrival_estimate_update(&city->arrivals_to[vehicle_heading(vehicle)], current_time, vehicle->quota);
+        toll_booth_scale(city, current_time);
+        metric_add(&live_metrics.queue_depth[city->id], 1);
+        
+        // Wake one idle booth to process it
+        pthread_cond_signal(&city->queue_not_empty);
+    } else {
+        sim_log(LOG_INFO, LOG_EVENT_QUEUE, vehicle->id, city->id, -1, "Queue full at %s, dropping vehicle %s_%d\n", 
+               city->name, vehicle_type_names[vehicle->type], vehicle->id);
+        drop_vehicle(vehicle);
+    }
+    
+    pthread_mutex_unlock(&city->queue_mutex);
+}
+
+/* After toll processing, vehicles go to the waiting area through the lock-free handoff.
+ * The side's mutex is only taken when a ferry is asleep on waiting_area_changed */
+void add_to_waiting_area(CityPart* city, Vehicle* vehicle) {
+    // Log completion of toll processing first
+    sim_log(LOG_INFO, LOG_EVENT_TOLL, vehicle->id, city->id, vehicle->toll_entry_booth_id, "%s_%d (%d quota) completed toll processing at %s_Booth_%d\n", 
+           vehicle_type_names[vehicle->type], vehicle->id, vehicle->quota, city->name, 
+           vehicle->toll_entry_booth_id);
+    
+    // Record entry time to waiting area - different for outbound vs return
+    if (vehicle->is_transported == 0) {
+        vehicle->timing->waiting_area_time = sim_now();
+    } else {
+        vehicle->timing->waiting_area_time_return = sim_now();
+    }
+    trace_vehicle(TRACE_WAITING_AREA, vehicle, city->id, vehicle->toll_entry_booth_id, 0);
+    
+    // Log entry to waiting area
+    sim_log(LOG_INFO, LOG_EVENT_WAITING_AREA, vehicle->id, city->id, -1, "%s_%d (%d quota) entered the waiting area at %s\n", 
+           vehicle_type_names[vehicle->type], vehicle->id, vehicle->quota, city->name);
+    
+    // Once pushed, the vehicle can board and change heading at any moment
+    SideId heading = vehicle_heading(vehicle);
+    metric_update_begin();
+    metric_add(&live_metrics.waiting_area_size[city->id], 1);
+    waiting_handoff_push(&city->handoff, vehicle);
+    atomic_fetch_sub(&city->booth_by_quota[heading][vehicle->quota], 1);
+    metric_add(&live_metrics.booths_busy[city->id], -1);
+    metric_update_end();
+    
+    // Let the ferry know there is something new to load. A ferry registers as a sleeper
+    // before its last version check, so either it sees the new version or we see it
+    atomic_fetch_add(&city->waiting_area_version, 1);
+    if (atomic_load(&city->waiting_area_sleepers) > 0) {
+        lock_mutex(&city->mutex, LOCK_WAITING_AREA);
+        pthread_cond_broadcast(&city->waiting_area_changed);
+        pthread_mutex_unlock(&city->mutex);
+    }
+    notify_fleet();
+}
+
+/* Vehicles queued for the toll booths on their way to heading, read without locking */
+int inbound_vehicle_count(CityPart* city, SideId heading) {
+    int count = 0;
+    for (int quota = CAR; quota <= TRUCK; quota++) {
+        count += atomic_load(&city->queued_by_quota[heading][quota]);
+    }
+    return count;
+}
+
+/* Wakes every thread blocked on this side's conditions - used at shutdown */
+void wake_city_waiters(CityPart* city) {
+    lock_mutex(&city->queue_mutex, LOCK_TOLL_QUEUE);
+    pthread_cond_broadcast(&city->queue_not_empty);
+    pthread_cond_broadcast(&city->booths_changed);
+    pthread_mutex_unlock(&city->queue_mutex);
+    
+    lock_mutex(&city->mutex, LOCK_WAITING_AREA);
+    pthread_cond_broadcast(&city->waiting_area_changed);
+    pthread_mutex_unlock(&city->mutex);
+}
+
+/* Opens or closes a booth - caller must hold city->queue_mutex */
+void toll_booth_set_open(CityPart* city, TollBooth* booth, int open, SimTime now) {
+    booth->is_open = open;
+    if (open) {
+        booth->opened_at = now;
+        city->open_booths++;
+        if (city->open_booths > city->peak_open_booths) {
+            city->peak_open_booths = city->open_booths;
+        }
+    } else {
+        booth->open_ns += now - booth->opened_at;
+        city->open_booths--;
+    }
+    metric_add(&live_metrics.booths_open[city->id], open ? 1 : -1);
+    
+    // Idle booths move between the two conditions, so wake both sets of sleepers
+    pthread_cond_broadcast(&city->booths_changed);
+    pthread_cond_broadcast(&city->queue_not_empty);
+}
+
+/* Opens a booth when the queue is long or its front vehicle has waited too long, and closes
+ * one when the remaining booths would still keep the queue short - caller must hold
+ * city->queue_mutex. The gap between the two thresholds and a cooldown after every change
+ * keep the number of open booths from flapping. A closing booth finishes its vehicle first. */
+void toll_booth_scale(CityPart* city, SimTime now) {
+    if (city->num_booths == config.booths_per_side) {
+        return; // Fixed staffing
+    }
+    if (city->booth_openings + city->booth_closings > 0 && now - city->last_booth_change < BOOTH_SCALING_COOLDOWN) {
+        return;
+    }
+    
+    int queued = city->vehicle_queue.size;
+    double front_wait = 0.0;
+    if (queued > 0) {
+        const Vehicle* front = vehicle_queue_at(&city->vehicle_queue, 0);
+        front_wait = seconds_between(now, front->is_transported == 0 ? front->timing->arrival_time :
+                                                                       front->timing->arrival_time_return);
+    }
+    
+    if (city->open_booths < city->num_booths &&
+        (queued > config.booth_open_queue * city->open_booths || front_wait > config.booth_open_wait)) {
+        TollBooth* booth = &city->booths[city->open_booths];
+        toll_booth_set_open(city, booth, 1, now);
+        city->booth_openings++;
+        city->last_booth_change = now;
+        sim_log(LOG_INFO, LOG_EVENT_TOLL, -1, city->id, booth->id, "%s opened - %d booths open, %d vehicles queued\n",
+               booth->name, city->open_booths, queued);
+    } else if (city->open_booths > config.booths_per_side &&
+               queued <= config.booth_close_queue * (city->open_booths - 1) &&
+               front_wait * 2 <= config.booth_open_wait) {
+        TollBooth* booth = &city->booths[city->open_booths - 1];
+        toll_booth_set_open(city, booth, 0, now);
+        city->booth_closings++;
+        city->last_booth_change = now;
+        sim_log(LOG_INFO, LOG_EVENT_TOLL, -1, city->id, booth->id, "%s closed - %d booths open, %d vehicles queued\n",
+               booth->name, city->open_booths, queued);
+    }
+}
+
+/* Seconds the booth has been open up to now */
+double booth_open_seconds(const TollBooth* booth, SimTime now) {
+    SimTime open_ns = booth->open_ns;
+    if (booth->is_open) {
+        open_ns += now - (booth->opened_at > start_time ? booth->opened_at : start_time);
+    }
+    return (double)open_ns / NS_PER_SECOND;
+}
+
+/* Starts the toll booth threads for a city side */
+void start_toll_booths(CityPart* city) {
+    for (int i = 0; i < city->num_booths; i++) {
+        platform_thread_create(&city->booths[i].thread, toll_booth_process_vehicle, &city->booths[i], pinned_thread_cpu());
+    }
+}
+
+/**
+ * Random number functions implementation
+ * Every booth and ferry draws from its own xoshiro256** stream, so no thread shares RNG
+ * state. Streams are derived from the run seed and a fixed stream id with splitmix64,
+ * which makes virtual clock runs bit-for-bit reproducible for a given --seed.
+ */
+/* splitmix64 step - spreads seeds into well-mixed generator states */
+uint64_t splitmix64(uint64_t* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/* Sets up the stream with the given id for a run seed */
+void rng_init(Rng* rng, uint64_t seed, uint64_t stream) {
+    uint64_t state = seed ^ splitmix64(&stream);
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&state);
+    }
+}
+
+static inline uint64_t rotate_left(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/* Next 64 random bits (xoshiro256**) */
+uint64_t rng_next(Rng* rng) {
+    uint64_t* s = rng->s;
+    uint64_t result = rotate_left(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotate_left(s[3], 45);
+    return result;
+}
+
+/* Uniform integer in [0, bound) - multiply-shift on the top 32 bits, no modulo bias worth noting */
+int rng_below(Rng* rng, int bound) {
+    return (int)(((rng_next(rng) >> 32) * (uint64_t)bound) >> 32);
+}
+
+/* Natural logarithm for x > 0 without libm: x = m * 2^k with m in [sqrt(1/2), sqrt(2)),
+ * then ln(m) = 2 atanh((m - 1) / (m + 1)), whose series converges fast on that range */
+double natural_log(double x) {
+    const double ln2 = 0.69314718055994530942;
+    const double sqrt2 = 1.41421356237309504880;
+    int k = 0;
+    while (x >= sqrt2) {
+        x *= 0.5;
+        k++;
+    }
+    while (x < sqrt2 * 0.5) {
+        x *= 2.0;
+        k--;
+    }
+    
+    double y = (x - 1.0) / (x + 1.0);
+    double y2 = y * y;
+    double term = y;
+    double sum = 0.0;
+    for (int n = 1; n < 40 && (term > 1e-18 || term < -1e-18); n += 2) {
+        sum += term / n;
+        term *= y2;
+    }
+    return 2.0 * sum + k * ln2;
+}
+
+/* Exponentially distributed delay with the given mean, rounded down (Poisson process gaps) */
+long long rng_exponential(Rng* rng, double mean) {
+    // Uniform in (0, 1] from the top 53 bits, so the logarithm is always finite
+    double u = (double)((rng_next(rng) >> 11) + 1) * (1.0 / 9007199254740992.0);
+    return (long long)(-mean * natural_log(u));
+}
+
+/* Records the run seed and seeds the setup stream - booths and ferries seed their own
+ * streams from run_seed when they are created */
+void seed_random_streams(uint64_t seed) {
+    run_seed = seed;
+    rng_init(&setup_rng, run_seed, RNG_STREAM_SETUP);
+}
+
+/**
+ * Platform functions implementation
+ * Everything that differs between Linux and macOS lives here. Linux waits on
+ * CLOCK_MONOTONIC condition variables, so a wall-clock step (NTP, suspend) cannot stretch
+ * or cut short a booth, ferry or errand wait, and can pin threads to CPUs. macOS has no
+ * pthread_condattr_setclock or affinity API and keeps CLOCK_REALTIME and free scheduling
+ */
+#ifdef __linux__
+#define PLATFORM_COND_CLOCK CLOCK_MONOTONIC
+#else
+#define PLATFORM_COND_CLOCK CLOCK_REALTIME
+#endif
+
+int pinned_threads = 0; // Booth and ferry threads handed a CPU so far this run (--pin-threads)
+
+/* Raw CLOCK_MONOTONIC reading in nanoseconds */
+SimTime monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+/* Current time in microseconds on the clock condition variables wait against - the time
+ * base of the errand timer and make_deadline */
+long long deadline_clock_us() {
+    struct timespec now;
+    clock_gettime(PLATFORM_COND_CLOCK, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+/* Absolute deadline delay_us from now, for pthread_cond_timedwait on a platform_cond_init
+ * condition variable */
+void make_deadline(long long delay_us, struct timespec* deadline) {
+    clock_gettime(PLATFORM_COND_CLOCK, deadline);
+    long long nanoseconds = deadline->tv_nsec + (delay_us % 1000000LL) * 1000LL;
+    deadline->tv_sec += (time_t)(delay_us / 1000000LL + nanoseconds / 1000000000LL);
+    deadline->tv_nsec = (long)(nanoseconds % 1000000000LL);
+}
+
+/* Sleeps delay_us microseconds. Unlike usleep it takes any length and resumes after a
+ * signal instead of returning early */
+void platform_sleep_us(long long delay_us) {
+    if (delay_us <= 0) return;
+    struct timespec remaining = { (time_t)(delay_us / 1000000LL), (long)(delay_us % 1000000LL) * 1000L };
+    while (nanosleep(&remaining, &remaining) != 0 && errno == EINTR) {
+    }
+}
+
+/* Initializes a condition variable whose timed waits use PLATFORM_COND_CLOCK */
+void platform_cond_init(pthread_cond_t* cond) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+#ifdef __linux__
+    pthread_condattr_setclock(&attr, PLATFORM_COND_CLOCK);
+#endif
+    if (pthread_cond_init(cond, &attr) != 0) {
+        perror("Failed to initialize condition variable");
+        exit(EXIT_FAILURE);
+    }
+    pthread_condattr_destroy(&attr);
+}
+
+/* Number of CPUs this process may run on - the affinity mask on Linux, so a container or
+ * taskset limit is respected, otherwise the online CPUs */
+int platform_cpu_count() {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0) {
+        return CPU_COUNT(&allowed);
+    }
+#endif
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (int)cpus : 1;
+}
+
+/* The index-th CPU of the affinity mask, wrapping round, or -1 where threads cannot be pinned */
+int platform_pinned_cpu(int index) {
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) return -1;
+    int wanted = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && wanted-- == 0) return cpu;
+    }
+#else
+    (void)index;
+#endif
+    return -1;
+}
+
+/* pthread_create, with the thread bound to cpu from its first instruction when cpu >= 0 and
+ * the platform supports it. Returns the pthread_create result */
+int platform_thread_create(pthread_t* thread, void* (*start)(void*), void* arg, int cpu) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+#ifdef __linux__
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+#else
+    (void)cpu;
+#endif
+    int result = pthread_create(thread, &attr, start, arg);
+    pthread_attr_destroy(&attr);
+    return result;
+}
+
+/* CPU for the next booth or ferry thread - the CPUs in turn with --pin-threads, else -1 */
+int pinned_thread_cpu() {
+    if (!config.pin_threads) return -1;
+    return platform_pinned_cpu(pinned_threads++);
+}
+
+/**
+ * Utility functions
+ */
+/* Current simulation time - monotonic clock since startup, or the simulated timeline in
+ * virtual clock mode. Never goes backwards, so differences between stamps are never negative */
+SimTime sim_now() {
+    if (config.virtual_clock) {
+        return virtual_clock_us * 1000LL;
+    }
+    return monotonic_ns() - clock_epoch;
+}
+
+/* Duration between two simulation time stamps in seconds */
+double seconds_between(SimTime end, SimTime start) {
+    return (double)(end - start) / NS_PER_SECOND;
+}
+
+/**
+ * Loading policy functions implementation
+ * Quotas are only 1, 2 or 3, so policies work on per-quota counts instead of sorting
+ * vehicle lists. can_depart and load_from_waiting_area use the same plan, so the ferry
+ * waits for exactly the vehicles it would actually board. The counts come from each
+ * side's per-type counters and waiting lanes, so they cost O(1) to gather.
+ */
+
+/* Starts an empty candidate set for a ferry with unfilled_quota of free space */
+void load_candidates_init(LoadCandidates* candidates, int unfilled_quota) {
+    memset(candidates, 0, sizeof(LoadCandidates));
+    candidates->fifo_remaining = unfilled_quota;
+}
+
+/* FIFO first-fit step for the next vehicle in boarding order */
+void load_candidates_offer(LoadCandidates* candidates, int quota) {
+    // FIFO boards every vehicle that still fits when its turn comes
+    if (quota <= candidates->fifo_remaining) {
+        candidates->fifo_take[quota]++;
+        candidates->fifo_remaining -= quota;
+    }
+}
+
+/* 1 if any counted vehicle has a quota of at most free_quota */
+int quota_fits_any(int free_quota, const int* count_by_quota) {
+    for (int quota = CAR; quota <= TRUCK && quota <= free_quota; quota++) {
+        if (count_by_quota[quota] > 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Number of vehicles of one quota bound for heading that are not yet in a lane */
+int pending_by_quota(CityPart* city, SideId heading, int quota) {
+    return atomic_load(&city->queued_by_quota[heading][quota]) + atomic_load(&city->booth_by_quota[heading][quota]) +
+           atomic_load(&city->handoff.by_quota[heading][quota]);
+}
+
+/* Constant-time "could anything still board for heading?" - caller must hold city->mutex (see
+ * city_lock). include_pending also counts vehicles still in the toll queue, at a booth or in the handoff. */
+int city_has_fitting_vehicle(CityPart* city, SideId heading, int free_quota, int include_pending) {
+    for (int quota = CAR; quota <= TRUCK && quota <= free_quota; quota++) {
+        if (city->waiting_area.lanes[heading][quota].size > 0 ||
+            (include_pending && pending_by_quota(city, heading, quota) > 0)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Gathers the vehicles at city ready to board for heading - caller must hold city->mutex (see
+ * city_lock). Per-quota counts are read from the counters; only the FIFO policy walks vehicles
+ * in boarding order (waiting area, booths, queue), skipping those bound elsewhere, and it stops
+ * as soon as nothing left behind could still fit. */
+void collect_load_candidates(CityPart* city, SideId heading, LoadCandidates* candidates, int include_pending) {
+    int unvisited[TRUCK + 1] = { 0, 0, 0, 0 };
+    for (int quota = CAR; quota <= TRUCK; quota++) {
+        unvisited[quota] = city->waiting_area.lanes[heading][quota].size;
+        if (include_pending) {
+            unvisited[quota] += pending_by_quota(city, heading, quota);
+        }
+        candidates->available[quota] = unvisited[quota];
+    }
+    
+    if (config.loading_policy != LOADING_FIFO) {
+        return;
+    }
+    
+    // Waiting area: merge the lanes by arrival order, ignoring lanes that no longer fit.
+    // FIFO never boards a vehicle after skipping one of the same type, so taking whole
+    // lane prefixes is exact.
+    int position[TRUCK + 1] = { 0, 0, 0, 0 };
+    while (quota_fits_any(candidates->fifo_remaining, unvisited)) {
+        Vehicle* next = NULL;
+        for (int quota = CAR; quota <= TRUCK && quota <= candidates->fifo_remaining; quota++) {
+            VehicleQueue* lane = &city->waiting_area.lanes[heading][quota];
+            if (position[quota] < lane->size) {
+                Vehicle* vehicle = vehicle_queue_at(lane, position[quota]);
+                if (!next || vehicle->waiting_sequence < next->waiting_sequence) {
+                    next = vehicle;
+                }
+            }
+        }
+        if (!next) {
+            break;
+        }
+        position[next->quota]++;
+        unvisited[next->quota]--;
+        load_candidates_offer(candidates, next->quota);
+    }
+    
+    if (!include_pending) {
+        return;
+    }
+    
+    // Then vehicles in toll booths
+    for (int i = 0; i < city->num_booths && quota_fits_any(candidates->fifo_remaining, unvisited); i++) {
+        Vehicle* vehicle = atomic_load_explicit(&city->booths[i].current_vehicle, memory_order_acquire);
+        if (vehicle && vehicle_heading(vehicle) == heading) {
+            unvisited[vehicle->quota]--;
+            load_candidates_offer(candidates, vehicle->quota);
+        }
+    }
+    
+    // Finally the queue
+    lock_mutex(&city->queue_mutex, LOCK_TOLL_QUEUE);
+    for (int i = 0; i < city->vehicle_queue.size && quota_fits_any(candidates->fifo_remaining, unvisited); i++) {
+        Vehicle* vehicle = vehicle_queue_at(&city->vehicle_queue, i);
+        if (vehicle_heading(vehicle) == heading) {
+            unvisited[vehicle->quota]--;
+            load_candidates_offer(candidates, vehicle->quota);
+        }
+    }
+    pthread_mutex_unlock(&city->queue_mutex);
+}
+
+/* Chooses how many vehicles of each quota to board into unfilled_quota */
+void plan_load(LoadingPolicy policy, const LoadCandidates* candidates, int unfilled_quota, LoadPlan* plan) {
+    const int* available = candidates->available;
+    int trucks = 0, minibuses = 0, cars = 0;
+    
+    switch (policy) {
+        case LOADING_FIFO:
+            trucks = candidates->fifo_take[TRUCK];
+            minibuses = candidates->fifo_take[MINIBUS];
+            cars = candidates->fifo_take[CAR];
+            break;
+            
+        case LOADING_GREEDY: {
+            int remaining = unfilled_quota;
+            trucks = available[TRUCK] < remaining / TRUCK ? available[TRUCK] : remaining / TRUCK;
+            remaining -= trucks * TRUCK;
+            minibuses = available[MINIBUS] < remaining / MINIBUS ? available[MINIBUS] : remaining / MINIBUS;
+            remaining -= minibuses * MINIBUS;
+            cars = available[CAR] < remaining ? available[CAR] : remaining;
+            break;
+        }
+            
+        case LOADING_EXACT_FILL: {
+            // For a fixed truck count, minibuses-then-cars is optimal for the rest, so one
+            // pass over the truck count finds the best fill (ties keep the most trucks)
+            int max_trucks = available[TRUCK] < unfilled_quota / TRUCK ? available[TRUCK] : unfilled_quota / TRUCK;
+            int best_fill = -1;
+            for (int t = max_trucks; t >= 0 && best_fill < unfilled_quota; t--) {
+                int remaining = unfilled_quota - t * TRUCK;
+                int m = available[MINIBUS] < remaining / MINIBUS ? available[MINIBUS] : remaining / MINIBUS;
+                int c = available[CAR] < remaining - m * MINIBUS ? available[CAR] : remaining - m * MINIBUS;
+                int fill = t * TRUCK + m * MINIBUS + c * CAR;
+                if (fill > best_fill) {
+                    best_fill = fill;
+                    trucks = t;
+                    minibuses = m;
+                    cars = c;
+                }
+            }
+            break;
+        }
+            
+        default:
+            break;
+    }
+    
+    plan->take[0] = 0;
+    plan->take[CAR] = cars;
+    plan->take[MINIBUS] = minibuses;
+    plan->take[TRUCK] = trucks;
+    plan->vehicles = cars + minibuses + trucks;
+    plan->quota = cars * CAR + minibuses * MINIBUS + trucks * TRUCK;
+}
+
+/* Looks up a policy by its option name - returns LOADING_POLICY_COUNT if unknown */
+LoadingPolicy parse_loading_policy(const char* name) {
+    return (LoadingPolicy)parse_option_name(name, loading_policy_names, LOADING_POLICY_COUNT);
+}
+
+/**
+ * Latency histogram functions implementation
+ */
+
+/* Bucket holding value - values below HISTOGRAM_SUB_BUCKETS are exact */
+int histogram_bucket(long long value) {
+    if (value < HISTOGRAM_SUB_BUCKETS) {
+        return value < 0 ? 0 : (int)value;
+    }
+    int msb = 63 - __builtin_clzll((unsigned long long)value);
+    int shift = msb - (HISTOGRAM_SUB_BITS - 1);
+    int sub = (int)(value >> shift);   // In [SUB_BUCKETS / 2, SUB_BUCKETS)
+    return HISTOGRAM_SUB_BUCKETS + (shift - 1) * (HISTOGRAM_SUB_BUCKETS / 2) + (sub - HISTOGRAM_SUB_BUCKETS / 2);
+}
+
+/* Largest value that falls into bucket */
+long long histogram_bucket_high(int bucket) {
+    if (bucket < HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int offset = bucket - HISTOGRAM_SUB_BUCKETS;
+    int shift = offset / (HISTOGRAM_SUB_BUCKETS / 2) + 1;
+    long long sub = offset % (HISTOGRAM_SUB_BUCKETS / 2) + HISTOGRAM_SUB_BUCKETS / 2;
+    return ((sub + 1) << shift) - 1;
+}
+
+/* Value at the given percentile (0-100), to bucket precision and never above the maximum */
+long long histogram_percentile(const LatencyHistogram* histogram, double percentile) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+    long long rank = (long long)(percentile / 100.0 * histogram->count + 0.5);
+    if (rank < 1) rank = 1;
+    
+    long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+        if (seen >= rank) {
+            long long high = histogram_bucket_high(i);
+            return high < histogram->max ? high : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+/* Adds count samples (negative values count as 0). The range pass is a plain reduction, so
+ * it vectorises; the bucket scatter and the sum stay in sample order, which keeps the
+ * floating-point sum the same as adding the samples one by one */
+void histogram_record_batch(LatencyHistogram* histogram, const long long* values, int count) {
+    if (count <= 0) {
+        return;
+    }
+    long long lowest = INT64_MAX;
+    long long highest = 0;
+    for (int i = 0; i < count; i++) {
+        long long value = values[i] < 0 ? 0 : values[i];
+        lowest = value < lowest ? value : lowest;
+        highest = value > highest ? value : highest;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        long long value = values[i] < 0 ? 0 : values[i];
+        histogram->counts[histogram_bucket(value)]++;
+        histogram->sum += (double)value;
+    }
+    if (histogram->count == 0 || lowest < histogram->min) {
+        histogram->min = lowest;
+    }
+    if (highest > histogram->max) {
+        histogram->max = highest;
+    }
+    histogram->count += count;
+}
+
+/* Stable counting sort of values by key (0 to key_limit - 1, key_limit <= MAX_TERMINALS)
+ * into grouped - group k is grouped[starts[k]] up to grouped[starts[k + 1]]. Each group
+ * stays in sample order and is contiguous, so the per-type and per-side statistics run the
+ * plain kernels on it */
+void batch_group_by(const long long* values, const int* keys, int count, int key_limit,
+                    long long* grouped, int* starts) {
+    for (int key = 0; key <= key_limit; key++) {
+        starts[key] = 0;
+    }
+    for (int i = 0; i < count; i++) {
+        starts[keys[i] + 1]++;
+    }
+    for (int key = 0; key < key_limit; key++) {
+        starts[key + 1] += starts[key];
+    }
+    int next[MAX_TERMINALS];
+    memcpy(next, starts, key_limit * sizeof(int));
+    for (int i = 0; i < count; i++) {
+        grouped[next[keys[i]]++] = values[i];
+    }
+}
+
+/* Feeds both legs of a batch of completed round trips into the overall, per-type and
+ * per-side histograms - caller must hold vehicle_records_mutex */
+void latency_record_batch(const StatsBatch* batch) {
+    // The per-leg metrics take the outbound and return samples of each vehicle in turn,
+    // tagged with the side the stage happened on
+    static const BatchStage leg_stages[LATENCY_ROUND_TRIP][2] = {
+        { STAGE_OUTBOUND_QUEUE, STAGE_RETURN_QUEUE },
+        { STAGE_OUTBOUND_TOLL, STAGE_RETURN_TOLL },
+        { STAGE_OUTBOUND_WAITING, STAGE_RETURN_WAITING },
+        { STAGE_OUTBOUND_RIDE, STAGE_RETURN_RIDE }
+    };
+    int count = batch->count;
+    long long values[2 * STATS_BATCH];
+    long long grouped[2 * STATS_BATCH];
+    int starts[MAX_TERMINALS + 1];
+    int types[2 * STATS_BATCH];
+    int sides[2 * STATS_BATCH];
+    for (int i = 0; i < count; i++) {
+        types[2 * i] = types[2 * i + 1] = batch->types[i];
+        sides[2 * i] = batch->origins[i];
+        sides[2 * i + 1] = batch->destinations[i];
+    }
+    
+    for (int m = 0; m < LATENCY_METRIC_COUNT; m++) {
+        const long long* samples;
+        const int* sample_types;
+        const int* sample_sides;
+        int samples_count;
+        if (m == LATENCY_ROUND_TRIP) {
+            samples = batch->durations[STAGE_ROUND_TRIP];
+            sample_types = batch->types;
+            sample_sides = batch->origins;
+            samples_count = count;
+        } else {
+            for (int i = 0; i < count; i++) {
+                values[2 * i] = batch->durations[leg_stages[m][0]][i];
+                values[2 * i + 1] = batch->durations[leg_stages[m][1]][i];
+            }
+            samples = values;
+            sample_types = types;
+            sample_sides = sides;
+            samples_count = 2 * count;
+        }
+        
+        histogram_record_batch(&latency_stats.all[m], samples, samples_count);
+        batch_group_by(samples, sample_types, samples_count, TRUCK + 1, grouped, starts);
+        for (int type = CAR; type <= TRUCK; type++) {
+            histogram_record_batch(&latency_stats.by_type[type][m], grouped + starts[type], starts[type + 1] - starts[type]);
+        }
+        batch_group_by(samples, sample_sides, samples_count, num_terminals, grouped, starts);
+        for (int side = 0; side < num_terminals; side++) {
+            histogram_record_batch(&latency_stats.by_side[side][m], grouped + starts[side], starts[side + 1] - starts[side]);
+        }
+    }
+}
+
+/* Calls visit for every histogram with samples, overall first, then per type and per side */
+void for_each_latency_histogram(void (*visit)(const char* metric, const char* group,
+                                              const LatencyHistogram* histogram, void* context),
+                                void* context) {
+    for (int m = 0; m < LATENCY_METRIC_COUNT; m++) {
+        if (latency_stats.all[m].count > 0) {
+            visit(latency_metric_names[m], "all", &latency_stats.all[m], context);
+        }
+        for (int type = CAR; type <= TRUCK; type++) {
+            if (latency_stats.by_type[type][m].count > 0) {
+                visit(latency_metric_names[m], vehicle_type_names[type], &latency_stats.by_type[type][m], context);
+            }
+        }
+        for (int side = 0; side < MAX_TERMINALS; side++) {
+            if (latency_stats.by_side[side][m].count > 0) {
+                visit(latency_metric_names[m], side_names[side], &latency_stats.by_side[side][m], context);
+            }
+        }
+    }
+}
+
+/* One row of the report's percentile table */
+void print_latency_row(const char* metric, const char* group, const LatencyHistogram* h, void* context) {
+    (void)context;
+    printf("| %-13s | %-7s | %8lld | %10.3f | %10.3f | %10.3f | %10.3f | %10.3f |\n",
+           metric, group, h->count,
+           histogram_percentile(h, 50.0) / 1e6, histogram_percentile(h, 90.0) / 1e6,
+           histogram_percentile(h, 99.0) / 1e6, h->max / 1e6, h->sum / h->count / 1e6);
+}
+
+/* Prints p50/p90/p99/max per metric, in milliseconds */
+void print_latency_report() {
+    if (latency_stats.all[LATENCY_ROUND_TRIP].count == 0) {
+        return;
+    }
+    printf("\n================ LATENCY PERCENTILES (milliseconds) =================\n");
+    printf("+---------------+---------+----------+------------+------------+------------+------------+------------+\n");
+    printf("| Metric        | Group   | Samples  | p50        | p90        | p99        | Max        | Mean       |\n");
+    printf("+---------------+---------+----------+------------+------------+------------+------------+------------+\n");
+    for_each_latency_histogram(print_latency_row, NULL);
+    printf("+---------------+---------+----------+------------+------------+------------+------------+------------+\n");
+}
+
+/* Export state shared by the CSV and JSON row writers */
+typedef struct {
+    FILE* file;
+    int json;
+    int rows;
+} LatencyExport;
+
+/* One exported histogram - all durations in seconds */
+void export_latency_row(const char* metric, const char* group, const LatencyHistogram* h, void* context) {
+    LatencyExport* out = (LatencyExport*)context;
+    if (out->json) {
+        fprintf(out->file, "%s\n    {\"metric\": \"%s\", \"group\": \"%s\", \"count\": %lld, "
+                "\"min\": %.9f, \"mean\": %.9f, \"p50\": %.9f, \"p90\": %.9f, \"p99\": %.9f, \"max\": %.9f}",
+                out->rows > 0 ? "," : "", metric, group, h->count, h->min / 1e9, h->sum / h->count / 1e9,
+                histogram_percentile(h, 50.0) / 1e9, histogram_percentile(h, 90.0) / 1e9,
+                histogram_percentile(h, 99.0) / 1e9, h->max / 1e9);
+    } else {
+        fprintf(out->file, "%s,%s,%lld,%.9f,%.9f,%.9f,%.9f,%.9f,%.9f\n",
+                metric, group, h->count, h->min / 1e9, h->sum / h->count / 1e9,
+                histogram_percentile(h, 50.0) / 1e9, histogram_percentile(h, 90.0) / 1e9,
+                histogram_percentile(h, 99.0) / 1e9, h->max / 1e9);
+    }
+    out->rows++;
+}
+
+/* Writes every histogram's summary to path - JSON if it ends in ".json", CSV otherwise.
+ * Returns 0 on success */
+int export_latency_stats(const char* path) {
+    size_t length = strlen(path);
+    LatencyExport out = { fopen(path, "w"), length >= 5 && strcmp(path + length - 5, ".json") == 0, 0 };
+    if (!out.file) {
+        perror("Failed to create latency export file");
+        return -1;
+    }
+    
+    if (out.json) {
+        fprintf(out.file, "{\n  \"unit\": \"seconds\",\n  \"loading_policy\": \"%s\",\n  \"latencies\": [",
+                loading_policy_names[config.loading_policy]);
+    } else {
+        fprintf(out.file, "metric,group,count,min_s,mean_s,p50_s,p90_s,p99_s,max_s\n");
+    }
+    for_each_latency_histogram(export_latency_row, &out);
+    if (out.json) {
+        fprintf(out.file, "\n  ]\n}\n");
+    }
+    
+    fclose(out.file);
+    return 0;
+}
+
+/**
+ * Trip telemetry functions implementation
+ */
+
+/* Adds a departing crossing as the next trip number - caller must hold mutex */
+void trip_log_append(const TripRecord* trip) {
+    if (trip_log.count == trip_log.capacity) {
+        int capacity = trip_log.capacity > 0 ? trip_log.capacity * 2 : 256;
+        TripRecord* records = (TripRecord*)realloc(trip_log.records, capacity * sizeof(TripRecord));
+        if (!records) {
+            perror("Failed to allocate memory for the trip log");
+            exit(EXIT_FAILURE);
+        }
+        trip_log.records = records;
+        trip_log.capacity = capacity;
+    }
+    trip_log.records[trip_log.count++] = *trip;
+}
+
+/* Utilisation per crossing, dock dwell and crossing times, and what made ferries leave */
+void print_trip_report() {
+    if (trip_log.count == 0) {
+        return;
+    }
+    
+    int reason_trips[TRIP_REASON_COUNT] = { 0 };
+    long long reason_quota[TRIP_REASON_COUNT] = { 0 };
+    double reason_dwell[TRIP_REASON_COUNT] = { 0.0 };
+    int load_bands[5] = { 0 };    // Empty, under 50%, 50-74%, 75-99%, full
+    long long quota = 0;
+    int loaded = 0, arrived = 0;
+    double dwell = 0.0, loading = 0.0, crossing = 0.0;
+    
+    for (int i = 0; i < trip_log.count; i++) {
+        const TripRecord* trip = &trip_log.records[i];
+        reason_trips[trip->reason]++;
+        reason_quota[trip->reason] += trip->quota;
+        reason_dwell[trip->reason] += trip->dwell_seconds;
+        quota += trip->quota;
+        dwell += trip->dwell_seconds;
+        if (trip->vehicles > 0) {
+            loaded++;
+            loading += trip->loading_seconds;
+        }
+        if (trip->arrived) {
+            arrived++;
+            crossing += trip->crossing_seconds;
+        }
+        
+        int percent = trip->quota * 100 / config.ferry_capacity;
+        load_bands[trip->vehicles == 0 ? 0 : percent < 50 ? 1 : percent < 75 ? 2 : percent < 100 ? 3 : 4]++;
+    }
+    
+    double capacity = config.ferry_capacity;
+    printf("\nTrip Telemetry:\n");
+    printf("  Crossings: %d (%d empty legs: %d first return, %d repositioning)\n", trip_log.count,
+           load_bands[0], reason_trips[TRIP_REASON_FIRST_RETURN], reason_trips[TRIP_REASON_REPOSITION]);
+    printf("  Quota per crossing: %.2f of %d (%.1f%%)", (double)quota / trip_log.count, config.ferry_capacity,
+           quota / capacity / trip_log.count * 100.0);
+    if (loaded > 0) {
+        printf(", loaded crossings %.2f (%.1f%%)", (double)quota / loaded, quota / capacity / loaded * 100.0);
+    }
+    printf("\n");
+    printf("  Load: %d empty, %d under 50%%, %d at 50-74%%, %d at 75-99%%, %d full\n",
+           load_bands[0], load_bands[1], load_bands[2], load_bands[3], load_bands[4]);
+    printf("  Mean dock dwell: %.3f seconds, first vehicle aboard to departure: %.3f seconds",
+           dwell / trip_log.count, loaded > 0 ? loading / loaded : 0.0);
+    if (arrived > 0) {
+        printf(", crossing: %.3f seconds", crossing / arrived);
+    }
+    printf("\n");
+    
+    printf("  By departure reason:\n");
+    for (int reason = 0; reason < TRIP_REASON_COUNT; reason++) {
+        if (reason_trips[reason] > 0) {
+            printf("    %-13s %5d crossings, %5.1f%% utilisation, %.3f s mean dwell\n", trip_reason_names[reason],
+                   reason_trips[reason], reason_quota[reason] / capacity / reason_trips[reason] * 100.0,
+                   reason_dwell[reason] / reason_trips[reason]);
+        }
+    }
+}
+
+/* Writes one CSV line per crossing to path - returns 0 on success */
+int export_trip_log(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to create trip export file");
+        return -1;
+    }
+    
+    fprintf(file, "trip,ferry,from,to,reason,vehicles,quota,capacity,dwell_s,loading_s,crossing_s\n");
+    for (int i = 0; i < trip_log.count; i++) {
+        const TripRecord* trip = &trip_log.records[i];
+        fprintf(file, "%d,%s,%s,%s,%s,%d,%d,%d,%.3f,%.3f,", i + 1, ferries[trip->ferry].name,
+                city_parts[trip->from].name, city_parts[trip->to].name, trip_reason_names[trip->reason],
+                trip->vehicles, trip->quota, config.ferry_capacity, trip->dwell_seconds, trip->loading_seconds);
+        if (trip->arrived) {
+            fprintf(file, "%.3f", trip->crossing_seconds);
+        }
+        fprintf(file, "\n");
+    }
+    
+    fclose(file);
+    return 0;
+}
+
+/**
+ * Ferry functions implementation
+ */
+
+/* Set up a new ferry with specified capacity, serving route */
+void initialize_ferry(Ferry* ferry, const char* name, int capacity, const Route* route) {
+    strcpy(ferry->name, name);
+    ferry->capacity = capacity;
+    ferry->route = route;
+    
+    // Every vehicle takes at least 1 quota, so capacity slots are always enough
+    ferry->vehicles = (Vehicle**)malloc(capacity * sizeof(Vehicle*));
+    if (!ferry->vehicles) {
+        perror("Failed to allocate memory for ferry");
+        exit(EXIT_FAILURE);
+    }
+
+    ferry->current_load = 0;
+    ferry->vehicle_count = 0;
+    ferry->is_loading = 0;
+    ferry->is_moving = 0;
+    ferry->is_unloading = 0;
+    ferry->is_running = 0;
+    ferry->departure_side = NULL;
+    ferry->first_outbound_completed = 0;
+    ferry->first_return_completed = 0;
+    ferry->last_waiting_message = 0;
+    ferry->last_message_time = 0;
+    ferry->departure_version = 0;
+    ferry->depart_message_time = 0;
+    ferry->depart_vehicles_needed = 0;
+    ferry->depart_unfilled_quota = 0;
+    ferry->depart_state = 0;
+    ferry->depart_reason = TRIP_REASON_FULL;
+    ferry->depart_deadline = 0;
+    ferry->deadline_generation = 0;
+    ferry->trip_number = 0;
+    ferry->docked_time = 0;
+    ferry->first_boarding_time = 0;
+    ferry->departure_time = 0;
+    ferry->trips_completed = 0;
+    ferry->vehicles_carried = 0;
+    ferry->docked_at = NULL;
+    ferry->docked_sequence = 0;
+    ferry->event_pending = 0;
+    ferry->location = NULL;
+    pthread_mutex_init(&ferry->mutex, NULL);
+    rng_init(&ferry->rng, run_seed, RNG_STREAM_FERRY | (uint64_t)(ferry - ferries));
+    platform_cond_init(&ferry->departure_changed);
+}
+
+/* Dock the ferry at a city side */
+void dock_at(Ferry* ferry, CityPart* city_part) {
+    ferry->location = city_part;
+    ferry->docked_time = sim_now();
+    sim_log(LOG_INFO, LOG_EVENT_TRIP, -1, city_part->id, -1, "%s docked at %s\n", ferry->name, city_part->name);
+}
+
+/* Load a vehicle onto the ferry */
+int load_vehicle(Ferry* ferry, Vehicle* vehicle) {
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    
+    if (ferry->current_load + vehicle->quota <= ferry->capacity) {
+        // Check if this is a return journey
+        int is_return_journey = vehicle->is_transported == 1;
+        
+        if (!is_return_journey) {
+            // Outbound journey (first trip)
+            vehicle->timing->boarding_time = sim_now();
+            
+            // Calculate waiting times for reporting
+            double queue_wait_time = seconds_between(vehicle->timing->toll_entry_time, vehicle->timing->arrival_time);
+            double waiting_area_time = seconds_between(vehicle->timing->boarding_time, vehicle->timing->waiting_area_time);
+            
+            // Total time is sum of components
+            double total_wait_time = queue_wait_time + waiting_area_time;
+            
+            sim_log(LOG_INFO, LOG_EVENT_BOARDING, vehicle->id, vehicle->current_side, -1, "%s_%d (%d quota) boarded %s for outbound journey (Used: %d/%d, Remaining: %d)\n",
+                   vehicle_type_names[vehicle->type], vehicle->id, vehicle->quota, ferry->name,
+                   ferry->current_load + vehicle->quota, ferry->capacity, 
+                   ferry->capacity - (ferry->current_load + vehicle->quota));
+            
+            sim_log(LOG_INFO, LOG_EVENT_BOARDING, vehicle->id, vehicle->current_side, -1, "  - %s_%d waiting times: In queue: %.3f sec, In waiting area: %.3f sec, Total: %.3f sec\n",
+                   vehicle_type_names[vehicle->type], vehicle->id, queue_wait_time, waiting_area_time, total_wait_time);
+        } else {
+            // Return journey
+            vehicle->timing->boarding_time_return = sim_now();
+            
+            // Calculate return waiting times, split the same way as outbound
+            double queue_wait = seconds_between(vehicle->timing->toll_entry_time_return, vehicle->timing->arrival_time_return);
+            double waiting_area_wait = seconds_between(vehicle->timing->boarding_time_return, vehicle->timing->waiting_area_time_return);
+            
+            // Total time is sum of components
+            double total_wait = queue_wait + waiting_area_wait;
+            
+            sim_log(LOG_INFO, LOG_EVENT_BOARDING, vehicle->id, vehicle->current_side, -1, "%s_%d (%d quota) boarded %s for return journey (Used: %d/%d, Remaining: %d)\n",
+                   vehicle_type_names[vehicle->type], vehicle->id, vehicle->quota, ferry->name,
+                   ferry->current_load + vehicle->quota, ferry->capacity, 
+                   ferry->capacity - (ferry->current_load + vehicle->quota));
+            
+            sim_log(LOG_INFO, LOG_EVENT_BOARDING, vehicle->id, vehicle->current_side, -1, "  - %s_%d return waiting times: In queue: %.3f sec, In waiting area: %.3f sec, Total: %.3f sec\n", 
+                   vehicle_type_names[vehicle->type], vehicle->id, queue_wait, waiting_area_wait, total_wait);
+        }
+        
+        trace_vehicle(TRACE_BOARDING, vehicle, vehicle->current_side, (int)(ferry - ferries), 0);
+        
+        // Add vehicle to ferry
+        if (ferry->vehicle_count == 0) {
+            ferry->first_boarding_time = sim_now();
+        }
+        ferry->vehicles[ferry->vehicle_count] = vehicle;
+        ferry->vehicle_count++;
+        ferry->current_load += vehicle->quota;
+        metric_update_begin();
+        metric_add(&live_metrics.ferry_load[ferry - ferries], vehicle->quota);
+        metric_add(&live_metrics.ferry_vehicles[ferry - ferries], 1);
+        metric_update_end();
+        
+        pthread_mutex_unlock(&ferry->mutex);
+        return 1; // Successfully loaded
+    }
+    
+    pthread_mutex_unlock(&ferry->mutex);
+    return 0; // Could not load (ferry would exceed capacity)
+}
+
+/* Trip count is now defined globally */
+
+/* Rules scheduler - depart based on a fixed cascade of conditions */
+int rules_should_depart(Ferry* ferry) {
+    // Only lock mutex when accessing shared data
+    CityPart* location = ferry->location;
+    CityPart* other_side = route_peer(ferry->route, location);
+    int vehicle_count = ferry->vehicle_count;
+    int current_load = ferry->current_load;
+    int capacity = ferry->capacity;
+    
+    // First check if there are any vehicles on the ferry
+    if (vehicle_count == 0) {
+        return 0;
+    }
+    
+    // Calculate remaining vehicles requiring transport (other ferries update the total)
+    pthread_mutex_lock(&mutex);
+    int remaining_vehicles = fleet_remaining();
+    pthread_mutex_unlock(&mutex);
+    int can_leave = 0;
+    int departure_reason = 0; // 1=full, 2=partial with no waiting, 3=other side needs
+    
+    // Rule 1: Ferry is completely full
+    if (current_load == capacity) {
+        can_leave = 1;
+        departure_reason = 1;
+        ferry->depart_reason = TRIP_REASON_FULL;
+    }
+            // Check potential for additional capacity filling
+    else {
+        int unfilled_quota = capacity - current_load;
+        
+        // Count the vehicles that could still board - O(1) when nothing fits
+        LoadCandidates candidates;
+        load_candidates_init(&candidates, unfilled_quota);
+        
+        city_lock(location);
+        if (city_has_fitting_vehicle(location, other_side->id, unfilled_quota, 1)) {
+            collect_load_candidates(location, other_side->id, &candidates, 1);
+        }
+        pthread_mutex_unlock(&location->mutex);
+        
+        // The loader will board by the same plan
+        LoadPlan plan;
+        plan_load(config.loading_policy, &candidates, unfilled_quota, &plan);
+        int vehicles_fitted = plan.vehicles;
+        int total_quota_fitted = plan.quota;
+        
+        // Different departure conditions
+        
+        // Condition 1: Ferry can potentially reach full capacity - wait for these vehicles
+        if (total_quota_fitted >= unfilled_quota) {
+            // Only show message when status changes or periodically
+            SimTime current_time = sim_now();
+            if (ferry->depart_vehicles_needed != vehicles_fitted || ferry->depart_unfilled_quota != unfilled_quota || 
+                seconds_between(current_time, ferry->depart_message_time) >= 5.0) { // Show message every 5 seconds
+                
+                sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Waiting for %d more vehicles to reach full capacity before departing (%d/%d quotas filled)\n", 
+                       vehicles_fitted, current_load, capacity);
+                
+                // Update status
+                ferry->depart_message_time = current_time;
+                ferry->depart_vehicles_needed = vehicles_fitted;
+                ferry->depart_unfilled_quota = unfilled_quota;
+                ferry->depart_state = 0;
+            }
+            can_leave = 0;
+        }
+        // Condition 2: Only 1 quota left unfilled and no cars available
+        else if (unfilled_quota == 1 && total_quota_fitted == 0) {
+            if (ferry->depart_state != 2) {
+                sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Only 1 quota left unfilled and no cars available - ready to depart\n");
+                ferry->depart_state = 2;
+            }
+            can_leave = 1;
+            departure_reason = 2;
+            ferry->depart_reason = TRIP_REASON_NOTHING_FITS;
+        }
+        // Condition 3: Only 2 quotas left unfilled and no fitting vehicles
+        else if (unfilled_quota == 2 && total_quota_fitted == 0) {
+            if (ferry->depart_state != 3) {
+                sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Only 2 quotas left unfilled and no fitting vehicles available - ready to depart\n");
+                ferry->depart_state = 3;
+            }
+            can_leave = 1;
+            departure_reason = 2;
+            ferry->depart_reason = TRIP_REASON_NOTHING_FITS;
+        }
+        // Condition 4: Only 3 quotas left unfilled and no fitting vehicles
+        else if (unfilled_quota == 3 && total_quota_fitted == 0) {
+            if (ferry->depart_state != 4) {
+                sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Only 3 quotas left unfilled and no fitting vehicles available - ready to depart\n");
+                ferry->depart_state = 4;
+            }
+            can_leave = 1;
+            departure_reason = 2;
+            ferry->depart_reason = TRIP_REASON_NOTHING_FITS;
+        }
+        // Condition 5: Final trip - ferry has all remaining vehicles
+        else if (vehicle_count == remaining_vehicles && total_quota_fitted == 0) {
+            if (ferry->depart_state != 5) {
+                sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Final trip: Ferry has all remaining %d vehicles - ready to depart\n", remaining_vehicles);
+                ferry->depart_state = 5;
+            }
+            can_leave = 1;
+            departure_reason = 2;
+            ferry->depart_reason = TRIP_REASON_FINAL;
+        }
+        // Condition 6: No more vehicles here but vehicles waiting on other side
+        else if (total_quota_fitted == 0) {
+            // Check for vehicles on the other side that travel this route
+            city_lock(other_side);
+            int other_side_has_vehicles = (inbound_vehicle_count(other_side, location->id) > 0 ||
+                                           other_side->waiting_area.size_to[location->id] > 0);
+            pthread_mutex_unlock(&other_side->mutex);
+            
+            if (other_side_has_vehicles) {
+                if (ferry->depart_state != 6) {
+                    sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "No more vehicles at current side, but vehicles waiting at other side - ferry departing\n");
+                    ferry->depart_state = 6;
+                }
+                can_leave = 1;
+                departure_reason = 3;
+                ferry->depart_reason = TRIP_REASON_OTHER_SIDE;
+            } else {
+                // Both sides empty
+                if (ferry->depart_state != 7) {
+                    sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Both sides empty, ferry departing with partial load: %d/%d quotas\n", 
+                          current_load, capacity);
+                    ferry->depart_state = 7;
+                }
+                can_leave = 1;
+                departure_reason = 2;
+                ferry->depart_reason = TRIP_REASON_BOTH_EMPTY;
+            }
+        }
+    }
+
+    // Only report status change
+    if (can_leave && departure_reason == 1 && ferry->depart_state != 1) {
+        sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Ferry is at full capacity and ready to depart\n");
+        ferry->depart_state = 1;
+    }
+    
+    return can_leave;
+}
+
+/* Folds one toll queue arrival into the smoothed rate - caller must hold city->queue_mutex */
+void arrival_estimate_update(ArrivalEstimate* estimate, SimTime now, int quota) {
+    if (estimate->samples == 0) {
+        estimate->mean_quota = quota;
+    } else {
+        double gap = seconds_between(now, estimate->last_ns);
+        estimate->mean_gap_seconds = estimate->samples == 1 ? gap :
+            estimate->mean_gap_seconds + (gap - estimate->mean_gap_seconds) * ARRIVAL_SMOOTHING;
+        estimate->mean_quota += (quota - estimate->mean_quota) * ARRIVAL_SMOOTHING;
+    }
+    estimate->last_ns = now;
+    estimate->samples++;
+}
+
+/* Expected seconds until arrivals at city bound for heading bring missing_quota more quotas,
+ * or -1 if there is no estimate yet. The time since the latest arrival counts as a gap once
+ * it is longer than the average, so the estimate grows while nobody comes. *deadline is set
+ * to when, without further arrivals, the estimate passes the latency budget. */
+double expected_fill_seconds(CityPart* city, SideId heading, int missing_quota, SimTime now, SimTime* deadline) {
+    lock_mutex(&city->queue_mutex, LOCK_TOLL_QUEUE);
+    ArrivalEstimate estimate = city->arrivals_to[heading];
+    pthread_mutex_unlock(&city->queue_mutex);
+    
+    if (estimate.samples < 2) {
+        return -1.0;
+    }
+    double since_last = seconds_between(now, estimate.last_ns);
+    double gap = estimate.mean_gap_seconds > since_last ? estimate.mean_gap_seconds : since_last;
+    
+    // Quiet gap after which the budget is exceeded - plus a millisecond so the re-check lands past it
+    double critical_gap = config.latency_budget * estimate.mean_quota / missing_quota;
+    *deadline = estimate.last_ns + (SimTime)(critical_gap * NS_PER_SECOND) + NS_PER_SECOND / 1000;
+    return missing_quota * gap / estimate.mean_quota;
+}
+
+/* Adaptive scheduler - waits for arrivals only while the expected time to fill the free
+ * quota stays within the latency budget (--latency-budget). A long budget favours full
+ * ferries, a short one short waits. Vehicles already at the terminal are always waited for. */
+int adaptive_should_depart(Ferry* ferry) {
+    CityPart* location = ferry->location;
+    CityPart* other_side = route_peer(ferry->route, location);
+    int unfilled_quota = ferry->capacity - ferry->current_load;
+    SimTime previous_deadline = ferry->depart_deadline;
+    ferry->depart_deadline = 0;
+    
+    if (ferry->vehicle_count == 0) {
+        return 0;
+    }
+    if (unfilled_quota == 0) {
+        if (ferry->depart_state != 1) {
+            sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Ferry is at full capacity and ready to depart\n");
+            ferry->depart_state = 1;
+        }
+        ferry->depart_reason = TRIP_REASON_FULL;
+        return 1;
+    }
+    
+    // Nothing is left to wait for once every remaining vehicle is aboard
+    pthread_mutex_lock(&mutex);
+    int remaining_vehicles = fleet_remaining();
+    pthread_mutex_unlock(&mutex);
+    if (ferry->vehicle_count == remaining_vehicles) {
+        if (ferry->depart_state != 5) {
+            sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Final trip: Ferry has all remaining %d vehicles - ready to depart\n", remaining_vehicles);
+            ferry->depart_state = 5;
+        }
+        ferry->depart_reason = TRIP_REASON_FINAL;
+        return 1;
+    }
+    
+    // Vehicles already in the waiting area, at a booth or in the toll queue that would board
+    LoadCandidates candidates;
+    load_candidates_init(&candidates, unfilled_quota);
+    city_lock(location);
+    if (city_has_fitting_vehicle(location, other_side->id, unfilled_quota, 1)) {
+        collect_load_candidates(location, other_side->id, &candidates, 1);
+    }
+    pthread_mutex_unlock(&location->mutex);
+    LoadPlan plan;
+    plan_load(config.loading_policy, &candidates, unfilled_quota, &plan);
+    
+    int missing_quota = unfilled_quota - plan.quota;
+    if (missing_quota <= 0) {
+        if (ferry->depart_state != 8) {
+            sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Vehicles at %s fill the remaining %d quotas - waiting for them\n",
+                   location->name, unfilled_quota);
+            ferry->depart_state = 8;
+        }
+        return 0;
+    }
+    
+    // The rest has to come from new arrivals
+    SimTime now = sim_now();
+    SimTime deadline = 0;
+    double fill_seconds = expected_fill_seconds(location, other_side->id, missing_quota, now, &deadline);
+    if (fill_seconds < 0.0 || fill_seconds > config.latency_budget) {
+        if (ferry->depart_state != 9) {
+            sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "%s %d more quotas (budget %d s) - departing with %d/%d quotas\n",
+                   fill_seconds < 0.0 ? "No arrival history yet to fill" : "Too long to fill",
+                   missing_quota, config.latency_budget, ferry->current_load, ferry->capacity);
+            ferry->depart_state = 9;
+        }
+        ferry->depart_reason = TRIP_REASON_BUDGET;
+        return 1;
+    }
+    
+    if (ferry->depart_state != 10) {
+        sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, location->id, -1, "Expecting %d more quotas within %.1f s (budget %d s) - waiting\n",
+               missing_quota, fill_seconds, config.latency_budget);
+        ferry->depart_state = 10;
+    }
+    
+    // Re-check at the deadline even if nothing arrives
+    ferry->depart_deadline = deadline;
+    if (config.virtual_clock && deadline != previous_deadline) {
+        schedule_event(EVENT_FERRY_DEADLINE, (deadline - now) / 1000, NULL, NULL, NULL, ferry,
+                       ++ferry->deadline_generation);
+    }
+    return 0;
+}
+
+/* A departure scheduler decides when a loaded ferry leaves and how long it then waits for
+ * last-minute vehicles. Both thread and event modes go through can_depart */
+typedef struct {
+    int (*should_depart)(Ferry* ferry);
+    long long grace_us;
+} DepartureScheduler;
+
+const DepartureScheduler departure_schedulers[DEPARTURE_POLICY_COUNT] = {
+    { rules_should_depart, 500000 },   // Half a second for last-minute vehicles
+    { adaptive_should_depart, 0 }      // Already waited for as long as worthwhile
+};
+
+/* Check if the ferry can depart under the configured scheduler */
+int can_depart(Ferry* ferry) {
+    return departure_schedulers[config.departure_policy].should_depart(ferry);
+}
+
+/* Last-minute wait between deciding to depart and leaving */
+long long departure_grace_us() {
+    return departure_schedulers[config.departure_policy].grace_us;
+}
+
+/* Structure for storing comprehensive vehicle statistics */
+typedef struct {
+    int id;
+    VehicleType type;
+    int quota;
+    SideId origin_side;
+    double outbound_journey_time;
+    int outbound_trip_number;
+    double return_journey_time;
+    int return_trip_number;
+    double time_at_destination;    // Time spent at destination before return
+    int completed_round_trip;
+} VehicleRecord;
+
+/* Count, sum and range of one duration, in seconds */
+typedef struct {
+    long long count;
+    double sum;
+    double min;
+    double max;
+} RunningStat;
+
+/* Report aggregates, added to as each vehicle completes so that the report never walks
+ * the fleet - protected by vehicle_records_mutex */
+typedef struct {
+    RunningStat outbound;                   // Arrival to unload at the destination
+    RunningStat outbound_queue;             // Arrival to toll entry
+    RunningStat outbound_toll;              // Toll processing
+    RunningStat outbound_waiting;           // Waiting area to boarding
+    RunningStat ferry_ride;                 // Boarding to unload, outbound
+    RunningStat return_journey;
+    RunningStat round_trip;
+    RunningStat outbound_by_type[TRUCK + 1];
+    RunningStat round_trip_by_side[MAX_TERMINALS]; // By origin
+} TransportStats;
+
+VehicleRecord vehicle_records[MAX_DETAILED_RECORDS]; // The first completions, for the detail table
+int recorded_vehicle_count = 0;
+TransportStats transport_stats;
+pthread_mutex_t vehicle_records_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* qsort comparator - orders statistics records by vehicle ID */
+int compare_records_by_id(const void* a, const void* b) {
+    const VehicleRecord* left = (const VehicleRecord*)a;
+    const VehicleRecord* right = (const VehicleRecord*)b;
+    return (left->id > right->id) - (left->id < right->id);
+}
+
+/* Mean of a running aggregate - 0 when it is empty */
+double running_stat_mean(const RunningStat* stat) {
+    return stat->count > 0 ? stat->sum / stat->count : 0.0;
+}
+
+/* Adds count nanosecond durations to a running aggregate. The range is taken on the
+ * integers, which vectorises and gives the same seconds as comparing each converted value;
+ * the sum stays in sample order */
+void running_stat_add_batch(RunningStat* stat, const long long* durations, int count) {
+    if (count <= 0) {
+        return;
+    }
+    long long lowest = INT64_MAX;
+    long long highest = INT64_MIN;
+    for (int i = 0; i < count; i++) {
+        lowest = durations[i] < lowest ? durations[i] : lowest;
+        highest = durations[i] > highest ? durations[i] : highest;
+    }
+    
+    for (int i = 0; i < count; i++) {
+        stat->sum += (double)durations[i] / NS_PER_SECOND;
+    }
+    double min = (double)lowest / NS_PER_SECOND;
+    double max = (double)highest / NS_PER_SECOND;
+    if (stat->count == 0 || min < stat->min) {
+        stat->min = min;
+    }
+    if (stat->count == 0 || max > stat->max) {
+        stat->max = max;
+    }
+    stat->count += count;
+}
+
+/* Batch kernel - out[i] = end[i] - start[i] */
+void batch_durations(long long* restrict out, const SimTime* restrict end, const SimTime* restrict start, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = end[i] - start[i];
+    }
+}
+
+/* Gathers the stamps of the batch's vehicles into one array each and computes every stage
+ * duration from them. Stamps come from a monotonic clock and every stage sets its own, so
+ * they are already in chronological order and need no clamping */
+void stats_batch_fill(StatsBatch* batch) {
+    SimTime arrival[STATS_BATCH], toll_entry[STATS_BATCH], waiting_area[STATS_BATCH];
+    SimTime boarding[STATS_BATCH], unload[STATS_BATCH];
+    SimTime arrival_return[STATS_BATCH], toll_entry_return[STATS_BATCH], waiting_area_return[STATS_BATCH];
+    SimTime boarding_return[STATS_BATCH], complete[STATS_BATCH];
+    int count = batch->count;
+    
+    for (int i = 0; i < count; i++) {
+        const Vehicle* vehicle = batch->vehicles[i];
+        const VehicleTiming* t = vehicle->timing;
+        batch->types[i] = vehicle->type;
+        batch->origins[i] = vehicle->origin_side;
+        batch->destinations[i] = vehicle->destination_side;
+        arrival[i] = t->arrival_time;
+        toll_entry[i] = t->toll_entry_time;
+        waiting_area[i] = t->waiting_area_time;
+        boarding[i] = t->boarding_time;
+        unload[i] = t->unload_time;
+        arrival_return[i] = t->arrival_time_return;
+        toll_entry_return[i] = t->toll_entry_time_return;
+        waiting_area_return[i] = t->waiting_area_time_return;
+        boarding_return[i] = t->boarding_time_return;
+        complete[i] = t->complete_time;
+    }
+    
+    long long (*d)[STATS_BATCH] = batch->durations;
+    batch_durations(d[STAGE_OUTBOUND], unload, arrival, count);
+    batch_durations(d[STAGE_OUTBOUND_QUEUE], toll_entry, arrival, count);
+    batch_durations(d[STAGE_OUTBOUND_TOLL], waiting_area, toll_entry, count);
+    batch_durations(d[STAGE_OUTBOUND_WAITING], boarding, waiting_area, count);
+    batch_durations(d[STAGE_OUTBOUND_RIDE], unload, boarding, count);
+    batch_durations(d[STAGE_RETURN_QUEUE], toll_entry_return, arrival_return, count);
+    batch_durations(d[STAGE_RETURN_TOLL], waiting_area_return, toll_entry_return, count);
+    batch_durations(d[STAGE_RETURN_WAITING], boarding_return, waiting_area_return, count);
+    batch_durations(d[STAGE_RETURN_RIDE], complete, boarding_return, count);
+    batch_durations(d[STAGE_RETURN], complete, arrival_return, count);
+    batch_durations(d[STAGE_ROUND_TRIP], complete, arrival, count);
+}
+
+/* Adds a filled batch to the aggregates, histograms and detail records - caller must hold
+ * vehicle_records_mutex */
+void stats_batch_record(const StatsBatch* batch) {
+    int count = batch->count;
+    const long long (*d)[STATS_BATCH] = batch->durations;
+    long long grouped[STATS_BATCH];
+    int starts[MAX_TERMINALS + 1];
+    
+    running_stat_add_batch(&transport_stats.outbound, d[STAGE_OUTBOUND], count);
+    running_stat_add_batch(&transport_stats.outbound_queue, d[STAGE_OUTBOUND_QUEUE], count);
+    running_stat_add_batch(&transport_stats.outbound_toll, d[STAGE_OUTBOUND_TOLL], count);
+    running_stat_add_batch(&transport_stats.outbound_waiting, d[STAGE_OUTBOUND_WAITING], count);
+    running_stat_add_batch(&transport_stats.ferry_ride, d[STAGE_OUTBOUND_RIDE], count);
+    batch_group_by(d[STAGE_OUTBOUND], batch->types, count, TRUCK + 1, grouped, starts);
+    for (int type = CAR; type <= TRUCK; type++) {
+        running_stat_add_batch(&transport_stats.outbound_by_type[type], grouped + starts[type], starts[type + 1] - starts[type]);
+    }
+    running_stat_add_batch(&transport_stats.return_journey, d[STAGE_RETURN], count);
+    running_stat_add_batch(&transport_stats.round_trip, d[STAGE_ROUND_TRIP], count);
+    batch_group_by(d[STAGE_ROUND_TRIP], batch->origins, count, num_terminals, grouped, starts);
+    for (int side = 0; side < num_terminals; side++) {
+        running_stat_add_batch(&transport_stats.round_trip_by_side[side], grouped + starts[side], starts[side + 1] - starts[side]);
+    }
+    latency_record_batch(batch);
+    
+    // Only the first completions are kept individually - the aggregates cover every vehicle
+    for (int i = 0; i < count && recorded_vehicle_count < MAX_DETAILED_RECORDS; i++) {
+        const Vehicle* vehicle = batch->vehicles[i];
+        VehicleRecord* record = &vehicle_records[recorded_vehicle_count++];
+        record->id = vehicle->id;
+        record->type = vehicle->type;
+        record->quota = vehicle->quota;
+        record->origin_side = vehicle->origin_side;  // Where the vehicle started
+        record->outbound_journey_time = (double)d[STAGE_OUTBOUND][i] / NS_PER_SECOND;
+        record->outbound_trip_number = vehicle->outbound_trip_number;
+        record->return_journey_time = (double)d[STAGE_RETURN][i] / NS_PER_SECOND;
+        record->return_trip_number = vehicle->return_trip_number;
+        record->time_at_destination = vehicle->errand_time; // Time spent doing errands
+        record->completed_round_trip = 1;
+    }
+}
+
+/* Adds the vehicles of a ferry load that have completed their round trip to the
+ * statistics, STATS_BATCH at a time under a single lock. Completed vehicles leave the
+ * ferry at the end of the unload, so every one on board is new here */
+void record_transported_vehicles(Vehicle* const* vehicles, int count) {
+    StatsBatch batch;
+    lock_mutex(&vehicle_records_mutex, LOCK_VEHICLE_RECORDS);
+    
+    int next = 0;
+    while (next < count) {
+        batch.count = 0;
+        for (; next < count && batch.count < STATS_BATCH; next++) {
+            if (vehicles[next]->is_transported == 2) {
+                batch.vehicles[batch.count++] = vehicles[next];
+            }
+        }
+        if (batch.count > 0) {
+            stats_batch_fill(&batch);
+            stats_batch_record(&batch);
+        }
+    }
+    
+    pthread_mutex_unlock(&vehicle_records_mutex);
+}
+
+/* Handles unloading vehicles at destination - returns the unloading time in microseconds */
+int unload_ferry_begin(Ferry* ferry) {
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    
+    ferry->is_unloading = 1;
+    sim_log(LOG_INFO, LOG_EVENT_UNLOADING, -1, ferry->location->id, -1, "%s unloading %d vehicles at %s\n", ferry->name, ferry->vehicle_count, ferry->location->name);
+    ferry->vehicles_carried += ferry->vehicle_count;
+    
+    // Set current time for unload timing
+    SimTime current_time = sim_now();
+    CityPart* current_location = ferry->location;
+    
+    // Process each vehicle on the ferry
+    for (int i = 0; i < ferry->vehicle_count; i++) {
+        Vehicle* vehicle = ferry->vehicles[i];
+        
+        // Different handling for outbound vs return trips
+        if (vehicle->is_transported == 0) {
+            // First journey (outbound) completed
+            vehicle->timing->unload_time = current_time;
+            trace_vehicle(TRACE_UNLOAD, vehicle, current_location->id, (int)(ferry - ferries),
+                          vehicle->outbound_trip_number);
+            vehicle->is_transported = 1; // Mark as completed first leg
+            vehicle->current_side = current_location->id; // Update current side
+            vehicle->return_side = ferry->departure_side->id; // Back along the route it came in on
+            
+            // Calculate journey times for this trip
+            double total_transit_time = seconds_between(vehicle->timing->unload_time, vehicle->timing->arrival_time);
+            double ferry_ride_time = seconds_between(vehicle->timing->unload_time, vehicle->timing->boarding_time);
+            
+            // Report individual vehicle stats
+            sim_log(LOG_INFO, LOG_EVENT_UNLOADING, vehicle->id, ferry->location->id, -1, "  - %s_%d transported (outbound): Total time: %.3f sec, Ferry ride: %.3f sec\n",
+                   vehicle_type_names[vehicle->type], vehicle->id, total_transit_time, ferry_ride_time);
+            
+            // Vehicles spend time at destination for activities 
+            // Simulate vehicle activities at destination (shopping, business, etc.)
+            vehicle->errand_time = 10 + rng_below(&ferry->rng, 21); // 10-30 seconds
+            vehicle->ready_for_return = 1;
+            
+            // Report how long vehicle will stay at destination
+            sim_log(LOG_INFO, LOG_EVENT_ERRAND, vehicle->id, ferry->location->id, -1, "%s_%d will spend %d seconds at %s before returning to %s\n", 
+                   vehicle_type_names[vehicle->type], vehicle->id, 
+                   vehicle->errand_time,
+                   current_location->name, 
+                   city_parts[vehicle->return_side].name);
+            
+        } else if (vehicle->is_transported == 1) {
+            // Return journey completed - full round trip done!
+            vehicle->timing->complete_time = current_time;
+            trace_vehicle(TRACE_COMPLETE, vehicle, current_location->id, (int)(ferry - ferries),
+                          vehicle->return_trip_number);
+            vehicle->is_transported = 2; // Mark as having completed round trip
+            
+            // Calculate total round trip stats
+            double outbound_time = seconds_between(vehicle->timing->unload_time, vehicle->timing->arrival_time);
+            double return_time = seconds_between(vehicle->timing->complete_time, vehicle->timing->arrival_time_return);
+            double total_round_trip = seconds_between(vehicle->timing->complete_time, vehicle->timing->arrival_time);
+            
+            sim_log(LOG_INFO, LOG_EVENT_UNLOADING, vehicle->id, ferry->location->id, -1, "  - %s_%d completed round trip: Outbound: %.3f sec, Return: %.3f sec, Total: %.3f sec\n",
+                   vehicle_type_names[vehicle->type], vehicle->id, outbound_time, return_time, total_round_trip);
+        }
+    }
+    
+    // Record the completed vehicles for final stats, as one batch
+    record_transported_vehicles(ferry->vehicles, ferry->vehicle_count);
+    
+    // Simulate the time it takes to unload
+    int unload_time = ferry->vehicle_count * 500000; // 0.5 seconds per vehicle
+    pthread_mutex_unlock(&ferry->mutex);
+    
+    return unload_time;
+}
+
+/* Unloading time is over - vehicles leave the ferry for their errands */
+void unload_ferry_finish(Ferry* ferry) {
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    
+    CityPart* current_location = ferry->location;
+    int completed_round_trips = 0;
+    
+    // Set up vehicles for their time at the destination
+    for (int i = 0; i < ferry->vehicle_count; i++) {
+        Vehicle* vehicle = ferry->vehicles[i];
+        if (vehicle->is_transported == 1 && vehicle->ready_for_return) {
+            start_vehicle_errand(vehicle, current_location);
+        } else if (vehicle->is_transported == 2) {
+            // Free memory for completed vehicles
+            completed_round_trips++;
+            destroy_vehicle(vehicle);
+        }
+    }
+    
+    // Track total completed round trips once the vehicles have actually left the ferry
+    pthread_mutex_lock(&mutex);
+    total_vehicles_transported += completed_round_trips;
+    pthread_cond_broadcast(&simulation_progress);
+    pthread_mutex_unlock(&mutex);
+    
+    // Reset the ferry - the finished vehicles become transported in the same update group
+    ferry->vehicle_count = 0;
+    ferry->current_load = 0;
+    metric_update_begin();
+    metric_add(&live_metrics.vehicles_transported, completed_round_trips);
+    atomic_store_explicit(&live_metrics.ferry_load[ferry - ferries], 0, memory_order_relaxed);
+    atomic_store_explicit(&live_metrics.ferry_vehicles[ferry - ferries], 0, memory_order_relaxed);
+    metric_update_end();
+    ferry->is_unloading = 0;
+    
+    sim_log(LOG_INFO, LOG_EVENT_UNLOADING, -1, ferry->location->id, -1, "%s has been completely unloaded\n", ferry->name);
+    
+    pthread_mutex_unlock(&ferry->mutex);
+}
+
+/* Handles unloading vehicles at destination */
+void unload_ferry(Ferry* ferry) {
+    platform_sleep_us(unload_ferry_begin(ferry));
+    unload_ferry_finish(ferry);
+}
+
+/* Special case: the first B->A return after the first A->B unloads its vehicles before leaving empty */
+int travel_requires_unload(Ferry* ferry, CityPart* destination) {
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    int is_first_return = (single_origin_fleet && ferry->first_outbound_completed == 1 && 
+                           !ferry->first_return_completed &&
+                           ferry->location->id == ferry->route->ends[1] && destination->id == ferry->route->ends[0]);
+    int requires_unload = is_first_return && ferry->vehicle_count > 0;
+    pthread_mutex_unlock(&ferry->mutex);
+    
+    if (requires_unload) {
+        sim_log(LOG_INFO, LOG_EVENT_UNLOADING, -1, -1, -1, "Unloading vehicles before first empty return trip\n");
+    }
+    return requires_unload;
+}
+
+/* Ferry leaves its current side towards the destination */
+void travel_depart(Ferry* ferry, CityPart* destination) {
+    // Hand the loading slot here to the next docked ferry
+    dispatcher_ferry_departing(ferry, destination);
+    
+    // How long the vehicles aboard waited for this departure since entering the waiting area
+    SimTime departure_time = sim_now();
+    double wait_seconds = 0.0;
+    for (int i = 0; i < ferry->vehicle_count; i++) {
+        const VehicleTiming* timing = ferry->vehicles[i]->timing;
+        wait_seconds += seconds_between(departure_time, ferry->vehicles[i]->is_transported == 0 ?
+                                        timing->waiting_area_time : timing->waiting_area_time_return);
+    }
+    
+    // The first return leaves empty whatever the scheduler said
+    int leaves_for_first_return = single_origin_fleet && ferry->first_outbound_completed == 1 &&
+                                  !ferry->first_return_completed &&
+                                  ferry->location->id == ferry->route->ends[1] &&
+                                  destination->id == ferry->route->ends[0];
+    TripRecord trip = {
+        (int32_t)(ferry - ferries), ferry->vehicle_count, ferry->current_load,
+        (uint8_t)ferry->location->id, (uint8_t)destination->id,
+        (uint8_t)(leaves_for_first_return ? TRIP_REASON_FIRST_RETURN : ferry->depart_reason), 0,
+        (float)seconds_between(departure_time, ferry->docked_time),
+        ferry->vehicle_count > 0 ? (float)seconds_between(departure_time, ferry->first_boarding_time) : 0.0f,
+        0.0f
+    };
+    ferry->departure_time = departure_time;
+    
+    pthread_mutex_lock(&mutex);
+    int trip_number = ++next_trip_number;
+    trip_log_append(&trip);
+    
+    // Utilisation of this crossing under the active loading policy
+    loading_stats.vehicles_departed += ferry->vehicle_count;
+    loading_stats.departure_wait_seconds += wait_seconds;
+    loading_stats.departures++;
+    loading_stats.quota_carried += ferry->current_load;
+    loading_stats.quota_offered += ferry->capacity;
+    if (ferry->vehicle_count > 0) {
+        loading_stats.loaded_departures++;
+    }
+    if (ferry->current_load == ferry->capacity) {
+        loading_stats.full_departures++;
+    }
+    pthread_mutex_unlock(&mutex);
+    
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    
+    ferry->is_moving = 1;
+    ferry->departure_side = ferry->location;
+    ferry->trip_number = trip_number;
+    const char* source_name = ferry->departure_side->name;
+    SideId source_id = ferry->departure_side->id;
+    
+    // Every vehicle aboard travels on this trip
+    for (int i = 0; i < ferry->vehicle_count; i++) {
+        Vehicle* vehicle = ferry->vehicles[i];
+        if (vehicle->is_transported == 0) {
+            vehicle->outbound_trip_number = trip_number;
+        } else {
+            vehicle->return_trip_number = trip_number;
+        }
+    }
+    
+    trace_ferry(TRACE_FERRY_DEPART, ferry, source_id, destination->id);
+    
+    // Special case: First B->A return trip after first A->B
+    int is_first_return = (single_origin_fleet && ferry->first_outbound_completed == 1 && 
+                          !ferry->first_return_completed &&
+                          source_id == ferry->route->ends[1] && destination->id == ferry->route->ends[0]);
+    
+    // Special message for first return trip
+    if (is_first_return) {
+        sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, source_id, -1, "First return trip: %s returning empty from %s to %s\n", 
+               ferry->name, source_name, destination->name);
+        ferry->first_return_completed = 1;  // Mark first return as completed
+    } else {
+        // Normal travel message
+        sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, source_id, -1, "%s departing from %s to %s (Trip #%d)\n", 
+               ferry->name, source_name, destination->name, trip_number);
+    }
+    
+    pthread_mutex_unlock(&ferry->mutex);
+}
+
+/* Ferry reaches the destination and docks there */
+void travel_arrive(Ferry* ferry, CityPart* destination) {
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    
+    const char* source_name = ferry->departure_side->name;
+    
+    // Arrive at destination
+    dock_at(ferry, destination);
+    ferry->is_moving = 0;
+    
+    // Every crossing counts as a completed trip
+    pthread_mutex_lock(&mutex);
+    trip_count++;
+    TripRecord* trip = &trip_log.records[ferry->trip_number - 1];
+    trip->crossing_seconds = (float)seconds_between(sim_now(), ferry->departure_time);
+    trip->arrived = 1;
+    pthread_mutex_unlock(&mutex);
+    metric_add(&live_metrics.trips_completed, 1);
+    ferry->trips_completed++;
+    trace_ferry(TRACE_FERRY_ARRIVE, ferry, destination->id, ferry->departure_side->id);
+    sim_log(LOG_INFO, LOG_EVENT_TRIP, -1, destination->id, -1, "Trip #%d completed: %s -> %s (%s)\n", ferry->trip_number, source_name, destination->name,
+           ferry->name);
+    
+    // Special handling for first A->B trip
+    if (single_origin_fleet && ferry->departure_side->id == ferry->route->ends[0] &&
+        destination->id == ferry->route->ends[1] && !ferry->first_outbound_completed) {
+        ferry->first_outbound_completed = 1;  // Now first trip is complete
+        sim_log(LOG_INFO, LOG_EVENT_TRIP, -1, destination->id, -1, "First outbound trip completed. Vehicles will spend some time at %s before returning.\n", 
+               ferry->location->name);
+    }
+    
+    pthread_mutex_unlock(&ferry->mutex);
+    
+    // Join the ferries docked here (and take the loading slot if it is free)
+    dispatcher_ferry_docked(ferry, destination);
+}
+
+/* Simulate travel time (3-5 seconds), in microseconds */
+int travel_time(Ferry* ferry) {
+    return 3000000 + rng_below(&ferry->rng, 2000000);
+}
+
+/* Handles ferry journey between city sides */
+void travel(Ferry* ferry, CityPart* destination) {
+    // For first return, unload vehicles first before empty return
+    if (travel_requires_unload(ferry, destination)) {
+        unload_ferry(ferry);
+    }
+    
+    travel_depart(ferry, destination);
+    platform_sleep_us(travel_time(ferry));
+    travel_arrive(ferry, destination);
+}
+
+/* Load waiting vehicles chosen by the loading policy - returns how many boarded */
+int load_from_waiting_area(Ferry* ferry, CityPart* location) {
+    SideId heading = route_peer(ferry->route, location)->id;
+    city_lock(location);
+    
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    int unfilled_quota = ferry->capacity - ferry->current_load;
+    pthread_mutex_unlock(&ferry->mutex);
+    
+    int loaded = 0;
+    if (city_has_fitting_vehicle(location, heading, unfilled_quota, 0)) {
+        LoadCandidates candidates;
+        load_candidates_init(&candidates, unfilled_quota);
+        collect_load_candidates(location, heading, &candidates, 0);
+        
+        LoadPlan plan;
+        plan_load(config.loading_policy, &candidates, unfilled_quota, &plan);
+        
+        // Planned vehicles are lane prefixes - board them in arrival order. Each move from
+        // the waiting area to the ferry is one update group for the live metrics
+        Vehicle* vehicle;
+        while ((vehicle = waiting_area_front(&location->waiting_area, heading, plan.take)) != NULL) {
+            metric_update_begin();
+            if (!load_vehicle(ferry, vehicle)) {
+                metric_update_end();
+                break;
+            }
+            waiting_area_pop(&location->waiting_area, heading, vehicle->quota);
+            metric_add(&live_metrics.waiting_area_size[location->id], -1);
+            metric_update_end();
+            plan.take[vehicle->quota]--;
+            loaded++;
+        }
+    }
+    
+    pthread_mutex_unlock(&location->mutex);
+    return loaded;
+}
+
+/* Decides the ferry's next step at its current side */
+FerryAction ferry_decide(Ferry* ferry, CityPart** destination) {
+    // If ferry has vehicles, check if ready to depart
+    if (ferry->vehicle_count > 0 && can_depart(ferry)) {
+        // Determine destination - alternate between the ends of the route
+        *destination = route_peer(ferry->route, ferry->location);
+        return FERRY_ACTION_DEPART;
+    }
+    
+    // Ferry has no vehicles or not ready to depart
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    CityPart* current_location = ferry->location;
+    pthread_mutex_unlock(&ferry->mutex);
+    CityPart* other_location = route_peer(ferry->route, current_location);
+    
+    if (!dispatcher_has_loading_slot(ferry)) {
+        // Another ferry is loading here - go where vehicles wait and no other ferry is serving
+        if (ferry->vehicle_count == 0 && dispatcher_should_reposition(ferry, other_location)) {
+            sim_log(LOG_INFO, LOG_EVENT_DISPATCH, -1, current_location->id, -1, "%s: %s is served by another ferry, repositioning empty to %s\n",
+                   ferry->name, current_location->name, other_location->name);
+            ferry->last_waiting_message = 0;
+            ferry->depart_reason = TRIP_REASON_REPOSITION;
+            *destination = other_location;
+            return FERRY_ACTION_REPOSITION;
+        }
+        
+        SimTime current_time = sim_now();
+        if (ferry->last_waiting_message != 3 || seconds_between(current_time, ferry->last_message_time) >= 5.0) {
+            sim_log(LOG_INFO, LOG_EVENT_DISPATCH, -1, current_location->id, -1, "%s waiting at %s for its turn to load\n", ferry->name, current_location->name);
+            ferry->last_waiting_message = 3;
+            ferry->last_message_time = current_time;
+        }
+        return FERRY_ACTION_IDLE;
+    }
+    
+    city_lock(current_location);
+    int waiting_vehicles = current_location->waiting_area.size_to[other_location->id];
+    pthread_mutex_unlock(&current_location->mutex);
+    
+    if (waiting_vehicles > 0) {
+        // Try to load vehicles from waiting area
+        if (load_from_waiting_area(ferry, current_location) > 0) {
+            // Reset message state since vehicles were loaded
+            ferry->last_waiting_message = 0;
+            return FERRY_ACTION_LOADED;
+        }
+        return FERRY_ACTION_IDLE;
+    }
+    
+    // No waiting vehicles, check other side
+    city_lock(other_location);
+    int other_side_waiting = other_location->waiting_area.size_to[current_location->id];
+    pthread_mutex_unlock(&other_location->mutex);
+    
+    if (ferry->vehicle_count == 0 && other_side_waiting > 0 && dispatcher_should_reposition(ferry, other_location)) {
+        sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, current_location->id, -1, "No vehicles at %s, but %d vehicles waiting at %s. %s departing empty.\n", 
+            current_location->name, other_side_waiting, other_location->name, ferry->name);
+        
+        // Reset message state
+        ferry->last_waiting_message = 0;
+        ferry->depart_reason = TRIP_REASON_REPOSITION;
+        *destination = other_location;
+        return FERRY_ACTION_REPOSITION;
+    }
+    
+    // No vehicles anywhere, just wait
+    SimTime current_time = sim_now();
+    if (ferry->last_waiting_message != 2 || seconds_between(current_time, ferry->last_message_time) >= 5.0) {
+        sim_log(LOG_INFO, LOG_EVENT_DEPARTURE, -1, current_location->id, -1, "%s remains docked at %s - no vehicles to transport\n", ferry->name, current_location->name);
+        ferry->last_waiting_message = 2;
+        ferry->last_message_time = current_time;
+    }
+    return FERRY_ACTION_IDLE;
+}
+
+/* Signals that something affecting the ferry's departure decision has changed */
+void notify_departure_change(Ferry* ferry) {
+    if (config.virtual_clock) {
+        wake_ferry(ferry);
+        return;
+    }
+    
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    ferry->departure_version++;
+    pthread_cond_broadcast(&ferry->departure_changed);
+    pthread_mutex_unlock(&ferry->mutex);
+}
+
+/* Signals every ferry in the fleet */
+void notify_fleet() {
+    for (int i = 0; i < num_ferries; i++) {
+        notify_departure_change(&ferries[i]);
+    }
+}
+
+/* Blocks the idle ferry until its situation changes (versions were read before ferry_decide) */
+void wait_for_ferry_wakeup(Ferry* ferry, CityPart* location, unsigned long waiting_area_version,
+                           unsigned long departure_version) {
+    // The adaptive scheduler also wants to re-check at its departure deadline
+    SimTime wake_time = ferry->depart_deadline;
+    struct timespec deadline;
+    if (wake_time != 0) {
+        SimTime now = sim_now();
+        make_deadline(wake_time > now ? (wake_time - now) / 1000 : 0, &deadline);
+    }
+    
+    if (ferry->last_waiting_message != 0) {
+        // Nothing to transport or no loading slot - changes on either side or in the fleet matter
+        lock_mutex(&ferry->mutex, LOCK_FERRY);
+        while (simulation_running && ferry->departure_version == departure_version &&
+               (wake_time == 0 || sim_now() < wake_time)) {
+            if (wake_time == 0) {
+                pthread_cond_wait(&ferry->departure_changed, &ferry->mutex);
+            } else {
+                pthread_cond_timedwait(&ferry->departure_changed, &ferry->mutex, &deadline);
+            }
+        }
+        pthread_mutex_unlock(&ferry->mutex);
+    } else {
+        // Waiting to fill up here - only arrivals in the local waiting area matter
+        lock_mutex(&location->mutex, LOCK_WAITING_AREA);
+        atomic_fetch_add(&location->waiting_area_sleepers, 1);
+        while (simulation_running && atomic_load(&location->waiting_area_version) == waiting_area_version &&
+               (wake_time == 0 || sim_now() < wake_time)) {
+            if (wake_time == 0) {
+                pthread_cond_wait(&location->waiting_area_changed, &location->mutex);
+            } else {
+                pthread_cond_timedwait(&location->waiting_area_changed, &location->mutex, &deadline);
+            }
+        }
+        atomic_fetch_sub(&location->waiting_area_sleepers, 1);
+        pthread_mutex_unlock(&location->mutex);
+    }
+}
+
+/* Waits out a fixed delay before departure, returning early only for shutdown */
+void ferry_grace_wait(Ferry* ferry, long long delay_us) {
+    struct timespec deadline;
+    make_deadline(delay_us, &deadline);
+    
+    lock_mutex(&ferry->mutex, LOCK_FERRY);
+    while (simulation_running &&
+           pthread_cond_timedwait(&ferry->departure_changed, &ferry->mutex, &deadline) == 0) {
+        // Woken early by a state change - keep waiting until the deadline
+    }
+    pthread_mutex_unlock(&ferry->mutex);
+}
+
+/**
+ * Dispatcher functions implementation
+ * Several ferries of a route may be docked at one of its ends, but only one of them (the
+ * loading ferry) takes vehicles for the route from the waiting area - each berth (route
+ * end) has its own slot, so the routes of a hub load side by side. The slot passes to the
+ * longest-docked ferry of the route when the loading ferry departs. Empty ferries only
+ * reposition to a route end that has waiting vehicles and no ferry of the route already
+ * docked there or on the way.
+ */
+
+/* Records a ferry arriving at a side */
+void dispatcher_ferry_docked(Ferry* ferry, CityPart* city) {
+    SideId berth = route_peer(ferry->route, city)->id;
+    pthread_mutex_lock(&dispatcher.mutex);
+    
+    city->ferries_docked[berth]++;
+    if (city->ferries_inbound[berth] > 0) {
+        city->ferries_inbound[berth]--;
+    }
+    ferry->docked_at = city;
+    ferry->docked_sequence = dispatcher.next_docked_sequence++;
+    
+    int granted = 0;
+    if (city->loading_ferry[berth] == NULL) {
+        city->loading_ferry[berth] = ferry;
+        granted = 1;
+    }
+    
+    pthread_mutex_unlock(&dispatcher.mutex);
+    
+    if (granted && num_ferries > 1) {
+        sim_log(LOG_INFO, LOG_EVENT_DISPATCH, -1, city->id, -1, "Dispatcher: %s is now loading at %s\n", ferry->name, city->name);
+    }
+}
+
+/* Records a ferry leaving its side, handing the loading slot to the next docked ferry */
+void dispatcher_ferry_departing(Ferry* ferry, CityPart* destination) {
+    CityPart* city = ferry->location;
+    Ferry* next = NULL;
+    
+    pthread_mutex_lock(&dispatcher.mutex);
+    
+    city->ferries_docked[destination->id]--;
+    destination->ferries_inbound[city->id]++;
+    ferry->docked_at = NULL;
+    
+    if (city->loading_ferry[destination->id] == ferry) {
+        city->loading_ferry[destination->id] = NULL;
+        
+        // Longest-docked ferry of the route still at this side gets the slot
+        for (int i = 0; i < num_ferries; i++) {
+            Ferry* candidate = &ferries[i];
+            if (candidate->docked_at == city && candidate->route == ferry->route &&
+                (next == NULL || candidate->docked_sequence < next->docked_sequence)) {
+                next = candidate;
+            }
+        }
+        city->loading_ferry[destination->id] = next;
+    }
+    
+    pthread_mutex_unlock(&dispatcher.mutex);
+    
+    if (next) {
+        sim_log(LOG_INFO, LOG_EVENT_DISPATCH, -1, city->id, -1, "Dispatcher: %s is now loading at %s\n", next->name, city->name);
+        notify_departure_change(next);
+    }
+    
+    // Other ferries may now want to reposition (or stop wanting to)
+    for (int i = 0; i < num_ferries; i++) {
+        if (&ferries[i] != ferry && &ferries[i] != next) {
+            notify_departure_change(&ferries[i]);
+        }
+    }
+}
+
+/* 1 if this ferry is the one allowed to load for its route at its current side */
+int dispatcher_has_loading_slot(Ferry* ferry) {
+    pthread_mutex_lock(&dispatcher.mutex);
+    CityPart* city = ferry->docked_at;
+    int has_slot = (city != NULL && city->loading_ferry[route_peer(ferry->route, city)->id] == ferry);
+    pthread_mutex_unlock(&dispatcher.mutex);
+    return has_slot;
+}
+
+/* 1 if an empty ferry should cross to the destination to pick up its waiting vehicles */
+int dispatcher_should_reposition(Ferry* ferry, CityPart* destination) {
+    SideId berth = route_peer(ferry->route, destination)->id;
+    city_lock(destination);
+    int waiting = destination->waiting_area.size_to[berth];
+    pthread_mutex_unlock(&destination->mutex);
+    
+    if (waiting == 0) {
+        return 0;
+    }
+    
+    pthread_mutex_lock(&dispatcher.mutex);
+    int covered = (destination->ferries_docked[berth] > 0 || destination->ferries_inbound[berth] > 0);
+    pthread_mutex_unlock(&dispatcher.mutex);
+    
+    return !covered;
+}
+
+/* The ferry operates as an independent thread */
+void* ferry_operation(void* arg) {
+    Ferry* ferry = (Ferry*)arg;
+    ferry->is_running = 1;
+    
+    while (simulation_running) {
+        CityPart* destination = NULL;
+        
+        // Remember the current state versions so no change is missed while deciding
+        lock_mutex(&ferry->mutex, LOCK_FERRY);
+        CityPart* location = ferry->location;
+        unsigned long departure_version = ferry->departure_version;
+        pthread_mutex_unlock(&ferry->mutex);
+        
+        unsigned long waiting_area_version = atomic_load(&location->waiting_area_version);
+        
+        switch (ferry_decide(ferry, &destination)) {
+            case FERRY_ACTION_DEPART:
+                // Small delay for any last-minute vehicles
+                ferry_grace_wait(ferry, departure_grace_us());
+                
+                // Double-check status in case something changed
+                if (ferry->vehicle_count > 0 && can_depart(ferry)) {
+                    // Travel to destination
+                    travel(ferry, destination);
+                    
+                    // First trip logic handled in travel function
+                    
+                    // Unload vehicles at destination
+                    unload_ferry(ferry);
+                    
+                    // Reset message state since ferry moved
+                    ferry->last_waiting_message = 0;
+                }
+                break;
+            case FERRY_ACTION_LOADED:
+                break;
+            case FERRY_ACTION_REPOSITION:
+                travel(ferry, destination);
+                break;
+            case FERRY_ACTION_IDLE:
+                // Block until something changes instead of polling
+                wait_for_ferry_wakeup(ferry, location, waiting_area_version, departure_version);
+                break;
+        }
+    }
+    
+    ferry->is_running = 0;
+    return NULL;
+}
+
+/**
+ * Discrete-event engine implementation (virtual clock mode)
+ * Each delay of the threaded simulation is an event on a simulated timeline.
+ * The clock jumps straight from one event to the next, so no time is spent sleeping.
+ */
+
+/* Orders events by fire time, then by scheduling order */
+int event_before(const SimEvent* a, const SimEvent* b) {
+    if (a->time_us != b->time_us) {
+        return a->time_us < b->time_us;
+    }
+    return a->sequence < b->sequence;
+}
+
+/* Adds an event that fires delay_us microseconds from the current simulated time */
+void schedule_event(EventType type, long long delay_us, Vehicle* vehicle, CityPart* city,
+                    TollBooth* booth, Ferry* ferry, int flag) {
+    EventCalendar* calendar = &event_calendar;
+    
+    if (calendar->size == calendar->capacity) {
+        int new_capacity = calendar->capacity ? calendar->capacity * 2 : 64;
+        SimEvent* events = (SimEvent*)realloc(calendar->events, new_capacity * sizeof(SimEvent));
+        if (!events) {
+            perror("Failed to allocate memory for event calendar");
+            exit(EXIT_FAILURE);
+        }
+        calendar->events = events;
+        calendar->capacity = new_capacity;
+    }
+    
+    SimEvent event;
+    event.time_us = virtual_clock_us + delay_us;
+    event.sequence = calendar->next_sequence++;
+    event.type = type;
+    event.vehicle = vehicle;
+    event.city = city;
+    event.booth = booth;
+    event.ferry = ferry;
+    event.flag = flag;
+    
+    // Sift up to restore the heap property
+    int i = calendar->size++;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!event_before(&event, &calendar->events[parent])) break;
+        calendar->events[i] = calendar->events[parent];
+        i = parent;
+    }
+    calendar->events[i] = event;
+}
+
+/* Removes the earliest event from the calendar - returns 0 when the calendar is empty */
+int next_event(SimEvent* out) {
+    EventCalendar* calendar = &event_calendar;
+    
+    if (calendar->size == 0) {
+        return 0;
+    }
+    
+    *out = calendar->events[0];
+    SimEvent last = calendar->events[--calendar->size];
+    
+    // Sift the last event down from the root
+    int i = 0;
+    for (;;) {
+        int child = 2 * i + 1;
+        if (child >= calendar->size) break;
+        if (child + 1 < calendar->size && event_before(&calendar->events[child + 1], &calendar->events[child])) {
+            child++;
+        }
+        if (!event_before(&calendar->events[child], &last)) break;
+        calendar->events[i] = calendar->events[child];
+        i = child;
+    }
+    if (calendar->size > 0) {
+        calendar->events[i] = last;
+    }
+    return 1;
+}
+
+/* Puts every free booth of a side to work on the next queued vehicle */
+void dispatch_toll_booths(CityPart* city) {
+    lock_mutex(&city->queue_mutex, LOCK_TOLL_QUEUE);
+    toll_booth_scale(city, sim_now());
+    
+    for (int i = 0; i < city->num_booths; i++) {
+        TollBooth* booth = &city->booths[i];
+        Vehicle* vehicle = toll_booth_take_vehicle(city, booth);
+        if (vehicle) {
+            schedule_event(EVENT_BOOTH_DONE, toll_processing_time(booth), vehicle, city, booth, NULL, 0);
+        }
+    }
+    
+    pthread_mutex_unlock(&city->queue_mutex);
+}
+
+/* Lets an idle ferry re-evaluate after something changed at the sides */
+void wake_ferry(Ferry* ferry) {
+    if (!ferry->event_pending) {
+        ferry->event_pending = 1;
+        schedule_event(EVENT_FERRY_WAKE, 0, NULL, NULL, NULL, ferry, 0);
+    }
+}
+
+/* Starts a crossing, unloading first when the first empty return requires it */
+void start_ferry_crossing(Ferry* ferry, CityPart* destination, int unload_on_arrival) {
+    if (travel_requires_unload(ferry, destination)) {
+        schedule_event(EVENT_FERRY_UNLOADED, unload_ferry_begin(ferry), NULL, destination, NULL, ferry,
+                       unload_on_arrival);
+        return;
+    }
+    
+    travel_depart(ferry, destination);
+    schedule_event(EVENT_FERRY_ARRIVE, travel_time(ferry), NULL, destination, NULL, ferry, unload_on_arrival);
+}
+
+/* Same decisions as ferry_operation, but delays are scheduled instead of slept */
+void step_ferry(Ferry* ferry) {
+    for (;;) {
+        CityPart* destination = NULL;
+        
+        switch (ferry_decide(ferry, &destination)) {
+            case FERRY_ACTION_DEPART:
+                // Small delay for any last-minute vehicles
+                ferry->event_pending = 1;
+                schedule_event(EVENT_FERRY_DEPART, departure_grace_us(), NULL, destination, NULL, ferry, 0);
+                return;
+            case FERRY_ACTION_LOADED:
+                continue;
+            case FERRY_ACTION_REPOSITION:
+                ferry->event_pending = 1;
+                start_ferry_crossing(ferry, destination, 0);
+                return;
+            case FERRY_ACTION_IDLE:
+                // Woken again by the next arrival at a queue or waiting area
+                return;
+        }
+    }
+}
+
+/* Applies one event to the simulation state */
+void handle_event(SimEvent* event) {
+    Ferry* event_ferry = event->ferry;
+    
+    switch (event->type) {
+        case EVENT_BOOTH_DONE:
+            toll_booth_release_vehicle(event->city, event->booth, event->vehicle);
+            dispatch_toll_booths(event->city);
+            notify_fleet();
+            break;
+            
+        case EVENT_ERRAND_DONE:
+            complete_vehicle_errand(event->vehicle, event->city, event->vehicle->errand_time);
+            dispatch_toll_booths(event->city);
+            notify_fleet();
+            break;
+            
+        case EVENT_FERRY_WAKE:
+            event_ferry->event_pending = 0;
+            step_ferry(event_ferry);
+            break;
+            
+        case EVENT_FERRY_DEPART:
+            // Double-check status in case something changed
+            if (event_ferry->vehicle_count > 0 && can_depart(event_ferry)) {
+                start_ferry_crossing(event_ferry, event->city, 1);
+            } else {
+                event_ferry->event_pending = 0;
+                step_ferry(event_ferry);
+            }
+            break;
+            
+        case EVENT_FERRY_ARRIVE:
+            travel_arrive(event_ferry, event->city);
+            if (event->flag) {
+                // Unload vehicles at destination
+                event_ferry->last_waiting_message = 0;
+                schedule_event(EVENT_FERRY_UNLOADED, unload_ferry_begin(event_ferry), NULL, NULL, NULL,
+                               event_ferry, 0);
+            } else {
+                event_ferry->event_pending = 0;
+                step_ferry(event_ferry);
+            }
+            break;
+            
+        case EVENT_FERRY_UNLOADED:
+            unload_ferry_finish(event_ferry);
+            if (event->city) {
+                // Unloading before the first empty return - now cross
+                travel_depart(event_ferry, event->city);
+                schedule_event(EVENT_FERRY_ARRIVE, travel_time(event_ferry), NULL, event->city, NULL, event_ferry,
+                               event->flag);
+            } else {
+                event_ferry->event_pending = 0;
+                step_ferry(event_ferry);
+            }
+            break;
+            
+        case EVENT_ARRIVAL:
+            inject_arrival(event->city->id, (VehicleType)event->flag);
+            dispatch_toll_booths(event->city);
+            notify_fleet();
+            arrivals_schedule_next();
+            break;
+            
+        case EVENT_FERRY_DEADLINE:
+            // Stale once the ferry moved on or set a newer deadline
+            if (!event_ferry->event_pending && event->flag == event_ferry->deadline_generation &&
+                event_ferry->depart_deadline != 0) {
+                step_ferry(event_ferry);
+            }
+            break;
+    }
+}
+
+/* Announces that no vehicle is left to transport */
+void log_fleet_finished() {
+    if (vehicles_dropped > 0) {
+        sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "\nAll %d vehicles have been transported or dropped (%d dropped)!\n",
+                total_fleet_size(), vehicles_dropped);
+    } else {
+        sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "\nAll %d vehicles have been transported!\n", total_fleet_size());
+    }
+}
+
+/* Runs the simulation on the virtual clock until all vehicles are transported or time runs out */
+void run_discrete_event_simulation(int simulation_time) {
+    int resumed = config.resume_file[0] != '\0';
+    simulation_running = 1;
+    if (!resumed) {
+        virtual_clock_us = 0;
+    }
+    start_time = 0; // The timeline starts at zero - a resumed run goes on from its checkpoint
+    
+    long long max_end_us = simulation_time * 1000000LL;
+    long long checkpoint_interval_us = config.checkpoint_file[0] ? config.checkpoint_interval * 1000000LL : 0;
+    long long next_checkpoint_us = checkpoint_interval_us > 0 ?
+                                   (virtual_clock_us / checkpoint_interval_us + 1) * checkpoint_interval_us : max_end_us;
+    sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Simulation running on virtual clock (max %d simulated seconds)...\n", simulation_time);
+    
+    // Monitor transportation progress
+    int all_vehicles_transported = 0;
+    
+    // Initial vehicles are already queued - get booths and ferry going. A resumed run has
+    // its pending events back on the calendar instead
+    if (!resumed) {
+        for (int side = 0; side < num_terminals; side++) {
+            dispatch_toll_booths(&city_parts[side]);
+        }
+        notify_fleet();
+        if (streaming_arrivals()) {
+            arrivals_schedule_next();
+        }
+    }
+    
+    stats_start();
+    
+    SimEvent event;
+    while (!all_vehicles_transported && event_calendar.size > 0) {
+        // Events past the limit stay on the calendar - a checkpoint keeps them for a longer run
+        long long due_us = event_calendar.events[0].time_us;
+        if (due_us >= max_end_us) {
+            break;
+        }
+        
+        // Everything before the checkpoint time has happened, nothing after it
+        if (due_us >= next_checkpoint_us) {
+            checkpoint_write_interval(next_checkpoint_us);
+            while (next_checkpoint_us <= due_us) {
+                next_checkpoint_us += checkpoint_interval_us;
+            }
+        }
+        next_event(&event);
+        
+        // Advance the clock straight to the next event
+        virtual_clock_us = event.time_us;
+        atomic_store_explicit(&live_metrics.clock_ns, event.time_us * 1000, memory_order_relaxed);
+        handle_event(&event);
+        
+        if (fleet_remaining() <= 0) {
+            all_vehicles_transported = 1;
+            log_fleet_finished();
+        }
+    }
+    
+    if (!all_vehicles_transported) {
+        // Nothing left that could happen before the limit - the rest of the run is idle time
+        virtual_clock_us = max_end_us;
+        atomic_store_explicit(&live_metrics.clock_ns, max_end_us * 1000, memory_order_relaxed);
+        sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "\nSimulation time limit reached.\n");
+    }
+    if (config.checkpoint_file[0]) {
+        checkpoint_write(config.checkpoint_file);
+    }
+    
+    simulation_running = 0;
+    end_time = sim_now();
+    stats_stop();
+    generate_report();
+}
+
+/**
+ * Main function
+ */
+/**
+ * Simulation functions implementation
+ */
+
+/* Sets up the simulation environment */
+void initialize_simulation() {
+    // The simulated timeline starts at zero
+    if (config.virtual_clock) {
+        virtual_clock_us = 0;
+    }
+    platform_cond_init(&simulation_progress);
+    pinned_threads = 0;
+    
+    // One arena block holds the whole fleet, hot and cold parts. Streaming arrivals only
+    // reserve one batch - the pool grows to the most vehicles ever in flight at once
+    int reserved = streaming_arrivals() && total_fleet_size() > VEHICLE_POOL_BATCH ? VEHICLE_POOL_BATCH : total_fleet_size();
+    arena_init(ARENA_ROUND(reserved * sizeof(VehicleSlot)) + ARENA_ROUND(reserved * sizeof(VehicleTiming)));
+    vehicle_pool_reserve(reserved);
+    
+    // Initialize the network and its terminals
+    build_network(config.num_terminals, config.topology);
+    for (int side = 0; side < num_terminals; side++) {
+        initialize_city_part(&city_parts[side], side_names[side], (SideId)side);
+    }
+    if (streaming_arrivals()) {
+        arrivals_init();
+    }
+    
+    // Initialize the fleet
+    num_ferries = config.num_ferries;
+    ferries = (Ferry*)malloc(num_ferries * sizeof(Ferry));
+    if (!ferries) {
+        perror("Failed to allocate memory for ferries");
+        exit(EXIT_FAILURE);
+    }
+    live_metrics_init();
+    for (int i = 0; i < num_ferries; i++) {
+        char name[MAX_NAME_LENGTH];
+        snprintf(name, sizeof(name), "Ferry_%d", i + 1);
+        initialize_ferry(&ferries[i], name, config.ferry_capacity, &routes[i % num_routes]);
+    }
+    
+    // Report aggregates
+    memset(&transport_stats, 0, sizeof(transport_stats));
+    recorded_vehicle_count = 0;
+    
+    // A resumed run finds its ferries where the checkpoint left them
+    if (config.resume_file[0]) {
+        return;
+    }
+    
+    // Randomly choose starting side (equal chance each)
+    CityPart* starting_side = &city_parts[rng_below(&setup_rng, num_terminals)];
+    
+    // Ferries are dealt out to the routes in turn. On each route the first ferry starts at
+    // the starting side (or the route's first end if it does not touch it), the rest
+    // alternate between the ends
+    for (int i = 0; i < num_ferries; i++) {
+        const Route* route = ferries[i].route;
+        CityPart* first_end = route->ends[1] == starting_side->id ? starting_side : &city_parts[route->ends[0]];
+        CityPart* side = (i / num_routes % 2 == 0) ? first_end : route_peer(route, first_end);
+        dock_at(&ferries[i], side);
+        dispatcher_ferry_docked(&ferries[i], side);
+    }
+    
+    sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, starting_side->id, -1, "Simulation initialized. %s starts at %s\n", ferries[0].name, starting_side->name);
+}
+
+/* Creates the initial set of vehicles. On the two-terminal route they all start at the
+ * ferry's initial location; in a larger network they are spread over the terminals in
+ * turn, each bound for a random neighbour of its start. With streaming arrivals nothing
+ * is created here - the generator brings the vehicles in during the run */
+void create_vehicles() {
+    int id = 1;
+    
+    if (streaming_arrivals()) {
+        single_origin_fleet = 0;
+        if (config.arrival_file[0]) {
+            sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Vehicles arrive as recorded in %s\n", config.arrival_file);
+        } else {
+            sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Vehicles arrive at every terminal at %d per hour\n", config.arrival_rate);
+        }
+        return;
+    }
+    
+    // All vehicles start at ferry's initial location
+    CityPart* starting_side = ferries[0].location;
+    int spread = num_terminals == 2 ? 1 : num_terminals;
+    single_origin_fleet = spread == 1 && config.departure_policy == DEPARTURE_RULES;
+    
+    if (spread == 1) {
+        sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, starting_side->id, -1, "Creating vehicles at %s (ferry's starting location)\n", starting_side->name);
+    } else {
+        sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Creating vehicles across %d terminals (%d routes)\n", num_terminals, num_routes);
+    }
+    
+    // Cars, then minibuses, then trucks
+    const int counts[TRUCK + 1] = { 0, config.num_cars, config.num_minibuses, config.num_trucks };
+    for (int type = CAR; type <= TRUCK; type++) {
+        for (int i = 0; i < counts[type]; i++) {
+            Vehicle* vehicle = create_vehicle(id, (VehicleType)type);
+            CityPart* origin = &city_parts[(starting_side->id + (id - 1) % spread) % num_terminals];
+            id++;
+            vehicle->origin_side = origin->id;
+            vehicle->current_side = origin->id;
+            vehicle->destination_side = pick_destination(&setup_rng, origin->id);
+            add_vehicle_to_queue(origin, vehicle);
+        }
+    }
+    
+    // Randomize queue order for realistic simulation (Fisher-Yates shuffle)
+    for (int side = 0; side < num_terminals; side++) {
+        CityPart* city = &city_parts[side];
+        lock_mutex(&city->queue_mutex, LOCK_TOLL_QUEUE);
+        for (int i = city->vehicle_queue.size - 1; i > 0; i--) {
+            int j = rng_below(&setup_rng, i + 1);
+            vehicle_queue_swap(&city->vehicle_queue, i, j);
+        }
+        pthread_mutex_unlock(&city->queue_mutex);
+        
+        if (city->vehicle_queue.size > 0) {
+            sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, city->id, -1, "Created and randomized %d vehicles at %s\n", city->vehicle_queue.size, city->name);
+        }
+    }
+}
+
+/* Runs the simulation for specified time or until all vehicles are transported */
+void run_simulation(int simulation_time) {
+    if (config.virtual_clock) {
+        run_discrete_event_simulation(simulation_time);
+        return;
+    }
+    
+    simulation_running = 1;
+    start_time = sim_now();
+    
+    // Start the errand worker pool and toll booth threads
+    errand_timer_start(config.errand_workers);
+    for (int side = 0; side < num_terminals; side++) {
+        start_toll_booths(&city_parts[side]);
+    }
+    
+    // Start one thread per ferry
+    for (int i = 0; i < num_ferries; i++) {
+        platform_thread_create(&ferries[i].thread, ferry_operation, &ferries[i], pinned_thread_cpu());
+    }
+    if (streaming_arrivals()) {
+        arrivals_start();
+    }
+    
+    stats_start();
+    
+    // Calculate the maximum end time
+    SimTime max_end_time = start_time + simulation_time * NS_PER_SECOND;
+    sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Simulation running (max %d seconds)...\n", simulation_time);
+    if (config.pin_threads) {
+        if (platform_pinned_cpu(0) < 0) {
+            sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Thread pinning is not supported on this platform - threads run unpinned\n");
+        } else {
+            sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Booth and ferry threads pinned to the CPUs in turn (%d available)\n", platform_cpu_count());
+        }
+    }
+    
+    // Monitor transportation progress
+    int all_vehicles_transported = 0;
+    
+    // Sleep until the ferry reports progress (unload_ferry signals) or the time limit is reached
+    struct timespec deadline;
+    make_deadline(simulation_time * 1000000LL, &deadline);
+    pthread_mutex_lock(&mutex);
+    while (fleet_remaining() > 0 && sim_now() < max_end_time) {
+        pthread_cond_timedwait(&simulation_progress, &mutex, &deadline);
+    }
+    if (fleet_remaining() <= 0) {
+        all_vehicles_transported = 1;
+        log_fleet_finished();
+    }
+    pthread_mutex_unlock(&mutex);
+    
+    if (all_vehicles_transported) {
+        // Check if there are no vehicles left anywhere - a snapshot of the live counters, no locks needed
+        MetricsSnapshot snapshot;
+        metrics_snapshot_init(&snapshot);
+        metrics_snapshot(&snapshot);
+        int vehicles_remaining = 0;
+        for (int side = 0; side < num_terminals; side++) {
+            vehicles_remaining += snapshot.queue_depth[side] + snapshot.waiting_area_size[side] +
+                                  snapshot.booths_busy[side];
+        }
+        for (int i = 0; i < num_ferries; i++) {
+            vehicles_remaining += snapshot.ferry_vehicles[i];
+        }
+        metrics_snapshot_destroy(&snapshot);
+        
+        if (vehicles_remaining == 0) {
+            sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "\nAll vehicles processed, no vehicles remaining in the system!\n");
+        }
+    } else {
+        sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "\nSimulation time limit reached.\n");
+    }
+    
+    // Stop the simulation and wake every blocked thread so it can see the flag
+    simulation_running = 0;
+    if (streaming_arrivals()) {
+        arrivals_stop();
+    }
+    for (int side = 0; side < num_terminals; side++) {
+        wake_city_waiters(&city_parts[side]);
+    }
+    notify_fleet();
+    
+    // Wait for threads to finish
+    sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Stopping all threads...\n");
+    for (int i = 0; i < num_ferries; i++) {
+        pthread_join(ferries[i].thread, NULL);
+    }
+    for (int side = 0; side < num_terminals; side++) {
+        for (int i = 0; i < city_parts[side].num_booths; i++) {
+            pthread_join(city_parts[side].booths[i].thread, NULL);
+        }
+    }
+    errand_timer_stop();
+    
+    end_time = sim_now();
+    stats_stop();
+    generate_report();
+}
+
+/* Generate a detailed statistical report after the simulation completes */
+void generate_report() {
+    // The report goes straight to stdout - let the writer catch up first so it comes last
+    log_flush();
+    
+    // Exported even in silent mode - that is what benchmark runs read
+    if (config.latency_export[0]) {
+        export_latency_stats(config.latency_export);
+    }
+    if (config.trip_export[0]) {
+        export_trip_log(config.trip_export);
+    }
+    if (!log_enabled(LOG_SUMMARY)) {
+        return;
+    }
+    
+    double duration = seconds_between(end_time, start_time);
+    
+    // Vehicles still in the booth handoff belong to the waiting area
+    for (int side = 0; side < num_terminals; side++) {
+        city_lock(&city_parts[side]);
+        pthread_mutex_unlock(&city_parts[side].mutex);
+    }
+    
+    // Count remaining vehicles at each location
+    int side_vehicles = 0;
+    for (int side = 0; side < num_terminals; side++) {
+        side_vehicles += city_parts[side].vehicle_queue.size + city_parts[side].waiting_area.size;
+    }
+    int ferry_vehicles = 0;
+    for (int f = 0; f < num_ferries; f++) {
+        ferry_vehicles += ferries[f].vehicle_count;
+    }
+    
+    // Count remaining vehicles by type
+    int remaining_cars = 0;
+    int remaining_minibuses = 0;
+    int remaining_trucks = 0;
+    
+    // Terminals
+    for (int side = 0; side < num_terminals; side++) {
+        CityPart* city = &city_parts[side];
+        for (int heading = 0; heading < num_terminals; heading++) {
+            remaining_cars += atomic_load(&city->queued_by_quota[heading][CAR]);
+            remaining_minibuses += atomic_load(&city->queued_by_quota[heading][MINIBUS]);
+            remaining_trucks += atomic_load(&city->queued_by_quota[heading][TRUCK]);
+            remaining_cars += city->waiting_area.lanes[heading][CAR].size;
+            remaining_minibuses += city->waiting_area.lanes[heading][MINIBUS].size;
+            remaining_trucks += city->waiting_area.lanes[heading][TRUCK].size;
+        }
+    }
+    
+    // Ferries
+    for (int f = 0; f < num_ferries; f++) {
+        for (int i = 0; i < ferries[f].vehicle_count; i++) {
+            switch (ferries[f].vehicles[i]->type) {
+                case CAR: remaining_cars++; break;
+                case MINIBUS: remaining_minibuses++; break;
+                case TRUCK: remaining_trucks++; break;
+            }
+        }
+    }
+    
+    // Not arrived yet (streaming arrivals)
+    remaining_cars += arrivals_pending(CAR);
+    remaining_minibuses += arrivals_pending(MINIBUS);
+    remaining_trucks += arrivals_pending(TRUCK);
+    
+    // Calculate statistics
+    int total_initial_vehicles = total_fleet_size();
+    double completion_percentage = ((double)total_vehicles_transported / total_initial_vehicles) * 100.0;
+    
+    // Calculate transported by type
+    int initial_cars = config.num_cars;
+    int initial_minibuses = config.num_minibuses;
+    int initial_trucks = config.num_trucks;
+    
+    int transported_cars = initial_cars - remaining_cars - vehicles_dropped_by_type[CAR];
+    int transported_minibuses = initial_minibuses - remaining_minibuses - vehicles_dropped_by_type[MINIBUS];
+    int transported_trucks = initial_trucks - remaining_trucks - vehicles_dropped_by_type[TRUCK];
+    
+    printf("\n======================== FERRY SIMULATION REPORT ========================\n");
+    printf("Total simulation time: %.3f seconds\n", duration);
+    printf("Number of trips completed: %d\n", trip_count);
+    
+    printf("\nTransported Vehicles:\n");
+    printf("  Total: %d / %d vehicles (%.1f%%)\n", 
+           total_vehicles_transported, total_initial_vehicles, completion_percentage);
+    printf("  Cars: %d / %d vehicles\n", transported_cars, initial_cars);
+    printf("  Minibuses: %d / %d vehicles\n", transported_minibuses, initial_minibuses);
+    printf("  Trucks: %d / %d vehicles\n", transported_trucks, initial_trucks);
+    if (vehicles_dropped > 0) {
+        printf("  Dropped (toll queue or waiting area full): %d (cars: %d, minibuses: %d, trucks: %d)\n",
+               vehicles_dropped, vehicles_dropped_by_type[CAR], vehicles_dropped_by_type[MINIBUS],
+               vehicles_dropped_by_type[TRUCK]);
+    }
+    
+    printf("\nRemaining Vehicles:\n");
+    printf("  Total remaining vehicles: %d\n", side_vehicles + ferry_vehicles);
+    for (int side = 0; side < num_terminals; side++) {
+        CityPart* city = &city_parts[side];
+        printf("  Waiting at %s: %d (in queue: %d, in waiting area: %d)\n", city->name,
+               city->vehicle_queue.size + city->waiting_area.size, city->vehicle_queue.size, city->waiting_area.size);
+    }
+    printf("  On ferries: %d\n", ferry_vehicles);
+    if (streaming_arrivals()) {
+        printf("  Yet to arrive: %d\n", arrivals_pending(CAR) + arrivals_pending(MINIBUS) + arrivals_pending(TRUCK));
+    }
+    
+    printf("\nFerry Fleet:\n");
+    for (int f = 0; f < num_ferries; f++) {
+        printf("  %s: %d trips, %d vehicles carried, %d on board, now at %s\n",
+               ferries[f].name, ferries[f].trips_completed, ferries[f].vehicles_carried,
+               ferries[f].vehicle_count, ferries[f].location->name);
+    }
+    
+    printf("\nToll Booths:\n");
+    double total_booth_hours = 0.0;
+    for (int side = 0; side < num_terminals; side++) {
+        CityPart* city = &city_parts[side];
+        double booth_seconds = 0.0;
+        for (int i = 0; i < city->num_booths; i++) {
+            booth_seconds += booth_open_seconds(&city->booths[i], end_time);
+        }
+        total_booth_hours += booth_seconds / 3600.0;
+        printf("  %s: %.3f booth-hours, %d of %d open at the end (peak %d), %d opened / %d closed\n",
+               city->name, booth_seconds / 3600.0, city->open_booths, city->num_booths, city->peak_open_booths,
+               city->booth_openings, city->booth_closings);
+    }
+    printf("  Total: %.3f booth-hours\n", total_booth_hours);
+    
+    int remaining_quotas = (remaining_cars * 1) + (remaining_minibuses * 2) + (remaining_trucks * 3);
+    int transported_quotas = (transported_cars * 1) + (transported_minibuses * 2) + (transported_trucks * 3);
+    int total_quotas = (initial_cars * 1) + (initial_minibuses * 2) + (initial_trucks * 3);
+    
+    printf("\nQuota Usage:\n");
+    printf("  Total quotas transported: %d / %d (%.1f%%)\n", 
+           transported_quotas, total_quotas, ((double)transported_quotas / total_quotas) * 100.0);
+    printf("  Total remaining quotas: %d / %d\n", remaining_quotas, total_quotas);
+    
+    printf("\nFerry Utilisation (loading policy: %s):\n", loading_policy_names[config.loading_policy]);
+    printf("  Departures: %d (%d with vehicles, %d at full capacity)\n",
+           loading_stats.departures, loading_stats.loaded_departures, loading_stats.full_departures);
+    if (loading_stats.departures > 0) {
+        printf("  Average utilisation per trip: %.1f%%\n",
+               (double)loading_stats.quota_carried / loading_stats.quota_offered * 100.0);
+    }
+    if (loading_stats.loaded_departures > 0) {
+        printf("  Average utilisation per loaded trip: %.1f%%\n",
+               (double)loading_stats.quota_carried /
+               ((double)loading_stats.quota_offered / loading_stats.departures * loading_stats.loaded_departures) * 100.0);
+    }
+    
+    printf("\nDeparture Scheduling (policy: %s", departure_policy_names[config.departure_policy]);
+    if (config.departure_policy == DEPARTURE_ADAPTIVE) {
+        printf(", latency budget %d s", config.latency_budget);
+    }
+    printf("):\n");
+    if (loading_stats.vehicles_departed > 0) {
+        printf("  Mean vehicle wait from waiting area to departure: %.3f seconds\n",
+               loading_stats.departure_wait_seconds / loading_stats.vehicles_departed);
+    }
+    if (loading_stats.departures > 0) {
+        printf("  Against a mean ferry utilisation of %.1f%% over %d departures\n",
+               (double)loading_stats.quota_carried / loading_stats.quota_offered * 100.0, loading_stats.departures);
+    }
+    
+    print_trip_report();
+    
+    // Show detailed vehicle statistics if any were transported
+    const TransportStats* stats = &transport_stats;
+    if (stats->outbound.count > 0) {
+        // Sort vehicles by ID for nice output
+        qsort(vehicle_records, recorded_vehicle_count, sizeof(VehicleRecord), compare_records_by_id);
+        
+        printf("\n==================== DETAILED VEHICLE STATISTICS ====================\n");
+        printf("+----+----------+---------+-------------+-------------+-------------+------------+-------------+\n");
+        printf("| ID | Type     | Origin  | Outbound(s) | Return(s)   | At Dest.(s) | Trip #     | Status      |\n");
+        printf("+----+----------+---------+-------------+-------------+-------------+------------+-------------+\n");
+        
+        for (int i = 0; i < recorded_vehicle_count; i++) {
+            VehicleRecord* v = &vehicle_records[i];
             
-        // Outbound journey stats
-        record->outbound_queue_time = safe_difftime(vehicle->toll_entry_time, vehicle->arrival_time);
-        record->outbound_journey_time = safe_difftime(vehicle->unload_time, vehicle->arrival_time);
-        record->outbound_trip_number = vehicle->outbound_trip_number;
+            printf("| %2d | %-8s | %-7s | %11.3f | %11.3f | %11.1f | %2d → %-5d | %-11s |\n",
+                v->id, vehicle_type_names[v->type], city_parts[v->origin_side].name, 
+                v->outbound_journey_time, v->return_journey_time, v->time_at_destination,
+                v->outbound_trip_number, v->return_trip_number,
+                v->completed_round_trip ? "Round trip" : "One-way");
+            
+            // Print a separator line after each vehicle
+            printf("+----+----------+---------+-------------+-------------+-------------+------------+-------------+\n");
+        }
+        if (stats->outbound.count > recorded_vehicle_count) {
+            printf("  First %d of %lld vehicles shown - the figures below cover all of them\n",
+                   recorded_vehicle_count, stats->outbound.count);
+        }
         
-        // Return journey stats (if completed)
-        if (vehicle->is_transported == 2) {
-            // Initialize with arrival time if not set
-            if (vehicle->arrival_time_return == 0)
-                vehicle->arrival_time_return = vehicle->unload_time + 1;  // At least 1 second later
-            if (vehicle->boarding_time_return == 0)
-                vehicle->boarding_time_return = vehicle->arrival_time_return;
-            if (vehicle->complete_time == 0)
-                vehicle->complete_time = vehicle->boarding_time_return;
-                
-            // Ensure return timestamps are in correct chronological order
-            if (vehicle->arrival_time_return < vehicle->unload_time)
-                vehicle->arrival_time_return = vehicle->unload_time + 1;  // At least 1 second later
-            if (vehicle->boarding_time_return < vehicle->arrival_time_return)
-                vehicle->boarding_time_return = vehicle->arrival_time_return;
-            if (vehicle->complete_time < vehicle->boarding_time_return)
-                vehicle->complete_time = vehicle->boarding_time_return;
-                    
-            record->return_queue_time = safe_difftime(vehicle->boarding_time_return, vehicle->arrival_time_return);
-            record->return_journey_time = safe_difftime(vehicle->complete_time, vehicle->arrival_time_return);
-            record->return_trip_number = vehicle->return_trip_number;
-            record->total_round_trip_time = safe_difftime(vehicle->complete_time, vehicle->arrival_time);
+        printf("\nAverage Transport Times:\n");
+        printf("  All vehicles (outbound): %.3f seconds\n", running_stat_mean(&stats->outbound));
+        
+        if (stats->round_trip.count > 0) {
+            printf("  All vehicles (return): %.3f seconds\n", running_stat_mean(&stats->return_journey));
+            printf("  All vehicles (round trip): %.3f seconds (min %.3f, max %.3f)\n",
+                   running_stat_mean(&stats->round_trip), stats->round_trip.min, stats->round_trip.max);
+        }
+        
+        const char* type_labels[TRUCK + 1] = { NULL, "Cars", "Minibuses", "Trucks" };
+        for (int type = CAR; type <= TRUCK; type++) {
+            if (stats->outbound_by_type[type].count > 0) {
+                printf("  %s (outbound): %.3f seconds\n", type_labels[type],
+                       running_stat_mean(&stats->outbound_by_type[type]));
+            }
+        }
+        
+        if (num_terminals > 2 || streaming_arrivals()) {
+            printf("\nRound Trips by Origin:\n");
+            for (int side = 0; side < num_terminals; side++) {
+                const RunningStat* origin = &stats->round_trip_by_side[side];
+                if (origin->count > 0) {
+                    printf("  %s: %lld vehicles, %.3f seconds (min %.3f, max %.3f)\n", city_parts[side].name,
+                           origin->count, running_stat_mean(origin), origin->min, origin->max);
+                }
+            }
+        }
             
-            record->time_at_destination = vehicle->errand_time; // Time spent doing errands
-            record->completed_round_trip = 1;
-        } else {
-            // Not completed return journey yet
-            record->return_queue_time = 0;
-            record->return_journey_time = 0;
-            record->return_trip_number = 0;
-            record->total_round_trip_time = record->outbound_journey_time; // Just the outbound time
-            record->time_at_destination = 0;
-            record->completed_round_trip = 0;
+        printf("\nAverage Outbound Latency:\n");
+        printf("  Toll queue: %.3f ms\n", running_stat_mean(&stats->outbound_queue) * 1000.0);
+        printf("  Toll processing: %.3f ms\n", running_stat_mean(&stats->outbound_toll) * 1000.0);
+        printf("  Waiting area: %.3f ms\n", running_stat_mean(&stats->outbound_waiting) * 1000.0);
+        printf("  Ferry ride: %.3f ms\n", running_stat_mean(&stats->ferry_ride) * 1000.0);
+            
+        printf("\nVehicles per Trip: %.2f vehicles/trip\n", (double)stats->outbound.count / trip_count);
+        printf("Completed Round Trips: %lld / %lld (%.1f%%)\n", 
+            stats->round_trip.count, stats->outbound.count, 
+            ((double)stats->round_trip.count / stats->outbound.count) * 100.0);
+    }
+    
+    print_latency_report();
+    
+    printf("\n=================================================================\n");
+}
+
+/* Free up all resources when simulation completes */
+void cleanup_simulation() {
+    for (int f = 0; f < num_ferries; f++) {
+        free(ferries[f].vehicles);
+        pthread_mutex_destroy(&ferries[f].mutex);
+        pthread_cond_destroy(&ferries[f].departure_changed);
+    }
+    free(ferries);
+    ferries = NULL;
+    live_metrics_destroy();
+    num_ferries = 0;
+    free(trip_log.records);
+    trip_log.records = NULL;
+    trip_log.count = trip_log.capacity = 0;
+    
+    // Release the dynamically sized structures
+    for (int side = 0; side < num_terminals; side++) {
+        CityPart* city = &city_parts[side];
+        free(city->booths);
+        vehicle_queue_destroy(&city->vehicle_queue);
+        waiting_area_destroy(&city->waiting_area);
+        
+        // Clean up thread synchronization objects
+        pthread_mutex_destroy(&city->mutex);
+        pthread_mutex_destroy(&city->queue_mutex);
+        pthread_cond_destroy(&city->queue_not_empty);
+        pthread_cond_destroy(&city->booths_changed);
+        pthread_cond_destroy(&city->waiting_area_changed);
+    }
+    pthread_mutex_destroy(&dispatcher.mutex);
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&simulation_progress);
+    
+    errand_timer_destroy();
+    arrivals_destroy();
+    trace_close();
+    
+    // Release the event calendar used by virtual clock mode
+    free(event_calendar.events);
+    event_calendar.events = NULL;
+    event_calendar.size = 0;
+    event_calendar.capacity = 0;
+    
+    // Every vehicle - wherever it was when the simulation stopped - and the booth thread
+    // arguments live in the arena
+    arena_release();
+    pthread_mutex_destroy(&sim_arena.mutex);
+    
+    sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Simulation resources cleaned up\n");
+    log_stop();
+}
+
+/**
+ * Checkpoint functions implementation
+ * In virtual clock mode the whole world lives in plain memory and only changes inside an
+ * event, so between two events it can be written out and later restored into a freshly
+ * initialised simulation. Pointers are stored as IDs - vehicle IDs, terminal IDs, booth and
+ * ferry indexes - and resolved again on restore, the event calendar included. With the same
+ * seed a resumed run continues exactly as the original would have; settings that do not
+ * shape the world (policies, thresholds, the time limit, the seed) may change to fork it.
+ */
+/* Start of a checkpoint file. The configuration, vehicles and statistics are stored as laid
+ * out in memory, so the layout sizes keep snapshots of another build from being read */
+typedef struct {
+    char magic[8];                // CHECKPOINT_MAGIC, not NUL-terminated
+    uint32_t version;
+    uint32_t layout[4];           // sizeof SimConfig, Vehicle, VehicleTiming and TransportStats
+    SimConfig config;             // Configuration of the run that wrote it
+    uint64_t run_seed;
+    long long clock_us;           // Simulated time of the snapshot
+} CheckpointHeader;
+
+/* A checkpoint being written or read - the first failed transfer fails the whole file */
+typedef struct {
+    FILE* file;
+    int failed;
+    Vehicle** vehicles;           // Restore only: restored vehicles by ID
+    int vehicle_limit;            // Highest valid vehicle ID
+} CheckpointStream;
+
+/* One calendar event - pointers become IDs and indexes */
+typedef struct {
+    long long time_us;
+    long long sequence;
+    int32_t type;
+    int32_t vehicle;              // Vehicle ID, 0 = none
+    int32_t city;                 // Terminal ID, -1 = none
+    int32_t booth_side;           // Terminal of the booth, -1 = none
+    int32_t booth;                // Index among the terminal's booths
+    int32_t ferry;                // Ferry index, -1 = none
+    int32_t flag;
+} CheckpointEvent;
+
+/* Sizes of the structures stored as they are in memory */
+void checkpoint_layout(uint32_t* layout) {
+    layout[0] = sizeof(SimConfig);
+    layout[1] = sizeof(Vehicle);
+    layout[2] = sizeof(VehicleTiming);
+    layout[3] = sizeof(TransportStats);
+}
+
+void checkpoint_put(CheckpointStream* stream, const void* data, size_t size) {
+    if (!stream->failed && fwrite(data, 1, size, stream->file) != size) {
+        stream->failed = 1;
+    }
+}
+
+void checkpoint_put_int(CheckpointStream* stream, int value) {
+    int32_t stored = value;
+    checkpoint_put(stream, &stored, sizeof(stored));
+}
+
+void checkpoint_put_long(CheckpointStream* stream, long long value) {
+    int64_t stored = value;
+    checkpoint_put(stream, &stored, sizeof(stored));
+}
+
+/* Pointers are written as IDs, NULL as 0 (vehicles) or -1 */
+void checkpoint_put_vehicle(CheckpointStream* stream, const Vehicle* vehicle) {
+    checkpoint_put_int(stream, vehicle ? vehicle->id : 0);
+}
+
+void checkpoint_put_city(CheckpointStream* stream, const CityPart* city) {
+    checkpoint_put_int(stream, city ? (int)city->id : -1);
+}
+
+void checkpoint_put_ferry(CheckpointStream* stream, const Ferry* ferry) {
+    checkpoint_put_int(stream, ferry ? (int)(ferry - ferries) : -1);
+}
+
+/* Fills data from the file - after a failure it is zeroed instead */
+void checkpoint_get(CheckpointStream* stream, void* data, size_t size) {
+    if (stream->failed || fread(data, 1, size, stream->file) != size) {
+        stream->failed = 1;
+        memset(data, 0, size);
+    }
+}
+
+int checkpoint_get_int(CheckpointStream* stream) {
+    int32_t stored;
+    checkpoint_get(stream, &stored, sizeof(stored));
+    return stored;
+}
+
+long long checkpoint_get_long(CheckpointStream* stream) {
+    int64_t stored;
+    checkpoint_get(stream, &stored, sizeof(stored));
+    return stored;
+}
+
+/* Reads a count or index that must lie in [low, high] - anything else fails the file */
+int checkpoint_get_range(CheckpointStream* stream, int low, int high) {
+    int value = checkpoint_get_int(stream);
+    if (value < low || value > high) {
+        stream->failed = 1;
+        return low;
+    }
+    return value;
+}
+
+/* Resolves a vehicle ID - NULL for none, or on failure if required */
+Vehicle* checkpoint_get_vehicle(CheckpointStream* stream, int required) {
+    Vehicle* vehicle = stream->vehicles[checkpoint_get_range(stream, 0, stream->vehicle_limit)];
+    if (!vehicle && required) {
+        stream->failed = 1;
+    }
+    return vehicle;
+}
+
+CityPart* checkpoint_get_city(CheckpointStream* stream, int required) {
+    int id = checkpoint_get_range(stream, required ? 0 : -1, num_terminals - 1);
+    return id >= 0 ? &city_parts[id] : NULL;
+}
+
+Ferry* checkpoint_get_ferry(CheckpointStream* stream) {
+    int index = checkpoint_get_range(stream, -1, num_ferries - 1);
+    return index >= 0 ? &ferries[index] : NULL;
+}
+
+/* Adds a vehicle to the list of vehicles to write, unless it is on it already */
+void checkpoint_collect(Vehicle* vehicle, unsigned char mark, Vehicle** list, int* count, unsigned char* seen) {
+    if (vehicle && !seen[vehicle->id]) {
+        seen[vehicle->id] = mark;
+        list[(*count)++] = vehicle;
+    }
+}
+
+/* Every vehicle in flight - wherever it is, and those that only an event refers to */
+void checkpoint_write_vehicles(CheckpointStream* stream) {
+    int limit = total_fleet_size() + 1;
+    Vehicle** list = (Vehicle**)malloc(limit * sizeof(Vehicle*));
+    unsigned char* seen = (unsigned char*)calloc(limit + 1, 1);
+    if (!list || !seen) {
+        perror("Failed to allocate memory for checkpoint");
+        exit(EXIT_FAILURE);
+    }
+    int count = 0;
+    
+    // Vehicles in a handoff first - their link is not part of the state (mark 2)
+    for (int side = 0; side < num_terminals; side++) {
+        Vehicle* vehicle = atomic_load_explicit(&city_parts[side].handoff.head, memory_order_acquire);
+        for (; vehicle; vehicle = vehicle->handoff_next) {
+            checkpoint_collect(vehicle, 2, list, &count, seen);
+        }
+    }
+    for (int side = 0; side < num_terminals; side++) {
+        CityPart* city = &city_parts[side];
+        for (int i = 0; i < city->vehicle_queue.size; i++) {
+            checkpoint_collect(vehicle_queue_at(&city->vehicle_queue, i), 1, list, &count, seen);
+        }
+        for (int i = 0; i < city->num_booths; i++) {
+            checkpoint_collect(atomic_load(&city->booths[i].current_vehicle), 1, list, &count, seen);
+        }
+        for (int heading = 0; heading < num_terminals; heading++) {
+            for (int quota = CAR; quota <= TRUCK; quota++) {
+                const VehicleQueue* lane = &city->waiting_area.lanes[heading][quota];
+                for (int i = 0; i < lane->size; i++) {
+                    checkpoint_collect(vehicle_queue_at(lane, i), 1, list, &count, seen);
+                }
+            }
+        }
+    }
+    for (int f = 0; f < num_ferries; f++) {
+        for (int i = 0; i < ferries[f].vehicle_count; i++) {
+            checkpoint_collect(ferries[f].vehicles[i], 1, list, &count, seen);
+        }
+    }
+    for (int i = 0; i < event_calendar.size; i++) {
+        checkpoint_collect(event_calendar.events[i].vehicle, 1, list, &count, seen);
+    }
+    
+    checkpoint_put_int(stream, count);
+    for (int i = 0; i < count; i++) {
+        Vehicle copy = *list[i];
+        copy.timing = NULL;
+        if (seen[copy.id] == 2) {
+            copy.waiting_sequence = 0;
+        }
+        checkpoint_put(stream, &copy, sizeof(copy));
+        checkpoint_put(stream, list[i]->timing, sizeof(VehicleTiming));
+    }
+    free(list);
+    free(seen);
+}
+
+/* Recreates the vehicles from the arena pool and indexes them by ID */
+void checkpoint_read_vehicles(CheckpointStream* stream) {
+    int count = checkpoint_get_range(stream, 0, stream->vehicle_limit);
+    for (int i = 0; i < count && !stream->failed; i++) {
+        Vehicle copy;
+        VehicleTiming timing;
+        checkpoint_get(stream, &copy, sizeof(copy));
+        checkpoint_get(stream, &timing, sizeof(timing));
+        if (copy.id < 1 || copy.id > stream->vehicle_limit || stream->vehicles[copy.id] ||
+            copy.type < CAR || copy.type > TRUCK || copy.quota != (int)copy.type ||
+            (int)copy.origin_side >= num_terminals || (int)copy.destination_side >= num_terminals ||
+            (int)copy.return_side >= num_terminals || (int)copy.current_side >= num_terminals) {
+            stream->failed = 1;
+            break;
+        }
+        
+        Vehicle* vehicle = create_vehicle(copy.id, copy.type);
+        copy.timing = vehicle->timing;
+        *vehicle = copy;
+        *vehicle->timing = timing;
+        stream->vehicles[copy.id] = vehicle;
+    }
+}
+
+/* A vehicle queue as the IDs of its vehicles, front first */
+void checkpoint_write_queue(CheckpointStream* stream, const VehicleQueue* queue) {
+    checkpoint_put_int(stream, queue->size);
+    for (int i = 0; i < queue->size; i++) {
+        checkpoint_put_vehicle(stream, vehicle_queue_at(queue, i));
+    }
+}
+
+/* Refills an empty queue - returns the number of vehicles added */
+int checkpoint_read_queue(CheckpointStream* stream, VehicleQueue* queue) {
+    int count = checkpoint_get_range(stream, 0, queue->capacity);
+    for (int i = 0; i < count && !stream->failed; i++) {
+        Vehicle* vehicle = checkpoint_get_vehicle(stream, 1);
+        if (vehicle) {
+            vehicle_queue_push_back(queue, vehicle);
+        }
+    }
+    return count;
+}
+
+/* Booths, toll queue, handoff, waiting area and berth state of a terminal */
+void checkpoint_write_city(CheckpointStream* stream, CityPart* city) {
+    checkpoint_put_int(stream, city->open_booths);
+    checkpoint_put_int(stream, city->peak_open_booths);
+    checkpoint_put_int(stream, city->booth_openings);
+    checkpoint_put_int(stream, city->booth_closings);
+    checkpoint_put_long(stream, city->last_booth_change);
+    for (int i = 0; i < city->num_booths; i++) {
+        TollBooth* booth = &city->booths[i];
+        checkpoint_put_int(stream, booth->is_occupied);
+        checkpoint_put_vehicle(stream, atomic_load(&booth->current_vehicle));
+        checkpoint_put(stream, &booth->rng, sizeof(booth->rng));
+        checkpoint_put_int(stream, booth->is_open);
+        checkpoint_put_long(stream, booth->opened_at);
+        checkpoint_put_long(stream, booth->open_ns);
+    }
+    
+    checkpoint_write_queue(stream, &city->vehicle_queue);
+    
+    // The handoff as it is linked, newest first
+    int handoff_count = 0;
+    Vehicle* head = atomic_load_explicit(&city->handoff.head, memory_order_acquire);
+    for (Vehicle* vehicle = head; vehicle; vehicle = vehicle->handoff_next) {
+        handoff_count++;
+    }
+    checkpoint_put_int(stream, handoff_count);
+    for (Vehicle* vehicle = head; vehicle; vehicle = vehicle->handoff_next) {
+        checkpoint_put_vehicle(stream, vehicle);
+    }
+    
+    for (int heading = 0; heading < num_terminals; heading++) {
+        for (int quota = CAR; quota <= TRUCK; quota++) {
+            checkpoint_write_queue(stream, &city->waiting_area.lanes[heading][quota]);
+        }
+    }
+    checkpoint_put_long(stream, (long long)city->waiting_area.next_sequence);
+    checkpoint_put_long(stream, (long long)atomic_load(&city->waiting_area_version));
+    
+    for (int heading = 0; heading < num_terminals; heading++) {
+        for (int quota = CAR; quota <= TRUCK; quota++) {
+            checkpoint_put_int(stream, atomic_load(&city->queued_by_quota[heading][quota]));
+            checkpoint_put_int(stream, atomic_load(&city->booth_by_quota[heading][quota]));
+            checkpoint_put_int(stream, atomic_load(&city->handoff.by_quota[heading][quota]));
+        }
+        checkpoint_put(stream, &city->arrivals_to[heading], sizeof(ArrivalEstimate));
+        checkpoint_put_ferry(stream, city->loading_ferry[heading]);
+        checkpoint_put_int(stream, city->ferries_docked[heading]);
+        checkpoint_put_int(stream, city->ferries_inbound[heading]);
+    }
+}
+
+void checkpoint_read_city(CheckpointStream* stream, CityPart* city) {
+    city->open_booths = checkpoint_get_range(stream, 0, city->num_booths);
+    city->peak_open_booths = checkpoint_get_range(stream, 0, city->num_booths);
+    city->booth_openings = checkpoint_get_int(stream);
+    city->booth_closings = checkpoint_get_int(stream);
+    city->last_booth_change = checkpoint_get_long(stream);
+    for (int i = 0; i < city->num_booths; i++) {
+        TollBooth* booth = &city->booths[i];
+        booth->is_occupied = checkpoint_get_int(stream);
+        atomic_store(&booth->current_vehicle, checkpoint_get_vehicle(stream, 0));
+        checkpoint_get(stream, &booth->rng, sizeof(booth->rng));
+        booth->is_open = checkpoint_get_int(stream);
+        booth->opened_at = checkpoint_get_long(stream);
+        booth->open_ns = checkpoint_get_long(stream);
+    }
+    
+    checkpoint_read_queue(stream, &city->vehicle_queue);
+    
+    // Pushed oldest first, so the list is linked as it was written
+    int handoff_count = checkpoint_get_range(stream, 0, stream->vehicle_limit);
+    Vehicle** handoff = (Vehicle**)malloc((handoff_count + 1) * sizeof(Vehicle*));
+    if (!handoff) {
+        perror("Failed to allocate memory for checkpoint");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < handoff_count; i++) {
+        handoff[i] = checkpoint_get_vehicle(stream, 1);
+    }
+    for (int i = handoff_count - 1; i >= 0 && !stream->failed; i--) {
+        waiting_handoff_push(&city->handoff, handoff[i]);
+    }
+    free(handoff);
+    
+    WaitingArea* area = &city->waiting_area;
+    for (int heading = 0; heading < num_terminals; heading++) {
+        for (int quota = CAR; quota <= TRUCK; quota++) {
+            int count = checkpoint_read_queue(stream, &area->lanes[heading][quota]);
+            area->size_to[heading] += count;
+            area->size += count;
+        }
+    }
+    if (area->size > area->capacity) {
+        stream->failed = 1;
+    }
+    area->next_sequence = (unsigned long)checkpoint_get_long(stream);
+    atomic_store(&city->waiting_area_version, (unsigned long)checkpoint_get_long(stream));
+    
+    // Counters are taken as written - the handoff pushes above counted their vehicles already
+    for (int heading = 0; heading < num_terminals; heading++) {
+        for (int quota = CAR; quota <= TRUCK; quota++) {
+            atomic_store(&city->queued_by_quota[heading][quota], checkpoint_get_int(stream));
+            atomic_store(&city->booth_by_quota[heading][quota], checkpoint_get_int(stream));
+            atomic_store(&city->handoff.by_quota[heading][quota], checkpoint_get_int(stream));
+        }
+        checkpoint_get(stream, &city->arrivals_to[heading], sizeof(ArrivalEstimate));
+        city->loading_ferry[heading] = checkpoint_get_ferry(stream);
+        city->ferries_docked[heading] = checkpoint_get_range(stream, 0, num_ferries);
+        city->ferries_inbound[heading] = checkpoint_get_range(stream, 0, num_ferries);
+    }
+}
+
+/* Load, position, journey and bookkeeping state of a ferry */
+void checkpoint_write_ferry(CheckpointStream* stream, const Ferry* ferry) {
+    checkpoint_put_int(stream, ferry->current_load);
+    checkpoint_put_int(stream, ferry->vehicle_count);
+    for (int i = 0; i < ferry->vehicle_count; i++) {
+        checkpoint_put_vehicle(stream, ferry->vehicles[i]);
+    }
+    checkpoint_put_city(stream, ferry->location);
+    checkpoint_put_int(stream, ferry->is_loading);
+    checkpoint_put_int(stream, ferry->is_moving);
+    checkpoint_put_int(stream, ferry->is_unloading);
+    checkpoint_put(stream, &ferry->rng, sizeof(ferry->rng));
+    checkpoint_put_city(stream, ferry->departure_side);
+    checkpoint_put_int(stream, ferry->first_outbound_completed);
+    checkpoint_put_int(stream, ferry->first_return_completed);
+    checkpoint_put_int(stream, ferry->last_waiting_message);
+    checkpoint_put_long(stream, ferry->last_message_time);
+    checkpoint_put_long(stream, ferry->depart_message_time);
+    checkpoint_put_int(stream, ferry->depart_vehicles_needed);
+    checkpoint_put_int(stream, ferry->depart_unfilled_quota);
+    checkpoint_put_int(stream, ferry->depart_state);
+    checkpoint_put_int(stream, ferry->depart_reason);
+    checkpoint_put_long(stream, ferry->depart_deadline);
+    checkpoint_put_int(stream, ferry->deadline_generation);
+    checkpoint_put_int(stream, ferry->trip_number);
+    checkpoint_put_long(stream, ferry->docked_time);
+    checkpoint_put_long(stream, ferry->first_boarding_time);
+    checkpoint_put_long(stream, ferry->departure_time);
+    checkpoint_put_int(stream, ferry->trips_completed);
+    checkpoint_put_int(stream, ferry->vehicles_carried);
+    checkpoint_put_city(stream, ferry->docked_at);
+    checkpoint_put_long(stream, ferry->docked_sequence);
+    checkpoint_put_int(stream, ferry->event_pending);
+    checkpoint_put_long(stream, (long long)ferry->departure_version);
+}
+
+void checkpoint_read_ferry(CheckpointStream* stream, Ferry* ferry) {
+    ferry->current_load = checkpoint_get_range(stream, 0, ferry->capacity);
+    ferry->vehicle_count = checkpoint_get_range(stream, 0, ferry->capacity);
+    for (int i = 0; i < ferry->vehicle_count; i++) {
+        ferry->vehicles[i] = checkpoint_get_vehicle(stream, 1);
+    }
+    ferry->location = checkpoint_get_city(stream, 1);
+    ferry->is_loading = checkpoint_get_int(stream);
+    ferry->is_moving = checkpoint_get_int(stream);
+    ferry->is_unloading = checkpoint_get_int(stream);
+    checkpoint_get(stream, &ferry->rng, sizeof(ferry->rng));
+    ferry->departure_side = checkpoint_get_city(stream, 0);
+    ferry->first_outbound_completed = checkpoint_get_int(stream);
+    ferry->first_return_completed = checkpoint_get_int(stream);
+    ferry->last_waiting_message = checkpoint_get_int(stream);
+    ferry->last_message_time = checkpoint_get_long(stream);
+    ferry->depart_message_time = checkpoint_get_long(stream);
+    ferry->depart_vehicles_needed = checkpoint_get_int(stream);
+    ferry->depart_unfilled_quota = checkpoint_get_int(stream);
+    ferry->depart_state = checkpoint_get_int(stream);
+    ferry->depart_reason = (TripReason)checkpoint_get_range(stream, 0, TRIP_REASON_COUNT - 1);
+    ferry->depart_deadline = checkpoint_get_long(stream);
+    ferry->deadline_generation = checkpoint_get_int(stream);
+    ferry->trip_number = checkpoint_get_int(stream);
+    ferry->docked_time = checkpoint_get_long(stream);
+    ferry->first_boarding_time = checkpoint_get_long(stream);
+    ferry->departure_time = checkpoint_get_long(stream);
+    ferry->trips_completed = checkpoint_get_int(stream);
+    ferry->vehicles_carried = checkpoint_get_int(stream);
+    ferry->docked_at = checkpoint_get_city(stream, 0);
+    ferry->docked_sequence = (long)checkpoint_get_long(stream);
+    ferry->event_pending = checkpoint_get_int(stream);
+    ferry->departure_version = (unsigned long)checkpoint_get_long(stream);
+}
+
+/* The pending events, in heap order - the calendar comes back exactly as it was */
+void checkpoint_write_events(CheckpointStream* stream) {
+    checkpoint_put_int(stream, event_calendar.size);
+    checkpoint_put_long(stream, event_calendar.next_sequence);
+    for (int i = 0; i < event_calendar.size; i++) {
+        const SimEvent* event = &event_calendar.events[i];
+        CheckpointEvent record;
+        memset(&record, 0, sizeof(record));
+        record.time_us = event->time_us;
+        record.sequence = event->sequence;
+        record.type = event->type;
+        record.vehicle = event->vehicle ? event->vehicle->id : 0;
+        record.city = event->city ? (int32_t)event->city->id : -1;
+        record.booth_side = event->booth ? (int32_t)event->booth->side : -1;
+        record.booth = event->booth ? event->booth->id - 1 : -1;
+        record.ferry = event->ferry ? (int32_t)(event->ferry - ferries) : -1;
+        record.flag = event->flag;
+        checkpoint_put(stream, &record, sizeof(record));
+    }
+}
+
+void checkpoint_read_events(CheckpointStream* stream) {
+    int count = checkpoint_get_range(stream, 0, INT32_MAX / (int)sizeof(SimEvent));
+    event_calendar.next_sequence = checkpoint_get_long(stream);
+    
+    int capacity = count > 64 ? count : 64;
+    SimEvent* events = (SimEvent*)realloc(event_calendar.events, capacity * sizeof(SimEvent));
+    if (!events) {
+        perror("Failed to allocate memory for event calendar");
+        exit(EXIT_FAILURE);
+    }
+    event_calendar.events = events;
+    event_calendar.capacity = capacity;
+    event_calendar.size = 0;
+    
+    for (int i = 0; i < count && !stream->failed; i++) {
+        CheckpointEvent record;
+        checkpoint_get(stream, &record, sizeof(record));
+        if (record.type < EVENT_BOOTH_DONE || record.type > EVENT_FERRY_DEADLINE ||
+            record.vehicle < 0 || record.vehicle > stream->vehicle_limit ||
+            record.city < -1 || record.city >= num_terminals ||
+            record.booth_side < -1 || record.booth_side >= num_terminals ||
+            record.ferry < -1 || record.ferry >= num_ferries ||
+            (record.booth_side >= 0 && (record.booth < 0 || record.booth >= city_parts[record.booth_side].num_booths))) {
+            stream->failed = 1;
+            break;
         }
         
-        recorded_vehicle_count++;
+        SimEvent* event = &events[event_calendar.size++];
+        event->time_us = record.time_us;
+        event->sequence = record.sequence;
+        event->type = (EventType)record.type;
+        event->vehicle = stream->vehicles[record.vehicle];
+        event->city = record.city >= 0 ? &city_parts[record.city] : NULL;
+        event->booth = record.booth_side >= 0 ? &city_parts[record.booth_side].booths[record.booth] : NULL;
+        event->ferry = record.ferry >= 0 ? &ferries[record.ferry] : NULL;
+        event->flag = record.flag;
+        
+        // What handle_event dereferences must be there
+        int needs_vehicle = event->type == EVENT_BOOTH_DONE || event->type == EVENT_ERRAND_DONE;
+        int needs_city = needs_vehicle || event->type == EVENT_ARRIVAL;
+        if ((needs_vehicle && !event->vehicle) || (needs_city && !event->city) ||
+            (event->type == EVENT_BOOTH_DONE && !event->booth) ||
+            (!needs_city && !event->ferry)) {
+            stream->failed = 1;
+        }
+    }
+}
+
+/* A histogram as its non-empty buckets */
+void checkpoint_write_histogram(CheckpointStream* stream, const LatencyHistogram* histogram) {
+    checkpoint_put_long(stream, histogram->count);
+    if (histogram->count == 0) {
+        return;
+    }
+    checkpoint_put_long(stream, histogram->min);
+    checkpoint_put_long(stream, histogram->max);
+    checkpoint_put(stream, &histogram->sum, sizeof(histogram->sum));
+    int used = 0;
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        used += histogram->counts[i] != 0;
+    }
+    checkpoint_put_int(stream, used);
+    for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        if (histogram->counts[i] != 0) {
+            checkpoint_put_int(stream, i);
+            checkpoint_put_long(stream, histogram->counts[i]);
+        }
+    }
+}
+
+void checkpoint_read_histogram(CheckpointStream* stream, LatencyHistogram* histogram) {
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->count = checkpoint_get_long(stream);
+    if (histogram->count == 0) {
+        return;
+    }
+    histogram->min = checkpoint_get_long(stream);
+    histogram->max = checkpoint_get_long(stream);
+    checkpoint_get(stream, &histogram->sum, sizeof(histogram->sum));
+    int used = checkpoint_get_range(stream, 0, HISTOGRAM_BUCKETS);
+    for (int i = 0; i < used; i++) {
+        int bucket = checkpoint_get_range(stream, 0, HISTOGRAM_BUCKETS - 1);
+        histogram->counts[bucket] = checkpoint_get_long(stream);
+    }
+}
+
+/* Report aggregates, latency histograms, the trip log and the live counters */
+void checkpoint_write_stats(CheckpointStream* stream) {
+    checkpoint_put(stream, &loading_stats, sizeof(loading_stats));
+    checkpoint_put(stream, &transport_stats, sizeof(transport_stats));
+    checkpoint_put_int(stream, recorded_vehicle_count);
+    checkpoint_put(stream, vehicle_records, recorded_vehicle_count * sizeof(VehicleRecord));
+    checkpoint_put_int(stream, trip_log.count);
+    checkpoint_put(stream, trip_log.records, trip_log.count * sizeof(TripRecord));
+    
+    for (int m = 0; m < LATENCY_METRIC_COUNT; m++) {
+        checkpoint_write_histogram(stream, &latency_stats.all[m]);
+        for (int type = CAR; type <= TRUCK; type++) {
+            checkpoint_write_histogram(stream, &latency_stats.by_type[type][m]);
+        }
+        for (int side = 0; side < num_terminals; side++) {
+            checkpoint_write_histogram(stream, &latency_stats.by_side[side][m]);
+        }
+    }
+    
+    for (int side = 0; side < num_terminals; side++) {
+        checkpoint_put_int(stream, atomic_load(&live_metrics.queue_depth[side]));
+        checkpoint_put_int(stream, atomic_load(&live_metrics.waiting_area_size[side]));
+        checkpoint_put_int(stream, atomic_load(&live_metrics.booths_busy[side]));
+        checkpoint_put_int(stream, atomic_load(&live_metrics.booths_open[side]));
+    }
+    for (int f = 0; f < num_ferries; f++) {
+        checkpoint_put_int(stream, atomic_load(&live_metrics.ferry_load[f]));
+        checkpoint_put_int(stream, atomic_load(&live_metrics.ferry_vehicles[f]));
+    }
+    checkpoint_put_int(stream, atomic_load(&live_metrics.trips_completed));
+    checkpoint_put_int(stream, atomic_load(&live_metrics.vehicles_transported));
+    checkpoint_put_int(stream, atomic_load(&live_metrics.vehicles_dropped));
+    checkpoint_put_long(stream, atomic_load(&live_metrics.events));
+}
+
+void checkpoint_read_stats(CheckpointStream* stream) {
+    checkpoint_get(stream, &loading_stats, sizeof(loading_stats));
+    checkpoint_get(stream, &transport_stats, sizeof(transport_stats));
+    recorded_vehicle_count = checkpoint_get_range(stream, 0, MAX_DETAILED_RECORDS);
+    checkpoint_get(stream, vehicle_records, recorded_vehicle_count * sizeof(VehicleRecord));
+    
+    int trips = checkpoint_get_range(stream, 0, INT32_MAX / (int)sizeof(TripRecord));
+    free(trip_log.records);
+    trip_log.records = NULL;
+    trip_log.count = trip_log.capacity = 0;
+    if (trips > 0 && !stream->failed) {
+        trip_log.records = (TripRecord*)malloc(trips * sizeof(TripRecord));
+        if (!trip_log.records) {
+            perror("Failed to allocate memory for the trip log");
+            exit(EXIT_FAILURE);
+        }
+        checkpoint_get(stream, trip_log.records, trips * sizeof(TripRecord));
+        trip_log.count = trip_log.capacity = trips;
+    }
+    
+    for (int m = 0; m < LATENCY_METRIC_COUNT; m++) {
+        checkpoint_read_histogram(stream, &latency_stats.all[m]);
+        for (int type = CAR; type <= TRUCK; type++) {
+            checkpoint_read_histogram(stream, &latency_stats.by_type[type][m]);
+        }
+        for (int side = 0; side < num_terminals; side++) {
+            checkpoint_read_histogram(stream, &latency_stats.by_side[side][m]);
+        }
+    }
+    
+    for (int side = 0; side < num_terminals; side++) {
+        atomic_store(&live_metrics.queue_depth[side], checkpoint_get_int(stream));
+        atomic_store(&live_metrics.waiting_area_size[side], checkpoint_get_int(stream));
+        atomic_store(&live_metrics.booths_busy[side], checkpoint_get_int(stream));
+        atomic_store(&live_metrics.booths_open[side], checkpoint_get_int(stream));
+    }
+    for (int f = 0; f < num_ferries; f++) {
+        atomic_store(&live_metrics.ferry_load[f], checkpoint_get_int(stream));
+        atomic_store(&live_metrics.ferry_vehicles[f], checkpoint_get_int(stream));
+    }
+    atomic_store(&live_metrics.trips_completed, checkpoint_get_int(stream));
+    atomic_store(&live_metrics.vehicles_transported, checkpoint_get_int(stream));
+    atomic_store(&live_metrics.vehicles_dropped, checkpoint_get_int(stream));
+    atomic_store(&live_metrics.events, checkpoint_get_long(stream));
+}
+
+/* Writes the world state to path, through a temporary file so that path always holds a
+ * complete checkpoint - returns 0 on success. Only called between two events */
+int checkpoint_write(const char* path) {
+    char temp_path[MAX_CONFIG_LINE + 32];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+    CheckpointStream stream = { fopen(temp_path, "wb"), 0, NULL, 0 };
+    if (!stream.file) {
+        perror("Failed to create checkpoint file");
+        return -1;
+    }
+    
+    CheckpointHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    checkpoint_layout(header.layout);
+    header.config = config;
+    header.run_seed = run_seed;
+    header.clock_us = virtual_clock_us;
+    checkpoint_put(&stream, &header, sizeof(header));
+    
+    checkpoint_put_int(&stream, total_vehicles_transported);
+    checkpoint_put_int(&stream, vehicles_dropped);
+    for (int type = CAR; type <= TRUCK; type++) {
+        checkpoint_put_int(&stream, vehicles_dropped_by_type[type]);
+    }
+    checkpoint_put_int(&stream, trip_count);
+    checkpoint_put_int(&stream, next_trip_number);
+    checkpoint_put_int(&stream, single_origin_fleet);
+    checkpoint_put(&stream, &setup_rng, sizeof(setup_rng));
+    checkpoint_put_long(&stream, dispatcher.next_docked_sequence);
+    
+    checkpoint_write_vehicles(&stream);
+    for (int side = 0; side < num_terminals; side++) {
+        checkpoint_write_city(&stream, &city_parts[side]);
+    }
+    for (int f = 0; f < num_ferries; f++) {
+        checkpoint_write_ferry(&stream, &ferries[f]);
+    }
+    
+    // Arrivals still to come - recorded ones are read from the arrival file again
+    checkpoint_put(&stream, &arrivals.rng, sizeof(arrivals.rng));
+    checkpoint_put(&stream, arrivals.next_us, sizeof(arrivals.next_us));
+    checkpoint_put(&stream, arrivals.remaining, sizeof(arrivals.remaining));
+    checkpoint_put_int(&stream, arrivals.position);
+    checkpoint_put_int(&stream, arrivals.next_id);
+    
+    checkpoint_write_events(&stream);
+    checkpoint_write_stats(&stream);
+    checkpoint_put(&stream, CHECKPOINT_MAGIC, 8); // A truncated file is never resumed
+    
+    if (fclose(stream.file) != 0) {
+        stream.failed = 1;
+    }
+    if (stream.failed || rename(temp_path, path) != 0) {
+        perror("Failed to write checkpoint");
+        remove(temp_path);
+        return -1;
+    }
+    sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Checkpoint written to %s at %.1f simulated seconds\n",
+            path, virtual_clock_us / 1e6);
+    return 0;
+}
+
+/* Writes the checkpoint due at the given simulated time - every interval gets its own
+ * file (FILE.<seconds>), so a run can be forked from any of them */
+void checkpoint_write_interval(long long at_us) {
+    char path[MAX_CONFIG_LINE + 24];
+    snprintf(path, sizeof(path), "%s.%lld", config.checkpoint_file, at_us / 1000000LL);
+    checkpoint_write(path);
+}
+
+/* Opens a checkpoint and reads its header - returns 0 on success */
+int checkpoint_open(const char* path, CheckpointStream* stream, CheckpointHeader* header) {
+    stream->file = fopen(path, "rb");
+    stream->failed = 0;
+    stream->vehicles = NULL;
+    stream->vehicle_limit = 0;
+    if (!stream->file) {
+        perror("Failed to open checkpoint file");
+        return -1;
+    }
+    
+    uint32_t layout[4];
+    checkpoint_layout(layout);
+    checkpoint_get(stream, header, sizeof(*header));
+    if (stream->failed || memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != CHECKPOINT_VERSION || memcmp(header->layout, layout, sizeof(layout)) != 0) {
+        fprintf(stderr, "%s: not a ferry simulation checkpoint (or written by another version)\n", path);
+        fclose(stream->file);
+        return -1;
+    }
+    return 0;
+}
+
+/* Takes over the configuration of a checkpointed run, seed included. Output files are not
+ * taken over - a resumed run writes what its own command line asks for */
+int checkpoint_read_config(const char* path, SimConfig* cfg) {
+    CheckpointStream stream;
+    CheckpointHeader header;
+    if (checkpoint_open(path, &stream, &header) != 0) {
+        return -1;
+    }
+    fclose(stream.file);
+    
+    *cfg = header.config;
+    cfg->seed = (int)header.run_seed;
+    cfg->trace_file[0] = '\0';
+    cfg->latency_export[0] = '\0';
+    cfg->trip_export[0] = '\0';
+    cfg->stats_file[0] = '\0';
+    cfg->checkpoint_file[0] = '\0';
+    cfg->resume_file[0] = '\0';
+    return 0;
+}
+
+/* First option that shapes the world and differs from the checkpointed run, NULL if none */
+const char* checkpoint_structure_change(const SimConfig* saved) {
+    if (!config.virtual_clock) return "virtual-clock";
+    if (saved->num_cars != config.num_cars) return "cars";
+    if (saved->num_minibuses != config.num_minibuses) return "minibuses";
+    if (saved->num_trucks != config.num_trucks) return "trucks";
+    if (saved->ferry_capacity != config.ferry_capacity) return "capacity";
+    if (saved->booths_per_side != config.booths_per_side) return "booths";
+    if (saved->booths_max != config.booths_max) return "booths-max";
+    if (saved->num_ferries != config.num_ferries) return "ferries";
+    if (saved->queue_capacity != config.queue_capacity) return "queue-capacity";
+    if (saved->num_terminals != config.num_terminals) return "terminals";
+    if (saved->topology != config.topology) return "topology";
+    if ((saved->arrival_rate > 0) != (config.arrival_rate > 0)) return "arrival-rate";
+    if (strcmp(saved->arrival_file, config.arrival_file) != 0) return "arrival-file";
+    return NULL;
+}
+
+/* Checks that the configuration can continue the checkpointed run - returns 0 if it can */
+int checkpoint_check(const char* path) {
+    CheckpointStream stream;
+    CheckpointHeader header;
+    if (checkpoint_open(path, &stream, &header) != 0) {
+        return -1;
+    }
+    fclose(stream.file);
+    
+    const char* changed = checkpoint_structure_change(&header.config);
+    if (changed) {
+        fprintf(stderr, "%s: --%s must be the same as in the checkpointed run\n", path, changed);
+        return -1;
+    }
+    return 0;
+}
+
+/* Replaces the freshly initialised world with a checkpoint (instead of create_vehicles).
+ * A seed other than the checkpointed run's reseeds every random stream, so the fork
+ * diverges from the original from here on - returns 0 on success */
+int checkpoint_restore(const char* path) {
+    CheckpointStream stream;
+    CheckpointHeader header;
+    if (checkpoint_check(path) != 0 || checkpoint_open(path, &stream, &header) != 0) {
+        return -1;
+    }
+    int reseed = header.run_seed != run_seed;
+    
+    stream.vehicle_limit = total_fleet_size() + 1;
+    stream.vehicles = (Vehicle**)calloc(stream.vehicle_limit + 1, sizeof(Vehicle*));
+    if (!stream.vehicles) {
+        perror("Failed to allocate memory for checkpoint");
+        exit(EXIT_FAILURE);
+    }
+    virtual_clock_us = header.clock_us;
+    atomic_store_explicit(&live_metrics.clock_ns, virtual_clock_us * 1000, memory_order_relaxed);
+    
+    total_vehicles_transported = checkpoint_get_int(&stream);
+    vehicles_dropped = checkpoint_get_int(&stream);
+    for (int type = CAR; type <= TRUCK; type++) {
+        vehicles_dropped_by_type[type] = checkpoint_get_int(&stream);
+    }
+    trip_count = checkpoint_get_int(&stream);
+    next_trip_number = checkpoint_get_int(&stream);
+    single_origin_fleet = checkpoint_get_int(&stream);
+    Rng saved_setup_rng;
+    checkpoint_get(&stream, &saved_setup_rng, sizeof(saved_setup_rng));
+    dispatcher.next_docked_sequence = (long)checkpoint_get_long(&stream);
+    
+    checkpoint_read_vehicles(&stream);
+    for (int side = 0; side < num_terminals; side++) {
+        checkpoint_read_city(&stream, &city_parts[side]);
+    }
+    for (int f = 0; f < num_ferries; f++) {
+        checkpoint_read_ferry(&stream, &ferries[f]);
+    }
+    
+    Rng saved_arrivals_rng;
+    checkpoint_get(&stream, &saved_arrivals_rng, sizeof(saved_arrivals_rng));
+    checkpoint_get(&stream, arrivals.next_us, sizeof(arrivals.next_us));
+    checkpoint_get(&stream, arrivals.remaining, sizeof(arrivals.remaining));
+    arrivals.position = checkpoint_get_range(&stream, 0, arrivals.record_count);
+    arrivals.next_id = checkpoint_get_range(&stream, 0, stream.vehicle_limit);
+    
+    checkpoint_read_events(&stream);
+    checkpoint_read_stats(&stream);
+    char trailer[8];
+    checkpoint_get(&stream, trailer, sizeof(trailer));
+    if (memcmp(trailer, CHECKPOINT_MAGIC, sizeof(trailer)) != 0) {
+        stream.failed = 1;
+    }
+    free(stream.vehicles);
+    fclose(stream.file);
+    if (stream.failed) {
+        fprintf(stderr, "%s: checkpoint is damaged or incomplete\n", path);
+        return -1;
+    }
+    
+    if (reseed) {
+        for (int side = 0; side < num_terminals; side++) {
+            for (int i = 0; i < city_parts[side].num_booths; i++) {
+                TollBooth* booth = &city_parts[side].booths[i];
+                rng_init(&booth->rng, run_seed, RNG_STREAM_BOOTH | ((uint64_t)side << 16) | (uint64_t)booth->id);
+            }
+        }
+        for (int f = 0; f < num_ferries; f++) {
+            rng_init(&ferries[f].rng, run_seed, RNG_STREAM_FERRY | (uint64_t)f);
+        }
+        rng_init(&arrivals.rng, run_seed, RNG_STREAM_ARRIVALS);
     } else {
-        printf("Warning: Maximum vehicle record count reached.\n");
+        setup_rng = saved_setup_rng;
+        arrivals.rng = saved_arrivals_rng;
     }
     
-    pthread_mutex_unlock(&vehicle_records_mutex);
+    // The arrival rate may change - gaps already drawn stay as they are
+    if (config.arrival_rate > 0) {
+        arrivals.mean_gap_us = 3600.0 * 1000000.0 / config.arrival_rate;
+    }
+    
+    sim_log(LOG_SUMMARY, LOG_EVENT_GENERAL, -1, -1, -1, "Resumed from %s at %.1f simulated seconds (%d of %d vehicles transported)%s\n",
+            path, virtual_clock_us / 1e6, total_vehicles_transported, total_fleet_size(),
+            reseed ? " with a new seed" : "");
+    return 0;
 }
 
-/* Handles unloading vehicles at destination */
-void unload_ferry(Ferry* ferry) {
-    pthread_mutex_lock(&ferry->mutex);
+/**
+ * Trace replay implementation
+ */
+
+/* What replay reconstructs for one vehicle */
+typedef struct {
+    int type;
+    int last_event;               // TraceEvent, -1 before the vehicle's first record
+    int64_t arrival_ns[2];        // Indexed by leg
+    int64_t boarding_ns[2];
+    int64_t unload_ns;
+    int64_t complete_ns;
+} ReplayVehicle;
+
+/* One crossing on the trip timeline */
+typedef struct {
+    int ferry;                    // -1 if the trace never saw it depart
+    int from_side;
+    int to_side;
+    int64_t loading_start_ns;     // First boarding for this crossing, -1 if it left empty
+    int64_t depart_ns;
+    int64_t arrive_ns;            // -1 if the ferry was still crossing when the run ended
+    int vehicles;
+    int quota;
+} ReplayTrip;
+
+/* Reads a trace written with --trace and prints the report statistics and the trip timeline.
+ * Returns 0 on success, -1 if the file cannot be read or is not a trace */
+int replay_trace(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open trace file");
+        return -1;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(TraceHeader)) {
+        fprintf(stderr, "%s: not a ferry simulation trace\n", path);
+        close(fd);
+        return -1;
+    }
     
-    ferry->is_unloading = 1;
-    printf("Unloading %d vehicles at %s\n", ferry->vehicle_count, ferry->location->name);
+    void* map = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Failed to map trace file");
+        return -1;
+    }
     
-    // Set current time for unload timing
-    time_t current_time = time(NULL);
-    CityPart* current_location = ferry->location;
+    const TraceHeader* header = (const TraceHeader*)map;
+    if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != TRACE_VERSION || header->record_size != sizeof(TraceRecord)) {
+        fprintf(stderr, "%s: not a ferry simulation trace (or written by another version)\n", path);
+        munmap(map, (size_t)info.st_size);
+        return -1;
+    }
     
-    // Process each vehicle on the ferry
-    for (int i = 0; i < ferry->vehicle_count; i++) {
-        Vehicle* vehicle = ferry->vehicles[i];
+    // Trust the file size over the header - a run that was killed never finalised it
+    const TraceRecord* records = (const TraceRecord*)(header + 1);
+    size_t count = ((size_t)info.st_size - sizeof(TraceHeader)) / sizeof(TraceRecord);
+    if (header->record_count > 0 && (size_t)header->record_count < count) {
+        count = (size_t)header->record_count;
+    }
+    
+    int fleet = header->num_cars + header->num_minibuses + header->num_trucks;
+    int max_trip = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (records[i].trip_number > max_trip) {
+            max_trip = records[i].trip_number;
+        }
+    }
+    
+    ReplayVehicle* vehicles = (ReplayVehicle*)calloc((size_t)fleet + 1, sizeof(ReplayVehicle));
+    ReplayTrip* trips = (ReplayTrip*)calloc((size_t)max_trip + 1, sizeof(ReplayTrip));
+    int64_t* loading_start = (int64_t*)malloc(((size_t)header->num_ferries + 1) * sizeof(int64_t));
+    if (!vehicles || !trips || !loading_start) {
+        perror("Failed to allocate memory for trace replay");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i <= fleet; i++) {
+        vehicles[i].last_event = -1;
+    }
+    for (int i = 0; i <= max_trip; i++) {
+        trips[i].ferry = -1;
+        trips[i].arrive_ns = -1;
+    }
+    for (int i = 0; i <= header->num_ferries; i++) {
+        loading_start[i] = -1;
+    }
+    
+    int departures = 0, loaded_departures = 0, full_departures = 0, trips_completed = 0;
+    long long quota_carried = 0;
+    int64_t last_time_ns = 0;
+    size_t skipped = 0;
+    
+    // One pass in record order rebuilds every vehicle's stamps and every crossing
+    for (size_t i = 0; i < count; i++) {
+        const TraceRecord* r = &records[i];
+        int is_ferry_event = r->event == TRACE_FERRY_DEPART || r->event == TRACE_FERRY_ARRIVE;
+        if (r->event >= TRACE_EVENT_COUNT || r->leg > 1 ||
+            (is_ferry_event ? (r->id < 0 || r->id >= header->num_ferries || r->trip_number < 1 ||
+                              r->unit < 0 || r->unit >= MAX_TERMINALS)
+                            : (r->id < 1 || r->id > fleet))) {
+            skipped++;
+            continue;
+        }
+        if (r->time_ns > last_time_ns) {
+            last_time_ns = r->time_ns;
+        }
         
-        // Different handling for outbound vs return trips
-        if (vehicle->is_transported == 0) {
-            // First journey (outbound) completed
-            vehicle->unload_time = current_time;
-            vehicle->is_transported = 1; // Mark as completed first leg
-            strcpy(vehicle->current_side, current_location->name); // Update current side
-            
-            // Calculate journey times for this trip
-            double total_transit_time = difftime(vehicle->unload_time, vehicle->arrival_time);
-            double ferry_ride_time = difftime(vehicle->unload_time, vehicle->boarding_time);
-            
-            // Report individual vehicle stats
-            printf("  - %s_%d transported (outbound): Total time: %.1f sec, Ferry ride: %.1f sec\n",
-                   vehicle->type_name, vehicle->id, total_transit_time, ferry_ride_time);
-            
-            // Vehicles spend time at destination for activities 
-            // Simulate vehicle activities at destination (shopping, business, etc.)
-            vehicle->errand_time = 10 + (rand() % 21); // 10-30 seconds
-            vehicle->ready_for_return = 1;
-            
-            // Report how long vehicle will stay at destination
-            printf("%s_%d will spend %d seconds at %s before returning to %s\n", 
-                   vehicle->type_name, vehicle->id, 
-                   vehicle->errand_time,
-                   current_location->name, 
-                   strcmp(current_location->name, "Side_A") == 0 ? "Side_B" : "Side_A");
-            
-        } else if (vehicle->is_transported == 1) {
-            // Return journey completed - full round trip done!
-            vehicle->complete_time = current_time;
-            vehicle->is_transported = 2; // Mark as having completed round trip
-            
-            // Calculate total round trip stats
-            double outbound_time = difftime(vehicle->unload_time, vehicle->arrival_time);
-            double return_time = difftime(vehicle->complete_time, vehicle->arrival_time_return);
-            double total_round_trip = difftime(vehicle->complete_time, vehicle->arrival_time);
-            
-            printf("  - %s_%d completed round trip: Outbound: %.1f sec, Return: %.1f sec, Total: %.1f sec\n",
-                   vehicle->type_name, vehicle->id, outbound_time, return_time, total_round_trip);
-            
-            // Record the completed vehicle for final stats
-            record_transported_vehicle(vehicle);
+        if (is_ferry_event) {
+            ReplayTrip* trip = &trips[r->trip_number];
+            if (r->event == TRACE_FERRY_DEPART) {
+                trip->ferry = r->id;
+                trip->from_side = r->side;
+                trip->to_side = r->unit;
+                trip->depart_ns = r->time_ns;
+                trip->vehicles = r->vehicles;
+                trip->quota = r->quota;
+                trip->loading_start_ns = r->vehicles > 0 ? loading_start[r->id] : -1;
+                loading_start[r->id] = -1;
+                
+                departures++;
+                quota_carried += r->quota;
+                if (r->vehicles > 0) loaded_departures++;
+                if (r->quota == header->ferry_capacity) full_departures++;
+            } else {
+                trip->arrive_ns = r->time_ns;
+                trips_completed++;
+            }
+            continue;
+        }
+        
+        ReplayVehicle* v = &vehicles[r->id];
+        v->type = r->vehicle_type;
+        v->last_event = r->event;
+        switch (r->event) {
+            case TRACE_ARRIVAL:
+                v->arrival_ns[r->leg] = r->time_ns;
+                break;
+            case TRACE_BOARDING:
+                v->boarding_ns[r->leg] = r->time_ns;
+                if (r->unit >= 0 && r->unit < header->num_ferries && loading_start[r->unit] < 0) {
+                    loading_start[r->unit] = r->time_ns;
+                }
+                break;
+            case TRACE_UNLOAD:
+                v->unload_ns = r->time_ns;
+                break;
+            case TRACE_COMPLETE:
+                v->complete_ns = r->time_ns;
+                break;
+            default:
+                break;
         }
     }
     
-    // Track total completed round trips for the report
+    // Vehicles past their outbound crossing count as transported, as in the live report
+    int transported[TRUCK + 1] = { 0, 0, 0, 0 };
+    int initial[TRUCK + 1] = { 0, header->num_cars, header->num_minibuses, header->num_trucks };
     int completed_round_trips = 0;
-    for (int i = 0; i < ferry->vehicle_count; i++) {
-        if (ferry->vehicles[i]->is_transported == 2) {
+    double total_outbound = 0, total_return = 0, total_round_trip = 0, total_boarding_wait = 0;
+    double outbound_by_type[TRUCK + 1] = { 0, 0, 0, 0 };
+    int completed_by_type[TRUCK + 1] = { 0, 0, 0, 0 };
+    
+    for (int id = 1; id <= fleet; id++) {
+        ReplayVehicle* v = &vehicles[id];
+        if (v->last_event < TRACE_UNLOAD || v->type < CAR || v->type > TRUCK) {
+            continue;
+        }
+        transported[v->type]++;
+        
+        if (v->last_event == TRACE_COMPLETE) {
+            double outbound = (v->unload_ns - v->arrival_ns[0]) / 1e9;
             completed_round_trips++;
+            total_outbound += outbound;
+            total_return += (v->complete_ns - v->arrival_ns[1]) / 1e9;
+            total_round_trip += (v->complete_ns - v->arrival_ns[0]) / 1e9;
+            total_boarding_wait += (v->boarding_ns[0] - v->arrival_ns[0] +
+                                    v->boarding_ns[1] - v->arrival_ns[1]) / 2e9;
+            outbound_by_type[v->type] += outbound;
+            completed_by_type[v->type]++;
         }
     }
     
-    pthread_mutex_lock(&mutex);
-    total_vehicles_transported += completed_round_trips;
-    pthread_mutex_unlock(&mutex);
+    int64_t duration_ns = header->duration_ns > 0 ? header->duration_ns : last_time_ns;
+    long long transported_quotas = 0, total_quotas = 0;
+    for (int type = CAR; type <= TRUCK; type++) {
+        transported_quotas += (long long)transported[type] * type;
+        total_quotas += (long long)initial[type] * type;
+    }
+    int policy = header->loading_policy >= 0 && header->loading_policy < LOADING_POLICY_COUNT ?
+                 header->loading_policy : LOADING_FIFO;
     
-    // Simulate the time it takes to unload
-    int unload_time = ferry->vehicle_count * 500000; // 0.5 seconds per vehicle
-    pthread_mutex_unlock(&ferry->mutex);
+    printf("\n======================== TRACE REPLAY REPORT ========================\n");
+    printf("Trace: %s (%zu events, %s clock)\n", path, count,
+           header->virtual_clock ? "virtual" : "real-time");
+    if (skipped > 0) {
+        printf("Skipped %zu malformed records\n", skipped);
+    }
+    printf("Total simulation time: %.3f seconds\n", duration_ns / 1e9);
+    printf("Number of trips completed: %d\n", trips_completed);
     
-    usleep(unload_time);
+    printf("\nTransported Vehicles:\n");
+    printf("  Total: %d / %d vehicles (%.1f%%)\n",
+           completed_round_trips, fleet, (double)completed_round_trips / fleet * 100.0);
+    printf("  Cars: %d / %d vehicles\n", transported[CAR], initial[CAR]);
+    printf("  Minibuses: %d / %d vehicles\n", transported[MINIBUS], initial[MINIBUS]);
+    printf("  Trucks: %d / %d vehicles\n", transported[TRUCK], initial[TRUCK]);
     
-    pthread_mutex_lock(&ferry->mutex);
+    printf("\nQuota Usage:\n");
+    printf("  Total quotas transported: %lld / %lld (%.1f%%)\n",
+           transported_quotas, total_quotas, (double)transported_quotas / total_quotas * 100.0);
     
-    // Set up vehicles for their time at the destination
-                // Create separate thread for each vehicle to handle destination activities
-    for (int i = 0; i < ferry->vehicle_count; i++) {
-        Vehicle* vehicle = ferry->vehicles[i];
-        if (vehicle->is_transported == 1 && vehicle->ready_for_return) {
-            // Create info struct to pass to the errand thread
-            ErrandInfo* info = (ErrandInfo*)malloc(sizeof(ErrandInfo));
-            info->vehicle = vehicle;
-            info->location = current_location;
-            info->delay_seconds = vehicle->errand_time;
-            
-            // Start a detached thread so it can run independently
-            pthread_t errand_thread;
-            pthread_create(&errand_thread, NULL, vehicle_errand_handler, info);
-            
-            // Thread cleans itself up when done
-            pthread_detach(errand_thread);
-        } else if (vehicle->is_transported == 2) {
-            // Free memory for completed vehicles
-            destroy_vehicle(vehicle);
-        }
+    printf("\nFerry Utilisation (loading policy: %s):\n", loading_policy_names[policy]);
+    printf("  Departures: %d (%d with vehicles, %d at full capacity)\n",
+           departures, loaded_departures, full_departures);
+    if (departures > 0) {
+        printf("  Average utilisation per trip: %.1f%%\n",
+               (double)quota_carried / ((double)departures * header->ferry_capacity) * 100.0);
+    }
+    if (loaded_departures > 0) {
+        printf("  Average utilisation per loaded trip: %.1f%%\n",
+               (double)quota_carried / ((double)loaded_departures * header->ferry_capacity) * 100.0);
     }
     
-    // Reset the ferry
-    ferry->vehicle_count = 0;
-    ferry->current_load = 0;
-    ferry->is_unloading = 0;
+    if (completed_round_trips > 0) {
+        printf("\nAverage Transport Times:\n");
+        printf("  All vehicles (outbound): %.3f seconds\n", total_outbound / completed_round_trips);
+        printf("  All vehicles (return): %.3f seconds\n", total_return / completed_round_trips);
+        printf("  All vehicles (round trip): %.3f seconds\n", total_round_trip / completed_round_trips);
+        printf("  All vehicles (wait before boarding, per leg): %.3f seconds\n",
+               total_boarding_wait / completed_round_trips);
+        if (completed_by_type[CAR] > 0)
+            printf("  Cars (outbound): %.3f seconds\n", outbound_by_type[CAR] / completed_by_type[CAR]);
+        if (completed_by_type[MINIBUS] > 0)
+            printf("  Minibuses (outbound): %.3f seconds\n", outbound_by_type[MINIBUS] / completed_by_type[MINIBUS]);
+        if (completed_by_type[TRUCK] > 0)
+            printf("  Trucks (outbound): %.3f seconds\n", outbound_by_type[TRUCK] / completed_by_type[TRUCK]);
+        
+        if (trips_completed > 0) {
+            printf("\nVehicles per Trip: %.2f vehicles/trip\n", (double)completed_round_trips / trips_completed);
+        }
+        printf("Completed Round Trips: %d / %d (%.1f%%)\n",
+               completed_round_trips, fleet, (double)completed_round_trips / fleet * 100.0);
+    }
     
-    printf("Ferry has been completely unloaded\n");
+    printf("\n=========================== TRIP TIMELINE ===========================\n");
+    printf("+--------+----------+------------------+------------+------------+------------+----------+---------+\n");
+    printf("| Trip # | Ferry    | Route            | Loading(s) | Depart(s)  | Arrive(s)  | Vehicles | Quota   |\n");
+    printf("+--------+----------+------------------+------------+------------+------------+----------+---------+\n");
+    for (int t = 1; t <= max_trip; t++) {
+        ReplayTrip* trip = &trips[t];
+        if (trip->ferry < 0) {
+            continue;
+        }
+        
+        char ferry_name[MAX_NAME_LENGTH];
+        char route[MAX_NAME_LENGTH];
+        char loading[16] = "-";
+        char arrive[16] = "crossing";
+        snprintf(ferry_name, sizeof(ferry_name), "Ferry_%d", trip->ferry + 1);
+        snprintf(route, sizeof(route), "%s -> %s", side_names[trip->from_side % MAX_TERMINALS],
+                 side_names[trip->to_side % MAX_TERMINALS]);
+        if (trip->loading_start_ns >= 0) {
+            snprintf(loading, sizeof(loading), "%.3f", trip->loading_start_ns / 1e9);
+        }
+        if (trip->arrive_ns >= 0) {
+            snprintf(arrive, sizeof(arrive), "%.3f", trip->arrive_ns / 1e9);
+        }
+        
+        printf("| %6d | %-8s | %-16s | %10s | %10.3f | %10s | %8d | %7d |\n",
+               t, ferry_name, route, loading, trip->depart_ns / 1e9, arrive,
+               trip->vehicles, trip->quota);
+    }
+    printf("+--------+----------+------------------+------------+------------+------------+----------+---------+\n");
     
-    pthread_mutex_unlock(&ferry->mutex);
+    free(vehicles);
+    free(trips);
+    free(loading_start);
+    munmap(map, (size_t)info.st_size);
+    return 0;
 }
 
-/* Handles ferry journey between city sides */
-void travel(Ferry* ferry, CityPart* destination) {
-    // Static variables track first trips for each direction
-    static int first_outbound_completed = 0;  // A->B first trip
-    static int first_return_completed = 0;    // B->A first return
-    
-    pthread_mutex_lock(&ferry->mutex);
+/**
+ * Configuration functions implementation
+ */
+
+/* Number of vehicles in the configured fleet */
+int total_fleet_size() {
+    return config.num_cars + config.num_minibuses + config.num_trucks;
+}
+
+/* Index of name in an option's value names - returns count if unknown */
+int parse_option_name(const char* name, const char* const* names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0) {
+            return i;
+        }
+    }
+    return count;
+}
+
+/* Parses a non-negative integer option value - returns -1 if invalid */
+int parse_config_int(const char* value) {
+    char* end;
+    long number = strtol(value, &end, 10);
+    if (end == value || *end != '\0' || number < 0 || number > 100000000L) {
+        return -1;
+    }
+    return (int)number;
+}
+
+/* Applies one key/value setting - shared by the command line and config files.
+ * Returns 0 on success, -1 for an unknown key or invalid value. */
+int apply_config_option(SimConfig* cfg, const char* key, const char* value) {
+    int* target = NULL;
     
-    ferry->is_moving = 1;
-    char source_name[MAX_NAME_LENGTH];
-    strcpy(source_name, ferry->location->name);
+    // Options that take a name instead of a number
+    if (strcmp(key, "loading-policy") == 0) {
+        LoadingPolicy policy = parse_loading_policy(value);
+        if (policy == LOADING_POLICY_COUNT) {
+            fprintf(stderr, "Invalid value for %s: %s (expected fifo, greedy or exact)\n", key, value);
+            return -1;
+        }
+        cfg->loading_policy = policy;
+        return 0;
+    }
+    if (strcmp(key, "log-level") == 0) {
+        int level = parse_option_name(value, log_level_names, LOG_LEVEL_COUNT);
+        if (level == LOG_LEVEL_COUNT) {
+            fprintf(stderr, "Invalid value for %s: %s (expected silent, summary, info or debug)\n",
+                    key, value);
+            return -1;
+        }
+        cfg->log_level = (LogLevel)level;
+        return 0;
+    }
+    if (strcmp(key, "departure-policy") == 0) {
+        int policy = parse_option_name(value, departure_policy_names, DEPARTURE_POLICY_COUNT);
+        if (policy == DEPARTURE_POLICY_COUNT) {
+            fprintf(stderr, "Invalid value for %s: %s (expected rules or adaptive)\n", key, value);
+            return -1;
+        }
+        cfg->departure_policy = (DeparturePolicy)policy;
+        return 0;
+    }
+    if (strcmp(key, "topology") == 0) {
+        int topology = parse_option_name(value, topology_names, TOPOLOGY_COUNT);
+        if (topology == TOPOLOGY_COUNT) {
+            fprintf(stderr, "Invalid value for %s: %s (expected line, ring or star)\n", key, value);
+            return -1;
+        }
+        cfg->topology = (Topology)topology;
+        return 0;
+    }
+    if (strcmp(key, "trace") == 0 || strcmp(key, "replay") == 0 || strcmp(key, "latency-export") == 0 ||
+        strcmp(key, "stats-file") == 0 || strcmp(key, "batch") == 0 || strcmp(key, "bench") == 0 ||
+        strcmp(key, "arrival-file") == 0 || strcmp(key, "trip-export") == 0 ||
+        strcmp(key, "checkpoint") == 0 || strcmp(key, "resume") == 0) {
+        char* path = strcmp(key, "trace") == 0 ? cfg->trace_file :
+                     strcmp(key, "checkpoint") == 0 ? cfg->checkpoint_file :
+                     strcmp(key, "resume") == 0 ? cfg->resume_file :
+                     strcmp(key, "replay") == 0 ? cfg->replay_file :
+                     strcmp(key, "trip-export") == 0 ? cfg->trip_export :
+                     strcmp(key, "stats-file") == 0 ? cfg->stats_file :
+                     strcmp(key, "batch") == 0 ? cfg->batch_file :
+                     strcmp(key, "arrival-file") == 0 ? cfg->arrival_file :
+                     strcmp(key, "bench") == 0 ? cfg->bench_file : cfg->latency_export;
+        if (value[0] == '\0' || strlen(value) >= MAX_CONFIG_LINE) {
+            fprintf(stderr, "Invalid value for %s: %s\n", key, value);
+            return -1;
+        }
+        strcpy(path, value);
+        return 0;
+    }
     
-    // Special case: First B->A return trip after first A->B
-    int is_first_return = (first_outbound_completed == 1 && 
-                          !first_return_completed &&
-                          strcmp(source_name, "Side_B") == 0 && 
-                          strcmp(destination->name, "Side_A") == 0);
+    if (strcmp(key, "cars") == 0) target = &cfg->num_cars;
+    else if (strcmp(key, "minibuses") == 0) target = &cfg->num_minibuses;
+    else if (strcmp(key, "trucks") == 0) target = &cfg->num_trucks;
+    else if (strcmp(key, "capacity") == 0) target = &cfg->ferry_capacity;
+    else if (strcmp(key, "booths") == 0) target = &cfg->booths_per_side;
+    else if (strcmp(key, "ferries") == 0) target = &cfg->num_ferries;
+    else if (strcmp(key, "errand-workers") == 0) target = &cfg->errand_workers;
+    else if (strcmp(key, "time") == 0) target = &cfg->simulation_time;
+    else if (strcmp(key, "queue-capacity") == 0) target = &cfg->queue_capacity;
+    else if (strcmp(key, "virtual-clock") == 0) target = &cfg->virtual_clock;
+    else if (strcmp(key, "pin-threads") == 0) target = &cfg->pin_threads;
+    else if (strcmp(key, "stats-interval") == 0) target = &cfg->stats_interval;
+    else if (strcmp(key, "seed") == 0) target = &cfg->seed;
+    else if (strcmp(key, "batch-jobs") == 0) target = &cfg->batch_jobs;
+    else if (strcmp(key, "batch-runs") == 0) target = &cfg->batch_runs;
+    else if (strcmp(key, "bench-max-vehicles") == 0) target = &cfg->bench_max_vehicles;
+    else if (strcmp(key, "bench-real-time") == 0) target = &cfg->bench_real_time;
+    else if (strcmp(key, "terminals") == 0) target = &cfg->num_terminals;
+    else if (strcmp(key, "arrival-rate") == 0) target = &cfg->arrival_rate;
+    else if (strcmp(key, "latency-budget") == 0) target = &cfg->latency_budget;
+    else if (strcmp(key, "booths-max") == 0) target = &cfg->booths_max;
+    else if (strcmp(key, "booth-open-queue") == 0) target = &cfg->booth_open_queue;
+    else if (strcmp(key, "booth-close-queue") == 0) target = &cfg->booth_close_queue;
+    else if (strcmp(key, "booth-open-wait") == 0) target = &cfg->booth_open_wait;
+    else if (strcmp(key, "checkpoint-interval") == 0) target = &cfg->checkpoint_interval;
     
-    // For first return, unload vehicles first before empty return
-    if (is_first_return && ferry->vehicle_count > 0) {
-        printf("Unloading vehicles before first empty return trip\n");
-        pthread_mutex_unlock(&ferry->mutex);
-        unload_ferry(ferry);
-        pthread_mutex_lock(&ferry->mutex);
+    if (!target) {
+        fprintf(stderr, "Unknown configuration option: %s\n", key);
+        return -1;
     }
     
-    // Special message for first return trip
-    if (is_first_return) {
-        printf("First return trip: Ferry returning empty from %s to %s\n", 
-               source_name, destination->name);
-        first_return_completed = 1;  // Mark first return as completed
-    } else {
-        // Normal travel message
-        printf("Ferry departing from %s to %s (Trip #%d)\n", 
-               source_name, destination->name, trip_count+1);
+    int number = parse_config_int(value);
+    if (number < 0) {
+        fprintf(stderr, "Invalid value for %s: %s\n", key, value);
+        return -1;
     }
     
-    pthread_mutex_unlock(&ferry->mutex);
-    
-    // Simulate travel time (3-5 seconds)
-    int travel_time = 3000000 + rand() % 2000000; // microseconds
-    usleep(travel_time);
-    
-    pthread_mutex_lock(&ferry->mutex);
+    *target = number;
+    return 0;
+}
+
+/* Loads "key = value" lines from a file; blank lines and '#' comments are ignored */
+int load_config_file(SimConfig* cfg, const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open configuration file");
+        return -1;
+    }
     
-    // Arrive at destination
-    dock_at(ferry, destination);
-    ferry->is_moving = 0;
+    char line[MAX_CONFIG_LINE];
+    int line_number = 0;
+    int result = 0;
     
-    // Special handling for first A->B trip
-    if (strcmp(source_name, "Side_A") == 0 && strcmp(destination->name, "Side_B") == 0) {
-        trip_count++;
-        printf("Trip #%d completed: %s -> %s\n", trip_count, source_name, destination->name);
-        
-        if (!first_outbound_completed) {
-            first_outbound_completed = 1;  // Now first trip is complete
-            printf("First outbound trip completed. Vehicles will spend some time at %s before returning.\n", 
-                   ferry->location->name);
-        }
-    } else if (strcmp(source_name, "Side_B") == 0 && strcmp(destination->name, "Side_A") == 0) {
-        // B->A return trip
-        if (first_return_completed) {  // Not the first empty return
-            trip_count++;
-            printf("Trip #%d completed: %s -> %s\n", trip_count, source_name, destination->name);
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        line_number++;
+        
+        // Strip comments and the trailing newline
+        line[strcspn(line, "#\r\n")] = '\0';
+        
+        char key[MAX_CONFIG_LINE];
+        char value[MAX_CONFIG_LINE];
+        char extra;
+        int fields = sscanf(line, " %[^= \t] = %s %c", key, value, &extra);
+        if (fields <= 0) {
+            continue; // Blank or comment-only line
+        }
+        if (fields != 2) {
+            fprintf(stderr, "%s:%d: expected \"key = value\"\n", path, line_number);
+            result = -1;
         } else {
-            // First return, increment trip but print complete message
-            trip_count++;
-            printf("Trip #%d completed: %s -> %s\n", trip_count, source_name, destination->name);
+            result = apply_config_option(cfg, key, value);
         }
     }
     
-    pthread_mutex_unlock(&ferry->mutex);
+    fclose(file);
+    return result;
 }
 
-/* The ferry operates as an independent thread */
-void* ferry_operation(void* arg) {
-    Ferry* ferry = (Ferry*)arg;
-    ferry->is_running = 1;
-    
-    // First trip variables, matching travel function's tracking
-    static int first_outbound_completed = 0;  // A->B first trip
-    static int first_return_completed = 0;    // B->A first return
-    
-    // Message state variables to avoid spam
-    int last_waiting_message = 0;
-    time_t last_message_time = 0;
-    
-    while (simulation_running) {
-        // If ferry has vehicles, check if ready to depart
-        if (ferry->vehicle_count > 0 && can_depart(ferry)) {
-            // Determine destination - alternate between sides
-            CityPart* destination = (ferry->location == &side_a) ? &side_b : &side_a;
-            
-            // Small delay for any last-minute vehicles
-            usleep(500000); // 0.5 second
-            
-            // Double-check status in case something changed
-            if (ferry->vehicle_count > 0 && can_depart(ferry)) {
-                // Travel to destination
-                travel(ferry, destination);
-                
-                // First trip logic handled in travel function
-                
-                // Unload vehicles at destination
-                unload_ferry(ferry);
-                
-                // Reset message state since ferry moved
-                last_waiting_message = 0;
-            }
+/* Checks that the configuration describes a runnable simulation */
+int validate_config(const SimConfig* cfg) {
+    if (cfg->num_cars + cfg->num_minibuses + cfg->num_trucks == 0) {
+        fprintf(stderr, "The fleet must contain at least one vehicle\n");
+        return -1;
+    }
+    if (cfg->ferry_capacity < TRUCK) {
+        fprintf(stderr, "Ferry capacity must be at least %d quotas so a truck fits\n", TRUCK);
+        return -1;
+    }
+    if (cfg->booths_per_side < 1) {
+        fprintf(stderr, "Each side needs at least one toll booth\n");
+        return -1;
+    }
+    if (cfg->booths_max != 0 && cfg->booths_max < cfg->booths_per_side) {
+        fprintf(stderr, "booths-max must be at least the %d booths that are always open\n", cfg->booths_per_side);
+        return -1;
+    }
+    if (cfg->booth_close_queue >= cfg->booth_open_queue) {
+        fprintf(stderr, "booth-close-queue must be below booth-open-queue, or booths would open and close in turn\n");
+        return -1;
+    }
+    if (cfg->num_terminals < 2 || cfg->num_terminals > MAX_TERMINALS) {
+        fprintf(stderr, "The network needs between 2 and %d terminals\n", MAX_TERMINALS);
+        return -1;
+    }
+    int route_count = cfg->num_terminals - 1 + (cfg->topology == TOPOLOGY_RING && cfg->num_terminals > 2);
+    if (cfg->num_ferries < route_count) {
+        fprintf(stderr, "Every route needs at least one ferry (%d routes)\n", route_count);
+        return -1;
+    }
+    if (cfg->errand_workers < 1) {
+        fprintf(stderr, "At least one errand worker thread is needed\n");
+        return -1;
+    }
+    if (cfg->simulation_time < 1) {
+        fprintf(stderr, "Simulation time must be at least 1 second\n");
+        return -1;
+    }
+    if (cfg->stats_interval < 1) {
+        fprintf(stderr, "The stats interval must be at least 1 second\n");
+        return -1;
+    }
+    if (cfg->batch_runs < 1) {
+        fprintf(stderr, "Every batch line needs at least one run\n");
+        return -1;
+    }
+    if (cfg->arrival_rate > 0 && cfg->arrival_file[0]) {
+        fprintf(stderr, "Use either an arrival rate or an arrival file, not both\n");
+        return -1;
+    }
+    // A resumed run takes the virtual clock from its checkpoint
+    if (cfg->checkpoint_file[0] && !cfg->virtual_clock && !cfg->resume_file[0]) {
+        fprintf(stderr, "Checkpoints need the virtual clock (--virtual-clock)\n");
+        return -1;
+    }
+    if ((cfg->checkpoint_file[0] || cfg->resume_file[0]) && (cfg->batch_file[0] || cfg->bench_file[0])) {
+        fprintf(stderr, "Checkpoints are written and resumed by single runs, not in a batch or benchmark\n");
+        return -1;
+    }
+    return 0;
+}
+
+/* Prints the supported command line options */
+void print_usage(const char* program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  --config=FILE        Load \"key = value\" settings from FILE (keys as below, without --)\n");
+    printf("  --cars=N             Number of cars (default %d)\n", DEFAULT_NUM_CARS);
+    printf("  --minibuses=N        Number of minibuses (default %d)\n", DEFAULT_NUM_MINIBUSES);
+    printf("  --trucks=N           Number of trucks (default %d)\n", DEFAULT_NUM_TRUCKS);
+    printf("  --capacity=N         Ferry capacity in quotas (default %d)\n", DEFAULT_FERRY_CAPACITY);
+    printf("  --booths=N           Toll booths per side, always open (default %d)\n", DEFAULT_TOLL_BOOTHS);
+    printf("  --booths-max=N       Booths a side may open when its queue grows (default: --booths, fixed)\n");
+    printf("  --booth-open-queue=N Open a booth above N queued vehicles per open booth (default %d)\n", DEFAULT_BOOTH_OPEN_QUEUE);
+    printf("  --booth-close-queue=N Close one at N or fewer per remaining booth (default %d)\n", DEFAULT_BOOTH_CLOSE_QUEUE);
+    printf("  --booth-open-wait=N  Also open one when the front vehicle queued N seconds (default %d)\n", DEFAULT_BOOTH_OPEN_WAIT);
+    printf("  --ferries=N          Ferries in the fleet, dealt out to the routes in turn (default %d)\n", DEFAULT_NUM_FERRIES);
+    printf("  --terminals=N        Terminals in the network, 2-%d (default 2, a single route)\n", MAX_TERMINALS);
+    printf("  --topology=T         line, ring or star (hub at Side_A) routes between the terminals (default line)\n");
+    printf("  --errand-workers=N   Threads returning vehicles from errands (default %d)\n", DEFAULT_ERRAND_WORKERS);
+    printf("  --time=N             Maximum simulation time in seconds (default %d)\n", DEFAULT_SIMULATION_TIME);
+    printf("  --queue-capacity=N   Per-side queue limit (default: whole fleet)\n");
+    printf("  --arrival-rate=N     Vehicles arrive at each terminal over time, N per hour (Poisson)\n");
+    printf("  --arrival-file=FILE  Vehicles arrive as recorded in FILE (time_seconds,side,type lines)\n");
+    printf("  --loading-policy=P   fifo, greedy (largest first) or exact (best fill) (default fifo)\n");
+    printf("  --departure-policy=P rules (fixed rule cascade) or adaptive (arrival-rate based) (default rules)\n");
+    printf("  --latency-budget=N   Adaptive departures: longest expected wait to fill up, seconds (default %d)\n", DEFAULT_LATENCY_BUDGET);
+    printf("  --log-level=L        silent, summary, info or debug (default info)\n");
+    printf("  --trace=FILE         Record every vehicle and ferry event to a binary trace FILE\n");
+    printf("  --replay=FILE        Rebuild the report and trip timelines from a trace, then exit\n");
+    printf("  --latency-export=FILE Write latency percentiles as CSV (JSON if FILE ends in .json)\n");
+    printf("  --trip-export=FILE    Write one CSV line per ferry crossing\n");
+    printf("  --stats-file=FILE     Publish live metrics in Prometheus text format to FILE\n");
+    printf("  --stats-interval=N    Seconds between live metrics snapshots (default 1)\n");
+    printf("  --seed=N              Random seed (default: current time)\n");
+    printf("  --batch=FILE          Run one simulation per line of FILE (options as key=value) in parallel\n");
+    printf("  --batch-jobs=N        Simulations run at once (default: one per CPU)\n");
+    printf("  --batch-runs=N        Runs of every batch line, seeds seed..seed+N-1 (default 1)\n");
+    printf("  --bench=FILE          Benchmark the simulator at growing fleet sizes, write JSON to FILE\n");
+    printf("  --bench-max-vehicles=N Largest benchmark fleet (default 1000000)\n");
+    printf("  --bench-real-time=N   Seconds per real-time benchmark case, 0 = skip them (default 10)\n");
+    printf("  --virtual-clock      Run on a simulated timeline (discrete-event engine, no real sleeping)\n");
+    printf("  --pin-threads        Pin booth and ferry threads to the CPUs in turn (Linux only)\n");
+    printf("  --checkpoint=FILE     Save the world state to FILE at the end of a virtual-clock run\n");
+    printf("  --checkpoint-interval=N Also save it every N simulated seconds, to FILE.<seconds>\n");
+    printf("  --resume=FILE         Continue a checkpointed run - options given here override its settings\n");
+}
+
+/* Reads options in order, so later options override earlier ones and config files */
+int parse_command_line(SimConfig* cfg, int argc, char* argv[]) {
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        
+        if (strncmp(arg, "--", 2) != 0) {
+            return -1;
+        }
+        arg += 2;
+        
+        char key[MAX_CONFIG_LINE];
+        const char* equals = strchr(arg, '=');
+        size_t key_length = equals ? (size_t)(equals - arg) : strlen(arg);
+        if (key_length == 0 || key_length >= sizeof(key)) {
+            return -1;
+        }
+        memcpy(key, arg, key_length);
+        key[key_length] = '\0';
+        
+        int result;
+        if (strcmp(key, "config") == 0) {
+            result = equals ? load_config_file(cfg, equals + 1) : -1;
+        } else if (!equals && (strcmp(key, "virtual-clock") == 0 || strcmp(key, "pin-threads") == 0)) {
+            result = apply_config_option(cfg, key, "1"); // Flag form
         } else {
-            // Ferry has no vehicles or not ready to depart
-            pthread_mutex_lock(&ferry->mutex);
-            CityPart* current_location = ferry->location;
-            pthread_mutex_unlock(&ferry->mutex);
-            
-            pthread_mutex_lock(&current_location->mutex);
-            int waiting_vehicles = current_location->waiting_area_size;
-            pthread_mutex_unlock(&current_location->mutex);
-            
-            if (waiting_vehicles > 0) {
-                // Try to load vehicles from waiting area
-                pthread_mutex_lock(&current_location->mutex);
-                
-                // Load as many vehicles as possible
-                for (int i = 0; i < current_location->waiting_area_size; i++) {
-                    Vehicle* vehicle = current_location->waiting_area[i];
-                    
-                    if (load_vehicle(ferry, vehicle)) {
-                        // Successfully loaded, remove from waiting area
-                        // Note: This shifts all elements, so index adjustment needed
-                        for (int j = i; j < current_location->waiting_area_size - 1; j++) {
-                            current_location->waiting_area[j] = current_location->waiting_area[j + 1];
-                        }
-                        current_location->waiting_area_size--;
-                        i--; // Adjust index because item was removed
-                    }
-                }
-                
-                pthread_mutex_unlock(&current_location->mutex);
-                
-                // Reset message state since vehicles were loaded
-                last_waiting_message = 0;
-            } else {
-                // No waiting vehicles, check other side
-                CityPart* other_location = (current_location == &side_a) ? &side_b : &side_a;
-                
-                pthread_mutex_lock(&other_location->mutex);
-                int other_side_waiting = other_location->waiting_area_size;
-                pthread_mutex_unlock(&other_location->mutex);
-                
-                if (other_side_waiting > 0) {
-                    // Special case for first empty return
-                    if (first_outbound_completed && !first_return_completed && current_location == &side_b) {
-                        // First empty return logic handled in travel function
-                        travel(ferry, &side_a);
-                        first_return_completed = 1;
-                        last_waiting_message = 0;
-                    } 
-                    // Normal empty journey
-                    else if (!(first_outbound_completed && !first_return_completed && current_location == &side_b)) {
-                        printf("No vehicles at %s, but %d vehicles waiting at %s. Ferry departing empty.\n", 
-                            current_location->name, other_side_waiting, other_location->name);
-                        travel(ferry, other_location);
-                        
-                        // Reset message state
-                        last_waiting_message = 0;
-                    } 
-                    // First empty return not ready yet
-                    else {
-                        // Only report waiting status periodically to avoid spam
-                        time_t current_time = time(NULL);
-                        if (last_waiting_message != 1 || difftime(current_time, last_message_time) >= 5.0) {
-                            printf("Ferry waiting at %s for first empty return trip.\n", current_location->name);
-                            last_waiting_message = 1;
-                            last_message_time = current_time;
-                        }
-                        sleep(1);
-                    }
-                } else {
-                    // No vehicles anywhere, just wait
-                    time_t current_time = time(NULL);
-                    if (last_waiting_message != 2 || difftime(current_time, last_message_time) >= 5.0) {
-                        printf("Ferry remains docked at %s - no vehicles to transport\n", current_location->name);
-                        last_waiting_message = 2;
-                        last_message_time = current_time;
-                    }
-                    sleep(1);
-                }
-            }
+            result = equals ? apply_config_option(cfg, key, equals + 1) : -1;
+        }
+        
+        if (result != 0) {
+            return -1;
         }
     }
-    
-    ferry->is_running = 0;
-    return NULL;
+    return validate_config(cfg);
 }
 
 /**
- * Main function
- */
-/**
- * Simulation functions implementation
+ * Batch runner functions implementation
+ * The world state is process-wide, so every simulation of a batch runs in its own forked
+ * process - a fully isolated instance with its own seed and configuration. At most
+ * batch_jobs processes run at once and the next run starts as soon as any finishes, so
+ * short and long runs balance across the cores. Results come back through shared memory.
  */
-
-/* Sets up the simulation environment */
-void initialize_simulation() {
-    // Initialize city sides
-    initialize_city_part(&side_a, "Side_A");
-    initialize_city_part(&side_b, "Side_B");
+/* Reads a batch file: one simulation per line, options as "key=value" separated by spaces
+ * on top of the base configuration. Returns the number of runs, or -1 on error */
+int load_batch_file(const char* path, const SimConfig* base, BatchRun** runs) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open batch file");
+        return -1;
+    }
     
-    // Initialize ferry
-    initialize_ferry(&ferry, MAX_CAPACITY);
+    // Replica k of every line uses the same seed, so settings are compared on equal footing
+    unsigned int base_seed = base->seed ? (unsigned int)base->seed : (unsigned int)time(NULL);
+    int count = 0;
+    int capacity = 0;
+    int result = 0;
+    int line_number = 0;
+    char line[MAX_CONFIG_LINE];
+    *runs = NULL;
     
-    // Randomly choose starting side (50% chance each)
-    CityPart* starting_side = (rand() % 2 == 0) ? &side_a : &side_b;
-    dock_at(&ferry, starting_side);
+    while (result == 0 && fgets(line, sizeof(line), file)) {
+        line_number++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        
+        SimConfig instance = *base;
+        instance.batch_file[0] = '\0';
+        char parameters[MAX_CONFIG_LINE];
+        strcpy(parameters, line);
+        
+        int options = 0;
+        char* save = NULL;
+        for (char* token = strtok_r(line, " \t", &save); token && result == 0;
+             token = strtok_r(NULL, " \t", &save)) {
+            char* equals = strchr(token, '=');
+            if (equals) {
+                *equals = '\0';
+            }
+            if (equals) {
+                result = apply_config_option(&instance, token, equals + 1);
+            } else if (strcmp(token, "virtual-clock") == 0 || strcmp(token, "pin-threads") == 0) {
+                result = apply_config_option(&instance, token, "1"); // Flag form
+            } else {
+                result = -1;
+            }
+            options++;
+        }
+        if (options == 0) {
+            continue;
+        }
+        if (result == 0 && (instance.batch_file[0] || instance.replay_file[0] || instance.bench_file[0])) {
+            fprintf(stderr, "batch, bench and replay cannot be used inside a batch\n");
+            result = -1;
+        }
+        if (result == 0) {
+            result = validate_config(&instance);
+        }
+        if (result != 0) {
+            fprintf(stderr, "Invalid batch line %d in %s\n", line_number, path);
+            break;
+        }
+        
+        for (int replica = 0; replica < base->batch_runs; replica++) {
+            if (count == capacity) {
+                capacity = capacity ? capacity * 2 : 16;
+                BatchRun* grown = (BatchRun*)realloc(*runs, capacity * sizeof(BatchRun));
+                if (!grown) {
+                    perror("Failed to allocate memory for batch runs");
+                    exit(EXIT_FAILURE);
+                }
+                *runs = grown;
+            }
+            BatchRun* run = &(*runs)[count++];
+            run->config = instance;
+            run->seed = (instance.seed ? (unsigned int)instance.seed : base_seed) + replica;
+            run->line = line_number;
+            run->pid = 0;
+            
+            // Trim the line for display
+            char* trimmed = parameters + strspn(parameters, " \t");
+            size_t length = strlen(trimmed);
+            while (length > 0 && (trimmed[length - 1] == ' ' || trimmed[length - 1] == '\t')) {
+                length--;
+            }
+            memcpy(run->parameters, trimmed, length);
+            run->parameters[length] = '\0';
+        }
+    }
+    fclose(file);
     
-    printf("Simulation initialized. Ferry starts at %s\n", starting_side->name);
+    if (result == 0 && count == 0) {
+        fprintf(stderr, "Batch file %s contains no simulations\n", path);
+        result = -1;
+    }
+    if (result != 0) {
+        free(*runs);
+        *runs = NULL;
+        return -1;
+    }
+    return count;
 }
 
-/* Creates the initial set of vehicles */
-void create_vehicles() {
-    int id = 1;
-    
-    // All vehicles start at ferry's initial location
-    CityPart* starting_side = ferry.location;
-    
-    printf("Creating vehicles at %s (ferry's starting location)\n", starting_side->name);
+/* Runs one simulation in the current (forked) process and records its outcome */
+void run_batch_instance(const BatchRun* run, BatchResult* result) {
+    config = run->config;
+    config.log_level = LOG_SILENT; // Parallel runs would interleave their output
+    seed_random_streams(run->seed);
     
-    // Create 12 cars
-    for (int i = 0; i < 12; i++) {
-        Vehicle* vehicle = create_vehicle(id++, CAR);
-        // Set origin and current side to match ferry location
-        strcpy(vehicle->origin, starting_side->name);
-        strcpy(vehicle->current_side, starting_side->name);
-        add_vehicle_to_queue(starting_side, vehicle);
+    clock_epoch = monotonic_ns();
+    log_start();
+    if (config.trace_file[0] && trace_open(config.trace_file) != 0) {
+        result->status = -1;
+        return;
     }
-    
-    // Create 10 minibuses
-    for (int i = 0; i < 10; i++) {
-        Vehicle* vehicle = create_vehicle(id++, MINIBUS);
-        strcpy(vehicle->origin, starting_side->name);
-        strcpy(vehicle->current_side, starting_side->name);
-        add_vehicle_to_queue(starting_side, vehicle);
+    if (config.arrival_file[0] && load_arrival_file(config.arrival_file, &config) != 0) {
+        result->status = -1;
+        return;
     }
     
-    // Create 8 trucks
-    for (int i = 0; i < 8; i++) {
-        Vehicle* vehicle = create_vehicle(id++, TRUCK);
-        strcpy(vehicle->origin, starting_side->name);
-        strcpy(vehicle->current_side, starting_side->name);
-        add_vehicle_to_queue(starting_side, vehicle);
-    }
+    initialize_simulation();
+    create_vehicles();
+    SimTime wall_start = monotonic_ns();
+    run_simulation(config.simulation_time);
+    result->wall_seconds = (double)(monotonic_ns() - wall_start) / NS_PER_SECOND;
     
-    // Randomize queue order for realistic simulation (Fisher-Yates shuffle)
-    pthread_mutex_lock(&starting_side->mutex);
-    for (int i = starting_side->queue_size - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        // Swap
-        Vehicle* temp = starting_side->vehicle_queue[i];
-        starting_side->vehicle_queue[i] = starting_side->vehicle_queue[j];
-        starting_side->vehicle_queue[j] = temp;
+    result->duration = seconds_between(end_time, start_time);
+    result->fleet_size = total_fleet_size();
+    result->vehicles_transported = total_vehicles_transported;
+    result->trips = trip_count;
+    result->utilisation = loading_stats.quota_offered > 0 ?
+                          (double)loading_stats.quota_carried / loading_stats.quota_offered * 100.0 : 0.0;
+    result->departure_wait = loading_stats.vehicles_departed > 0 ?
+                             loading_stats.departure_wait_seconds / loading_stats.vehicles_departed : 0.0;
+    const LatencyHistogram* round_trip = &latency_stats.all[LATENCY_ROUND_TRIP];
+    if (round_trip->count > 0) {
+        result->round_trip_p50 = histogram_percentile(round_trip, 50.0) / 1e9;
+        result->round_trip_p99 = histogram_percentile(round_trip, 99.0) / 1e9;
+        result->round_trip_mean = round_trip->sum / round_trip->count / 1e9;
+    }
+    result->events = atomic_load(&live_metrics.events);
+    for (int i = 0; i < LOCK_CLASS_COUNT; i++) {
+        result->lock_contended[i] = atomic_load(&lock_stats[i].contended);
+        result->lock_wait_ns[i] = atomic_load(&lock_stats[i].wait_ns);
     }
-    pthread_mutex_unlock(&starting_side->mutex);
     
-    printf("Created and randomized %d vehicles at %s\n", starting_side->queue_size, starting_side->name);
+    cleanup_simulation();
+    result->peak_rss_kb = peak_rss_kb();
+    result->status = 1;
 }
 
-/* Runs the simulation for specified time or until all vehicles are transported */
-void run_simulation(int simulation_time) {
-    simulation_running = 1;
-    start_time = time(NULL);
-    
-    // Start toll booth threads
-    start_toll_booths(&side_a);
-    start_toll_booths(&side_b);
-    
-    // Start ferry thread
-    pthread_create(&ferry.thread, NULL, ferry_operation, &ferry);
-    
-    // Calculate the maximum end time
-    time_t max_end_time = start_time + simulation_time;
-    printf("Simulation running (max %d seconds)...\n", simulation_time);
+/* Runs every simulation in its own process, at most jobs at once. Returns the results in
+ * shared memory (release with munmap), or NULL if they could not be mapped */
+BatchResult* run_batch_processes(BatchRun* runs, int count, int jobs) {
+    // Anonymous shared mapping - children write their result slot, the runner reads it
+    BatchResult* results = (BatchResult*)mmap(NULL, count * sizeof(BatchResult), PROT_READ | PROT_WRITE,
+                                              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED) {
+        perror("Failed to map batch results");
+        return NULL;
+    }
+    memset(results, 0, count * sizeof(BatchResult));
     
-    // Monitor transportation progress
-    int total_expected_vehicles = 30; // 12 cars + 10 minibuses + 8 trucks
-    int all_vehicles_transported = 0;
+    fflush(stdout); // Children must not inherit buffered output
     
-    while (!all_vehicles_transported && time(NULL) < max_end_time) {
-        // Check periodically
-        sleep(1);
-        
-        pthread_mutex_lock(&mutex);
-        if (total_vehicles_transported >= total_expected_vehicles) {
-            all_vehicles_transported = 1;
-            printf("\nAll %d vehicles have been transported!\n", total_expected_vehicles);
+    int next = 0;
+    int active = 0;
+    while (next < count || active > 0) {
+        // Keep every job slot busy
+        while (active < jobs && next < count) {
+            pid_t pid = fork();
+            if (pid < 0) {
+                perror("Failed to start a batch simulation");
+                results[next].status = -1;
+                next++;
+                continue;
+            }
+            if (pid == 0) {
+                run_batch_instance(&runs[next], &results[next]);
+                _exit(results[next].status == 1 ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+            runs[next].pid = pid;
+            next++;
+            active++;
+        }
+        if (active == 0) {
+            break;
         }
-        pthread_mutex_unlock(&mutex);
-        
-        // Check if there are no vehicles left anywhere
-        pthread_mutex_lock(&side_a.mutex);
-        pthread_mutex_lock(&side_b.mutex);
-        pthread_mutex_lock(&ferry.mutex);
-        
-        int vehicles_remaining = side_a.queue_size + side_a.waiting_area_size + 
-                                side_b.queue_size + side_b.waiting_area_size + 
-                                ferry.vehicle_count;
-                                
-        pthread_mutex_unlock(&ferry.mutex);
-        pthread_mutex_unlock(&side_b.mutex);
-        pthread_mutex_unlock(&side_a.mutex);
         
-        if (vehicles_remaining == 0 && total_vehicles_transported == total_expected_vehicles) {
-            all_vehicles_transported = 1;
-            printf("\nAll vehicles processed, no vehicles remaining in the system!\n");
+        int status;
+        pid_t finished = wait(&status);
+        if (finished < 0) {
+            perror("Failed to wait for a batch simulation");
+            break;
+        }
+        for (int i = 0; i < next; i++) {
+            if (runs[i].pid == finished) {
+                runs[i].pid = 0;
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+                    results[i].status = -1;
+                }
+                active--;
+                break;
+            }
         }
     }
+    return results;
+}
+
+/* Runs every simulation of a batch file and prints per-run and per-line results */
+int run_batch(const char* path) {
+    BatchRun* runs;
+    int count = load_batch_file(path, &config, &runs);
+    if (count < 0) {
+        return -1;
+    }
     
-    if (time(NULL) >= max_end_time) {
-        printf("\nSimulation time limit reached.\n");
+    int jobs = config.batch_jobs;
+    if (jobs <= 0) {
+        jobs = platform_cpu_count();
+    }
+    if (jobs > count) {
+        jobs = count;
     }
     
-    // Stop the simulation
-    simulation_running = 0;
+    printf("Running %d simulation%s from %s, %d at a time...\n", count, count == 1 ? "" : "s", path, jobs);
+    SimTime batch_start = monotonic_ns();
+    BatchResult* results = run_batch_processes(runs, count, jobs);
+    if (!results) {
+        free(runs);
+        return -1;
+    }
+    double wall_seconds = (double)(monotonic_ns() - batch_start) / NS_PER_SECOND;
     
-    // Wait for threads to finish
-    printf("Stopping all threads...\n");
-    pthread_join(ferry.thread, NULL);
-    for (int i = 0; i < NUM_TOLL_BOOTHS; i++) {
-        pthread_join(side_a.booths[i].thread, NULL);
-        pthread_join(side_b.booths[i].thread, NULL);
+    printf("\n==================================== BATCH RESULTS ====================================\n");
+    printf("+-----+------+------------+-----------+-------------+-------+--------+------------+------------+\n");
+    printf("| Run | Line |       Seed |  Time (s) | Transported | Trips | Util %% | RT p50 (s) | RT p99 (s) |\n");
+    printf("+-----+------+------------+-----------+-------------+-------+--------+------------+------------+\n");
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        const BatchResult* r = &results[i];
+        if (r->status != 1) {
+            printf("| %3d | %4d | %10u | %-66s |\n", i + 1, runs[i].line, runs[i].seed, "failed");
+            failed++;
+            continue;
+        }
+        printf("| %3d | %4d | %10u | %9.3f | %5d/%-5d | %5d | %6.1f | %10.3f | %10.3f |\n",
+               i + 1, runs[i].line, runs[i].seed, r->duration, r->vehicles_transported, r->fleet_size,
+               r->trips, r->utilisation, r->round_trip_p50, r->round_trip_p99);
     }
+    printf("+-----+------+------------+-----------+-------------+-------+--------+------------+------------+\n");
     
-    end_time = time(NULL);
-    generate_report();
+    // Replicas of one line are aggregated across their seeds
+    printf("\nPer line (mean over finished runs, time range in brackets):\n");
+    for (int i = 0; i < count; i++) {
+        if (i > 0 && runs[i].line == runs[i - 1].line) {
+            continue;
+        }
+        int finished = 0;
+        double duration_sum = 0.0, duration_min = 0.0, duration_max = 0.0;
+        double mean_sum = 0.0, p99_sum = 0.0, utilisation_sum = 0.0, wait_sum = 0.0;
+        for (int j = i; j < count && runs[j].line == runs[i].line; j++) {
+            const BatchResult* r = &results[j];
+            if (r->status != 1) {
+                continue;
+            }
+            if (finished == 0 || r->duration < duration_min) {
+                duration_min = r->duration;
+            }
+            if (finished == 0 || r->duration > duration_max) {
+                duration_max = r->duration;
+            }
+            finished++;
+            duration_sum += r->duration;
+            mean_sum += r->round_trip_mean;
+            p99_sum += r->round_trip_p99;
+            utilisation_sum += r->utilisation;
+            wait_sum += r->departure_wait;
+        }
+        printf("  Line %d [%s]:\n", runs[i].line, runs[i].parameters);
+        if (finished == 0) {
+            printf("    no run finished\n");
+            continue;
+        }
+        printf("    %d run%s, time %.3f s [%.3f - %.3f], round trip mean %.3f s, p99 %.3f s, utilisation %.1f%%, "
+               "wait before departure %.3f s\n",
+               finished, finished == 1 ? "" : "s", duration_sum / finished, duration_min, duration_max,
+               mean_sum / finished, p99_sum / finished, utilisation_sum / finished, wait_sum / finished);
+    }
+    printf("\n%d of %d simulations finished in %.3f seconds of wall time\n", count - failed, count, wall_seconds);
+    
+    munmap(results, count * sizeof(BatchResult));
+    free(runs);
+    return failed == 0 ? 0 : -1;
 }
 
-/* Generate a detailed statistical report after the simulation completes */
-void generate_report() {
-    double duration = difftime(end_time, start_time);
-    
-    // Count remaining vehicles at each location
-    int side_a_vehicles = side_a.queue_size + side_a.waiting_area_size;
-    int side_b_vehicles = side_b.queue_size + side_b.waiting_area_size;
-    int ferry_vehicles = ferry.vehicle_count;
+/**
+ * Benchmark functions implementation
+ * Measures the simulator itself: every case is a batch run (own process, so peak RSS is
+ * per case) executed one at a time so cases do not compete for cores. Case names are
+ * stable, so JSON files from two versions can be compared case by case.
+ */
+/* Fleet sizes of the benchmark ladder - virtual clock cases */
+static const int bench_fleet_sizes[] = { 30, 1000, 10000, 100000, 1000000 };
+/* Real-time cases are bounded by bench_real_time seconds, so only small fleets make sense */
+static const int bench_real_time_fleets[] = { 30, 300 };
+static const int bench_booth_counts[] = { 2, 8 };
+
+#define BENCH_COUNT(array) ((int)(sizeof(array) / sizeof((array)[0])))
+
+/* Peak resident set size of this process in kilobytes */
+long peak_rss_kb() {
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // Bytes on macOS
+#else
+    return usage.ru_maxrss;        // Kilobytes on Linux
+#endif
+}
+
+/* Sets up one benchmark case on top of the base configuration - same fleet mix as the defaults */
+void bench_case(BatchRun* run, int index, int vehicles, int booths, int virtual_clock) {
+    SimConfig* cfg = &run->config;
+    *cfg = config;
+    cfg->trace_file[0] = '\0';
+    cfg->latency_export[0] = '\0';
+    cfg->trip_export[0] = '\0';
+    cfg->stats_file[0] = '\0';
+    cfg->bench_file[0] = '\0';
     
-    // Count remaining vehicles by type
-    int remaining_cars = 0;
-    int remaining_minibuses = 0;
-    int remaining_trucks = 0;
+    int mix = DEFAULT_NUM_CARS + DEFAULT_NUM_MINIBUSES + DEFAULT_NUM_TRUCKS;
+    cfg->num_cars = (int)((long long)vehicles * DEFAULT_NUM_CARS / mix);
+    cfg->num_minibuses = (int)((long long)vehicles * DEFAULT_NUM_MINIBUSES / mix);
+    cfg->num_trucks = vehicles - cfg->num_cars - cfg->num_minibuses;
+    cfg->booths_per_side = booths;
+    cfg->virtual_clock = virtual_clock;
+    cfg->queue_capacity = 0;
+    // Virtual cases run until the fleet is done; real-time cases are cut off
+    cfg->simulation_time = virtual_clock ? 1000000000 : config.bench_real_time;
     
-    // Side A
-    for (int i = 0; i < side_a.queue_size; i++) {
-        switch (side_a.vehicle_queue[i]->type) {
-            case CAR: remaining_cars++; break;
-            case MINIBUS: remaining_minibuses++; break;
-            case TRUCK: remaining_trucks++; break;
+    snprintf(run->parameters, sizeof(run->parameters), "%s/vehicles=%d/booths=%d",
+             virtual_clock ? "virtual" : "real-time", vehicles, booths);
+    run->line = index + 1;
+    run->seed = config.seed ? (unsigned int)config.seed : 1; // Fixed by default - runs must be comparable
+    run->pid = 0;
+}
+
+/* Writes the benchmark results as JSON, one object per case */
+void write_bench_json(FILE* file, const BatchRun* runs, const BatchResult* results, int count) {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"benchmark\": \"ferry-simulation\",\n");
+    fprintf(file, "  \"schema\": 1,\n");
+    fprintf(file, "  \"seed\": %u,\n", count > 0 ? runs[0].seed : 0);
+    fprintf(file, "  \"ferries\": %d,\n", config.num_ferries);
+    fprintf(file, "  \"capacity\": %d,\n", config.ferry_capacity);
+    fprintf(file, "  \"loading_policy\": \"%s\",\n", loading_policy_names[config.loading_policy]);
+    fprintf(file, "  \"pin_threads\": %s,\n", config.pin_threads ? "true" : "false");
+    fprintf(file, "  \"cases\": [\n");
+    for (int i = 0; i < count; i++) {
+        const BatchRun* run = &runs[i];
+        const BatchResult* r = &results[i];
+        fprintf(file, "    {\n");
+        fprintf(file, "      \"name\": \"%s\",\n", run->parameters);
+        fprintf(file, "      \"mode\": \"%s\",\n", run->config.virtual_clock ? "virtual" : "real-time");
+        fprintf(file, "      \"vehicles\": %d,\n",
+                run->config.num_cars + run->config.num_minibuses + run->config.num_trucks);
+        fprintf(file, "      \"booths\": %d,\n", run->config.booths_per_side);
+        fprintf(file, "      \"status\": \"%s\"", r->status == 1 ? "ok" : "failed");
+        if (r->status == 1) {
+            double events_per_second = r->wall_seconds > 0.0 ? r->events / r->wall_seconds : 0.0;
+            double wall_per_hour = r->duration > 0.0 ? r->wall_seconds / (r->duration / 3600.0) : 0.0;
+            fprintf(file, ",\n");
+            fprintf(file, "      \"wall_seconds\": %.6f,\n", r->wall_seconds);
+            fprintf(file, "      \"simulated_seconds\": %.3f,\n", r->duration);
+            fprintf(file, "      \"events\": %lld,\n", r->events);
+            fprintf(file, "      \"events_per_second\": %.1f,\n", events_per_second);
+            fprintf(file, "      \"wall_seconds_per_simulated_hour\": %.6f,\n", wall_per_hour);
+            fprintf(file, "      \"peak_rss_kb\": %ld,\n", r->peak_rss_kb);
+            fprintf(file, "      \"vehicles_transported\": %d,\n", r->vehicles_transported);
+            fprintf(file, "      \"locks\": {\n");
+            for (int l = 0; l < LOCK_CLASS_COUNT; l++) {
+                fprintf(file, "        \"%s\": { \"contended\": %lld, \"wait_seconds\": %.6f }%s\n",
+                        lock_class_names[l], r->lock_contended[l], (double)r->lock_wait_ns[l] / NS_PER_SECOND,
+                        l + 1 < LOCK_CLASS_COUNT ? "," : "");
+            }
+            fprintf(file, "      }\n");
+        } else {
+            fprintf(file, "\n");
         }
+        fprintf(file, "    }%s\n", i + 1 < count ? "," : "");
+    }
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+}
+
+/* Runs the benchmark ladder, prints a summary and writes the JSON results to path */
+int run_benchmark(const char* path) {
+    int max_cases = (BENCH_COUNT(bench_fleet_sizes) + BENCH_COUNT(bench_real_time_fleets)) *
+                    BENCH_COUNT(bench_booth_counts);
+    BatchRun* runs = (BatchRun*)malloc(max_cases * sizeof(BatchRun));
+    if (!runs) {
+        perror("Failed to allocate memory for benchmark cases");
+        exit(EXIT_FAILURE);
     }
     
-    for (int i = 0; i < side_a.waiting_area_size; i++) {
-        switch (side_a.waiting_area[i]->type) {
-            case CAR: remaining_cars++; break;
-            case MINIBUS: remaining_minibuses++; break;
-            case TRUCK: remaining_trucks++; break;
+    int count = 0;
+    for (int f = 0; f < BENCH_COUNT(bench_fleet_sizes) && bench_fleet_sizes[f] <= config.bench_max_vehicles; f++) {
+        for (int b = 0; b < BENCH_COUNT(bench_booth_counts); b++) {
+            bench_case(&runs[count], count, bench_fleet_sizes[f], bench_booth_counts[b], 1);
+            count++;
         }
     }
-    
-    // Side B
-    for (int i = 0; i < side_b.queue_size; i++) {
-        switch (side_b.vehicle_queue[i]->type) {
-            case CAR: remaining_cars++; break;
-            case MINIBUS: remaining_minibuses++; break;
-            case TRUCK: remaining_trucks++; break;
+    for (int f = 0; config.bench_real_time > 0 && f < BENCH_COUNT(bench_real_time_fleets) &&
+                    bench_real_time_fleets[f] <= config.bench_max_vehicles; f++) {
+        for (int b = 0; b < BENCH_COUNT(bench_booth_counts); b++) {
+            bench_case(&runs[count], count, bench_real_time_fleets[f], bench_booth_counts[b], 0);
+            count++;
         }
     }
+    if (count == 0) {
+        fprintf(stderr, "No benchmark case fits within %d vehicles\n", config.bench_max_vehicles);
+        free(runs);
+        return -1;
+    }
     
-    for (int i = 0; i < side_b.waiting_area_size; i++) {
-        switch (side_b.waiting_area[i]->type) {
-            case CAR: remaining_cars++; break;
-            case MINIBUS: remaining_minibuses++; break;
-            case TRUCK: remaining_trucks++; break;
-        }
+    printf("Running %d benchmark case%s one at a time...\n", count, count == 1 ? "" : "s");
+    BatchResult* results = run_batch_processes(runs, count, 1);
+    if (!results) {
+        free(runs);
+        return -1;
     }
     
-    // Ferry
-    for (int i = 0; i < ferry.vehicle_count; i++) {
-        switch (ferry.vehicles[i]->type) {
-            case CAR: remaining_cars++; break;
-            case MINIBUS: remaining_minibuses++; break;
-            case TRUCK: remaining_trucks++; break;
+    printf("\n================================== BENCHMARK RESULTS ==================================\n");
+    printf("+------------------------------------+-----------+------------+------------+--------------+----------+\n");
+    printf("| Case                               |  Wall (s) |    Sim (s) |   Events/s | Wall s/sim h | RSS (MB) |\n");
+    printf("+------------------------------------+-----------+------------+------------+--------------+----------+\n");
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        const BatchResult* r = &results[i];
+        if (r->status != 1) {
+            printf("| %-34s | %-61s |\n", runs[i].parameters, "failed");
+            failed++;
+            continue;
         }
+        printf("| %-34s | %9.3f | %10.1f | %10.0f | %12.4f | %8.1f |\n", runs[i].parameters,
+               r->wall_seconds, r->duration, r->wall_seconds > 0.0 ? r->events / r->wall_seconds : 0.0,
+               r->duration > 0.0 ? r->wall_seconds / (r->duration / 3600.0) : 0.0, r->peak_rss_kb / 1024.0);
     }
+    printf("+------------------------------------+-----------+------------+------------+--------------+----------+\n");
     
-    // Calculate statistics
-    int total_initial_vehicles = 30;  // Total initial vehicles (12 + 10 + 8)
-    double completion_percentage = ((double)total_vehicles_transported / total_initial_vehicles) * 100.0;
-    
-    // Calculate transported by type
-    int initial_cars = 12;
-    int initial_minibuses = 10;
-    int initial_trucks = 8;
-    
-    int transported_cars = initial_cars - remaining_cars;
-    int transported_minibuses = initial_minibuses - remaining_minibuses;
-    int transported_trucks = initial_trucks - remaining_trucks;
-    
-    printf("\n======================== FERRY SIMULATION REPORT ========================\n");
-    printf("Total simulation time: %.2f seconds\n", duration);
-    printf("Number of trips completed: %d\n", trip_count);
-    
-    printf("\nTransported Vehicles:\n");
-    printf("  Total: %d / %d vehicles (%.1f%%)\n", 
-           total_vehicles_transported, total_initial_vehicles, completion_percentage);
-    printf("  Cars: %d / %d vehicles\n", transported_cars, initial_cars);
-    printf("  Minibuses: %d / %d vehicles\n", transported_minibuses, initial_minibuses);
-    printf("  Trucks: %d / %d vehicles\n", transported_trucks, initial_trucks);
-    
-    printf("\nRemaining Vehicles:\n");
-    printf("  Total remaining vehicles: %d\n", side_a_vehicles + side_b_vehicles + ferry_vehicles);
-    printf("  Waiting at Side_A: %d (in queue: %d, in waiting area: %d)\n", 
-           side_a_vehicles, side_a.queue_size, side_a.waiting_area_size);
-    printf("  Waiting at Side_B: %d (in queue: %d, in waiting area: %d)\n", 
-           side_b_vehicles, side_b.queue_size, side_b.waiting_area_size);
-    printf("  On ferry: %d\n", ferry_vehicles);
-    printf("  Current ferry location: %s\n", ferry.location->name);
-    
-    int remaining_quotas = (remaining_cars * 1) + (remaining_minibuses * 2) + (remaining_trucks * 3);
-    int transported_quotas = (transported_cars * 1) + (transported_minibuses * 2) + (transported_trucks * 3);
-    int total_quotas = (initial_cars * 1) + (initial_minibuses * 2) + (initial_trucks * 3);
-    
-    printf("\nQuota Usage:\n");
-    printf("  Total quotas transported: %d / %d (%.1f%%)\n", 
-           transported_quotas, total_quotas, ((double)transported_quotas / total_quotas) * 100.0);
-    printf("  Total remaining quotas: %d / %d\n", remaining_quotas, total_quotas);
-    
-    // Show detailed vehicle statistics if any were transported
-    if (recorded_vehicle_count > 0) {
-        // Sort vehicles by ID for nice output
-        for (int i = 0; i < recorded_vehicle_count; i++) {
-            for (int j = i + 1; j < recorded_vehicle_count; j++) {
-                if (vehicle_records[i].id > vehicle_records[j].id) {
-                    VehicleRecord temp = vehicle_records[i];
-                    vehicle_records[i] = vehicle_records[j];
-                    vehicle_records[j] = temp;
-                }
-            }
-        }
-        
-        printf("\n==================== DETAILED VEHICLE STATISTICS ====================\n");
-        printf("+----+----------+---------+-------------+-------------+-------------+------------+-------------+\n");
-        printf("| ID | Type     | Origin  | Outbound(s) | Return(s)   | At Dest.(s) | Trip #     | Status      |\n");
-        printf("+----+----------+---------+-------------+-------------+-------------+------------+-------------+\n");
-        
-        // Calculate averages for stats
-        double total_outbound_time = 0;
-        double total_return_time = 0;
-        double total_round_trip_time = 0;
-        double car_outbound = 0, minibus_outbound = 0, truck_outbound = 0;
-        double car_return = 0, minibus_return = 0, truck_return = 0;
-        int car_count = 0, minibus_count = 0, truck_count = 0;
-        int completed_round_trips = 0;
-        
-        for (int i = 0; i < recorded_vehicle_count; i++) {
-            VehicleRecord* v = &vehicle_records[i];
-            
-            char status[20];
-            if (v->completed_round_trip) {
-                strcpy(status, "Round trip");
-                completed_round_trips++;
-            } else {
-                strcpy(status, "One-way");
-            }
-            
-            printf("| %2d | %-8s | %-7s | %11.1f | %11.1f | %11.1f | %2d → %-5d | %-11s |\n",
-                v->id, v->type_name, v->origin, 
-                v->outbound_journey_time, 
-                v->completed_round_trip ? v->return_journey_time : 0.0,
-                v->completed_round_trip ? v->time_at_destination : 0.0,
-                v->outbound_trip_number, 
-                v->completed_round_trip ? v->return_trip_number : 0,
-                status);
-            
-            // Print a separator line after each vehicle
-            printf("+----+----------+---------+-------------+-------------+-------------+------------+-------------+\n");
-            
-            // Add to averages
-            total_outbound_time += v->outbound_journey_time;
-            
-            if (v->completed_round_trip) {
-                total_return_time += v->return_journey_time;
-                total_round_trip_time += v->total_round_trip_time;
-            }
-            
-            if (strcmp(v->type_name, "CAR") == 0) {
-                car_outbound += v->outbound_journey_time;
-                if (v->completed_round_trip) {
-                    car_return += v->return_journey_time;
-                }
-                car_count++;
-            } else if (strcmp(v->type_name, "MINIBUS") == 0) {
-                minibus_outbound += v->outbound_journey_time;
-                if (v->completed_round_trip) {
-                    minibus_return += v->return_journey_time;
-                }
-                minibus_count++;
-            } else if (strcmp(v->type_name, "TRUCK") == 0) {
-                truck_outbound += v->outbound_journey_time;
-                if (v->completed_round_trip) {
-                    truck_return += v->return_journey_time;
-                }
-                truck_count++;
-            }
+    printf("\nLock wait (contended acquisitions / milliseconds blocked):\n");
+    for (int i = 0; i < count; i++) {
+        const BatchResult* r = &results[i];
+        if (r->status != 1) {
+            continue;
         }
-        
-        printf("\nAverage Transport Times:\n");
-        printf("  All vehicles (outbound): %.2f seconds\n", total_outbound_time / recorded_vehicle_count);
-        
-        if (completed_round_trips > 0) {
-            printf("  All vehicles (return): %.2f seconds\n", total_return_time / completed_round_trips);
-            printf("  All vehicles (round trip): %.2f seconds\n", total_round_trip_time / completed_round_trips);
+        printf("  %-34s", runs[i].parameters);
+        for (int l = 0; l < LOCK_CLASS_COUNT; l++) {
+            printf("  %s %lld/%.3f", lock_class_names[l], r->lock_contended[l], r->lock_wait_ns[l] / 1e6);
         }
-        
-        if (car_count > 0)
-            printf("  Cars (outbound): %.2f seconds\n", car_outbound / car_count);
-        if (minibus_count > 0)
-            printf("  Minibuses (outbound): %.2f seconds\n", minibus_outbound / minibus_count);
-        if (truck_count > 0)
-            printf("  Trucks (outbound): %.2f seconds\n", truck_outbound / truck_count);
-            
-        printf("\nVehicles per Trip: %.2f vehicles/trip\n", (double)recorded_vehicle_count / trip_count);
-        printf("Completed Round Trips: %d / %d (%.1f%%)\n", 
-            completed_round_trips, recorded_vehicle_count, 
-            ((double)completed_round_trips / recorded_vehicle_count) * 100.0);
+        printf("\n");
     }
     
-    printf("\n=================================================================\n");
+    int result = failed == 0 ? 0 : -1;
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to write benchmark results");
+        result = -1;
+    } else {
+        write_bench_json(file, runs, results, count);
+        fclose(file);
+        printf("\nBenchmark results written to %s\n", path);
+    }
+    
+    munmap(results, count * sizeof(BatchResult));
+    free(runs);
+    return result;
 }
 
-/* Free up all resources when simulation completes */
-void cleanup_simulation() {
-    // Free memory for vehicles in queues
-    for (int i = 0; i < side_a.queue_size; i++) {
-        destroy_vehicle(side_a.vehicle_queue[i]);
+int main(int argc, char* argv[]) {
+    // Parse command line options
+    if (parse_command_line(&config, argc, argv) != 0) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
     }
     
-    for (int i = 0; i < side_a.waiting_area_size; i++) {
-        destroy_vehicle(side_a.waiting_area[i]);
+    // Continue a checkpointed run - its settings first, then the command line on top
+    if (config.resume_file[0]) {
+        if (checkpoint_read_config(config.resume_file, &config) != 0) {
+            return EXIT_FAILURE;
+        }
+        if (parse_command_line(&config, argc, argv) != 0) {
+            print_usage(argv[0]);
+            return EXIT_FAILURE;
+        }
     }
     
-    for (int i = 0; i < side_b.queue_size; i++) {
-        destroy_vehicle(side_b.vehicle_queue[i]);
+    // Offline analysis of an earlier run - nothing is simulated
+    if (config.replay_file[0]) {
+        return replay_trace(config.replay_file) == 0 ? 0 : EXIT_FAILURE;
     }
     
-    for (int i = 0; i < side_b.waiting_area_size; i++) {
-        destroy_vehicle(side_b.waiting_area[i]);
+    // Parameter sweep - every simulation runs in its own process
+    if (config.batch_file[0]) {
+        return run_batch(config.batch_file) == 0 ? 0 : EXIT_FAILURE;
     }
-    
-    for (int i = 0; i < ferry.vehicle_count; i++) {
-        destroy_vehicle(ferry.vehicles[i]);
+    if (config.bench_file[0]) {
+        return run_benchmark(config.bench_file) == 0 ? 0 : EXIT_FAILURE;
     }
     
-    // Clean up thread synchronization objects
-    pthread_mutex_destroy(&side_a.mutex);
-    pthread_mutex_destroy(&side_b.mutex);
-    pthread_mutex_destroy(&ferry.mutex);
-    pthread_mutex_destroy(&mutex);
+    // Derive every random stream from one run seed
+    seed_random_streams(config.seed ? (uint64_t)config.seed : (uint64_t)time(NULL));
     
-    printf("Simulation resources cleaned up\n");
-}
-
-int main() {
-    // Initialize random number generator
-    srand(time(NULL));
+    // Start the log writer before any thread can produce messages
+    clock_epoch = monotonic_ns();
+    log_start();
+    if (config.trace_file[0] && trace_open(config.trace_file) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (config.arrival_file[0] && load_arrival_file(config.arrival_file, &config) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (config.resume_file[0] && checkpoint_check(config.resume_file) != 0) {
+        return EXIT_FAILURE;
+    }
     
-    printf("\n### FERRY TRANSPORTATION SYSTEM SIMULATION ###\n\n");
-    printf("Simulation parameters:\n");
-    printf("- Two city sides connected by a ferry route\n");
-    printf("- One ferry with capacity of 20 quotas\n");
-    printf("- 12 cars (1 quota each), 10 minibuses (2 quotas each), 8 trucks (3 quotas each)\n");
-    printf("- 2 toll booths on each side\n\n");
-    printf("Starting simulation...\n\n");
+    if (log_enabled(LOG_SUMMARY)) {
+        printf("\n### FERRY TRANSPORTATION SYSTEM SIMULATION ###\n\n");
+        printf("Simulation parameters:\n");
+        if (config.num_terminals == 2) {
+            printf("- Two city sides connected by a ferry route\n");
+        } else {
+            printf("- %d terminals connected by %s routes\n", config.num_terminals, topology_names[config.topology]);
+        }
+        printf("- %d ferr%s with capacity of %d quotas each\n",
+               config.num_ferries, config.num_ferries == 1 ? "y" : "ies", config.ferry_capacity);
+        printf("- %d cars (1 quota each), %d minibuses (2 quotas each), %d trucks (3 quotas each)\n",
+               config.num_cars, config.num_minibuses, config.num_trucks);
+        if (config.booths_max > config.booths_per_side) {
+            printf("- %d to %d toll booths on each side, opened as queues grow\n", config.booths_per_side, config.booths_max);
+        } else {
+            printf("- %d toll booths on each side\n", config.booths_per_side);
+        }
+        if (config.arrival_file[0]) {
+            printf("- Arrivals: replayed from %s\n", config.arrival_file);
+        } else if (config.arrival_rate > 0) {
+            printf("- Arrivals: Poisson, %d vehicles per hour at each terminal\n", config.arrival_rate);
+        }
+        printf("- Loading policy: %s\n", loading_policy_names[config.loading_policy]);
+        if (config.departure_policy == DEPARTURE_ADAPTIVE) {
+            printf("- Departure policy: adaptive, latency budget %d seconds\n", config.latency_budget);
+        }
+        if (config.resume_file[0]) {
+            printf("- Resumed from %s\n", config.resume_file);
+        }
+        printf("- Clock: %s\n\n", config.virtual_clock ? "virtual (discrete-event)" : "real time");
+        printf("Starting simulation...\n\n");
+    }
     
     // Run the full simulation cycle
     initialize_simulation();
-    create_vehicles();
-    run_simulation(SIMULATION_TIME);
+    if (config.resume_file[0]) {
+        if (checkpoint_restore(config.resume_file) != 0) {
+            return EXIT_FAILURE;
+        }
+    } else {
+        create_vehicles();
+    }
+    run_simulation(config.simulation_time);
     
     // Clean up when done
     cleanup_simulation();